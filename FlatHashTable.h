@@ -0,0 +1,333 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// An open addressing hash table that stores its keys and values inline, in the style of Swiss tables.
+// Next to the slots is an array of control bytes, one per slot, holding either FLAT_TABLE_EMPTY or
+// 7 bits of the key's hash, so a probe can check a whole group of slots with a couple of SIMD
+// instructions and only touch the slots whose control byte matches.
+// Slots are probed linearly, which lets removal shift the following entries back into the hole
+// instead of leaving tombstones behind. Several entries may share a key.
+// Linear probing builds long clusters as the table fills, and removal has to scan to the end of one,
+// so the table is kept at most half full.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FLAT_TABLE_GROUP_WIDTH 32
+typedef uint32_t FlatTableMask;
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLAT_TABLE_GROUP_WIDTH 16
+typedef uint32_t FlatTableMask;
+#else
+#define FLAT_TABLE_GROUP_WIDTH 8
+typedef uint64_t FlatTableMask;
+#endif
+
+// a macro because gcc treats a function that only prefetches as having no effect and drops calls to it
+#if defined(__GNUC__) || defined(__clang__)
+#define FLAT_TABLE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define FLAT_TABLE_PREFETCH(address)
+#endif
+
+#define FLAT_TABLE_EMPTY 0x80
+// the table grows once it is this full, as a fraction of 8
+#define FLAT_TABLE_MAX_LOAD_EIGHTHS 4
+
+typedef struct FlatTableSlot
+{
+    uint64_t key;
+    void *value;
+} FlatTableSlot;
+
+typedef struct FlatHashTable
+{
+    // capacity + FLAT_TABLE_GROUP_WIDTH bytes, the extra group mirrors the first
+    // so that a group can be loaded starting from any slot
+    uint8_t *control;
+    FlatTableSlot *slots;
+    // always a power of two
+    size_t capacity;
+    size_t count;
+    int shift;
+} FlatHashTable;
+
+// for every control byte in the group at control that equals value, sets the corresponding bit of the result
+FlatTableMask flatTableMatch(const uint8_t *control, uint8_t value)
+{
+#if defined(__AVX2__)
+    __m256i group = _mm256_loadu_si256((const __m256i *)control);
+    return (FlatTableMask)_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)value)));
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i group = _mm_loadu_si128((const __m128i *)control);
+    return (FlatTableMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+#else
+    // SWAR: find the zero bytes of group ^ value, then pack one bit per byte
+    uint64_t group;
+    memcpy(&group, control, sizeof(group));
+    uint64_t difference = group ^ (0x0101010101010101ull * value);
+    uint64_t zero_bytes = ~(((difference & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | difference | 0x7F7F7F7F7F7F7F7Full);
+    FlatTableMask mask = 0;
+    for (int i = 0; i < 8; i++) mask |= ((zero_bytes >> (i * 8 + 7)) & 1) << i;
+    return mask;
+#endif
+}
+
+int flatTableLowestBit(FlatTableMask mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (sizeof(mask) == 8) ? __builtin_ctzll(mask) : __builtin_ctz((uint32_t)mask);
+#else
+    int index = 0;
+    while (!(mask & 1)) { mask >>= 1; index++; }
+    return index;
+#endif
+}
+
+uint64_t flatTableMix(uint64_t key)
+{
+    return key * 0x9E3779B97F4A7C15ull;
+}
+
+size_t flatTableHome(FlatHashTable *table, uint64_t key)
+{
+    return (size_t)(flatTableMix(key) >> table->shift);
+}
+
+// The low bits of the multiply only depend on the low bits of the key, so the tag comes from
+// the 7 bits just below the ones the home slot is taken from
+uint8_t flatTableTag(FlatHashTable *table, uint64_t key)
+{
+    return (uint8_t)((flatTableMix(key) >> (table->shift - 7)) & 0x7F);
+}
+
+void flatTableSetControl(FlatHashTable *table, size_t slot, uint8_t value)
+{
+    table->control[slot] = value;
+    if (slot < FLAT_TABLE_GROUP_WIDTH) table->control[table->capacity + slot] = value;
+}
+
+void allocateFlatHashTable(FlatHashTable *table, size_t capacity)
+{
+    table->capacity = capacity;
+    table->count = 0;
+    table->shift = 64;
+    while (capacity > 1) { capacity >>= 1; table->shift--; }
+    table->control = malloc(table->capacity + FLAT_TABLE_GROUP_WIDTH);
+    memset(table->control, FLAT_TABLE_EMPTY, table->capacity + FLAT_TABLE_GROUP_WIDTH);
+    table->slots = malloc(table->capacity * sizeof(FlatTableSlot));
+}
+
+// sized so that expected_count entries fit without growing
+void makeFlatHashTable(FlatHashTable *table, size_t expected_count)
+{
+    size_t capacity = FLAT_TABLE_GROUP_WIDTH;
+    while (capacity * FLAT_TABLE_MAX_LOAD_EIGHTHS / 8 < expected_count + 1) capacity <<= 1;
+    allocateFlatHashTable(table, capacity);
+}
+
+void freeFlatHashTable(FlatHashTable *table)
+{
+    free(table->control);
+    free(table->slots);
+    *table = (FlatHashTable) { 0 };
+}
+
+void clearFlatHashTable(FlatHashTable *table)
+{
+    memset(table->control, FLAT_TABLE_EMPTY, table->capacity + FLAT_TABLE_GROUP_WIDTH);
+    table->count = 0;
+}
+
+// puts the entry in the first empty slot at or after its home, without checking the load
+void flatTablePlace(FlatHashTable *table, uint64_t key, void *value)
+{
+    size_t mask = table->capacity - 1;
+    size_t position = flatTableHome(table, key);
+    // at most half full, the home slot is often free already
+    if (table->control[position] == FLAT_TABLE_EMPTY)
+    {
+        flatTableSetControl(table, position, flatTableTag(table, key));
+        table->slots[position] = (FlatTableSlot) { key, value };
+        table->count++;
+        return;
+    }
+    for (;;)
+    {
+        FlatTableMask empty = flatTableMatch(&table->control[position], FLAT_TABLE_EMPTY);
+        if (empty)
+        {
+            size_t slot = (position + flatTableLowestBit(empty)) & mask;
+            flatTableSetControl(table, slot, flatTableTag(table, key));
+            table->slots[slot] = (FlatTableSlot) { key, value };
+            table->count++;
+            return;
+        }
+        position = (position + FLAT_TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+void growFlatHashTable(FlatHashTable *table)
+{
+    FlatHashTable old = *table;
+    allocateFlatHashTable(table, old.capacity * 2);
+    for (size_t i = 0; i < old.capacity; i++)
+    {
+        if (old.control[i] != FLAT_TABLE_EMPTY) flatTablePlace(table, old.slots[i].key, old.slots[i].value);
+    }
+    free(old.control);
+    free(old.slots);
+}
+
+// the same key can be inserted more than once
+void flatTableInsert(FlatHashTable *table, uint64_t key, void *value)
+{
+    if ((table->count + 1) * 8 > table->capacity * FLAT_TABLE_MAX_LOAD_EIGHTHS) growFlatHashTable(table);
+    flatTablePlace(table, key, value);
+}
+
+// Returns the first slot holding key, starting the probe from position, or -1 if there is none.
+// position has to be the key's home or just past a slot that was returned by an earlier probe.
+ptrdiff_t flatTableProbe(FlatHashTable *table, uint64_t key, size_t position)
+{
+    size_t mask = table->capacity - 1;
+    // most entries are in the slot the probe starts from, which is quicker to check on its own
+    if (table->control[position] != FLAT_TABLE_EMPTY && table->slots[position].key == key) return position;
+    uint8_t tag = flatTableTag(table, key);
+    for (;;)
+    {
+        FlatTableMask matches = flatTableMatch(&table->control[position], tag);
+        FlatTableMask empty = flatTableMatch(&table->control[position], FLAT_TABLE_EMPTY);
+        // entries with this key can't be past the first empty slot
+        if (empty) matches &= (empty & -empty) - 1;
+        while (matches)
+        {
+            size_t slot = (position + flatTableLowestBit(matches)) & mask;
+            if (table->slots[slot].key == key) return slot;
+            matches &= matches - 1;
+        }
+        if (empty) return -1;
+        position = (position + FLAT_TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+void *flatTableFind(FlatHashTable *table, uint64_t key)
+{
+    ptrdiff_t slot = flatTableProbe(table, key, flatTableHome(table, key));
+    return (slot >= 0) ? table->slots[slot].value : NULL;
+}
+
+// one pass over the probe sequence, rather than a new probe per entry
+size_t flatTableFindAll(FlatHashTable *table, uint64_t key, void **return_buffer, size_t buffer_size)
+{
+    size_t index = 0;
+    size_t mask = table->capacity - 1;
+    size_t position = flatTableHome(table, key);
+    // start loading the slots the probe will look at while it checks the control bytes
+    FLAT_TABLE_PREFETCH(&table->slots[position]);
+    FLAT_TABLE_PREFETCH(&table->slots[(position + 3) & mask]);
+    uint8_t tag = flatTableTag(table, key);
+    for (;;)
+    {
+        FlatTableMask matches = flatTableMatch(&table->control[position], tag);
+        FlatTableMask empty = flatTableMatch(&table->control[position], FLAT_TABLE_EMPTY);
+        if (empty) matches &= (empty & -empty) - 1;
+        while (matches)
+        {
+            size_t slot = (position + flatTableLowestBit(matches)) & mask;
+            if (table->slots[slot].key == key)
+            {
+                if (index >= buffer_size) return index;
+                return_buffer[index++] = table->slots[slot].value;
+            }
+            matches &= matches - 1;
+        }
+        if (empty) return index;
+        position = (position + FLAT_TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+// Empties a slot and shifts later entries of the same cluster back, so no tombstone is needed.
+// An entry can move into the hole as long as that doesn't put it before its home slot.
+void flatTableRemoveSlot(FlatHashTable *table, size_t hole)
+{
+    size_t mask = table->capacity - 1;
+    // with the table at most half full, there is usually nothing after the hole to shift back
+    if (table->control[(hole + 1) & mask] == FLAT_TABLE_EMPTY)
+    {
+        flatTableSetControl(table, hole, FLAT_TABLE_EMPTY);
+        table->count--;
+        return;
+    }
+    // find where the cluster ends from the control bytes first, so the loop below
+    // isn't waiting on each slot's key just to know whether to keep going
+    size_t cluster_end = (hole + 1) & mask;
+    for (;;)
+    {
+        FlatTableMask empty = flatTableMatch(&table->control[cluster_end], FLAT_TABLE_EMPTY);
+        if (empty)
+        {
+            cluster_end = (cluster_end + flatTableLowestBit(empty)) & mask;
+            break;
+        }
+        cluster_end = (cluster_end + FLAT_TABLE_GROUP_WIDTH) & mask;
+    }
+    for (size_t next = (hole + 1) & mask; next != cluster_end; next = (next + 1) & mask)
+    {
+        size_t home = flatTableHome(table, table->slots[next].key);
+        // the hole is garbage until something moves into it, so copying unconditionally
+        // and only moving the hole when the entry may go there avoids a hard to predict branch
+        flatTableSetControl(table, hole, table->control[next]);
+        table->slots[hole] = table->slots[next];
+        hole = (((next - home) & mask) >= ((next - hole) & mask)) ? next : hole;
+    }
+    flatTableSetControl(table, hole, FLAT_TABLE_EMPTY);
+    table->count--;
+}
+
+void *flatTableRemove(FlatHashTable *table, uint64_t key)
+{
+    ptrdiff_t slot = flatTableProbe(table, key, flatTableHome(table, key));
+    if (slot < 0) return NULL;
+    void *value = table->slots[slot].value;
+    flatTableRemoveSlot(table, slot);
+    return value;
+}
+
+// Removes one entry matching both key and value. Returns how many entries had the key
+// before the removal, or 0 if nothing matched.
+int flatTableRemoveByValue(FlatHashTable *table, uint64_t key, void *value)
+{
+    size_t mask = table->capacity - 1;
+    size_t position = flatTableHome(table, key);
+    FLAT_TABLE_PREFETCH(&table->slots[position]);
+    FLAT_TABLE_PREFETCH(&table->slots[(position + 3) & mask]);
+    uint8_t tag = flatTableTag(table, key);
+    int key_matches_count = 0;
+    ptrdiff_t found = -1;
+    for (;;)
+    {
+        FlatTableMask matches = flatTableMatch(&table->control[position], tag);
+        FlatTableMask empty = flatTableMatch(&table->control[position], FLAT_TABLE_EMPTY);
+        if (empty) matches &= (empty & -empty) - 1;
+        while (matches)
+        {
+            size_t slot = (position + flatTableLowestBit(matches)) & mask;
+            if (table->slots[slot].key == key)
+            {
+                key_matches_count++;
+                if (found < 0 && table->slots[slot].value == value) found = slot;
+            }
+            matches &= matches - 1;
+        }
+        if (empty) break;
+        position = (position + FLAT_TABLE_GROUP_WIDTH) & mask;
+    }
+    if (found < 0) return 0;
+    flatTableRemoveSlot(table, found);
+    return key_matches_count;
+}
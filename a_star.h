@@ -1,38 +1,226 @@
 #pragma once
+#include <limits.h>
 #include "min_heap.h"
 #include "HashTable.h"
 #include "level.h"
 #include "vector.h"
 
+// lazy decrease-key leaves stale entries in the heap, so it gets some slack
+#define A_STAR_HEAP_SLACK 2
+#define A_STAR_NEIGHBOR_COUNT 12
+
 typedef struct AStarNode
 {
     Vector3 node_position;
     int g_score;
     int f_score;
+    int closed;
     struct AStarNode *came_from;
 } AStarNode;
 
 typedef struct SearchData
 {
-    BlockPage nodes; // maybe this should just be an array
+    // every node touched by the current search lives at the front of this array,
+    // so resetting only costs as much as the last search did
+    AStarNode *nodes;
+    size_t node_count;
+    size_t max_nodes;
+    // maps the hash of a position to its node, whether it is open or closed
     HashTable open_set;
     Heap open_f_min_heap;
+    // the last path found, from the start position to the goal
+    Vector3 *path;
+    size_t path_length;
 } SearchData;
 
+// one step along x or z, optionally climbing or dropping a single tile
+Vector3 a_star_neighbor_offsets[A_STAR_NEIGHBOR_COUNT] =
+{
+    {  1, 0,  0 }, { -1, 0,  0 }, { 0, 0,  1 }, { 0, 0, -1 },
+    {  1, 1,  0 }, { -1, 1,  0 }, { 0, 1,  1 }, { 0, 1, -1 },
+    {  1, -1, 0 }, { -1, -1, 0 }, { 0, -1, 1 }, { 0, -1, -1 },
+};
+
 SearchData createSearchData(int max_nodes)
 {
     SearchData result = { 0 };
-    makePage(&result.nodes, max_nodes, sizeof(AStarNode));
-    result.open_set.items = calloc(max_nodes, sizeof(HashItem *));
-    result.open_set.len = max_nodes;
-    result.open_set.num = 0;
-    makePage(&result.open_set.page, max_nodes, sizeof(HashItem));
-    result.open_f_min_heap.max_size = max_nodes;
-    result.open_f_min_heap.pairs = calloc(max_nodes, sizeof(KeyValuePair));
+    result.nodes = calloc(max_nodes, sizeof(AStarNode));
+    result.max_nodes = max_nodes;
+    // sized up front so that the table never has to grow during a search
+    makeHashTable(&result.open_set, max_nodes);
+    result.open_f_min_heap.max_size = max_nodes * A_STAR_HEAP_SLACK;
+    result.open_f_min_heap.pairs = calloc(max_nodes * A_STAR_HEAP_SLACK, sizeof(KeyValuePair));
+    result.path = calloc(max_nodes, sizeof(Vector3));
     return result;
 }
 
-AStarNode *aStarPathFind(Vector3 start_position, Vector3 goal, SearchData *search_data)
+void freeSearchData(SearchData *search_data)
+{
+    free(search_data->nodes);
+    freeHashTable(&search_data->open_set);
+    free(search_data->open_f_min_heap.pairs);
+    free(search_data->path);
+    *search_data = (SearchData) { 0 };
+}
+
+int cellIsEmpty(Vector3 position, Level *level)
+{
+    if (position.x < 0 || position.x >= level->size.x
+    || position.y < 0 || position.y >= level->size.y
+    || position.z < 0 || position.z >= level->size.z) return 0;
+    return !getTileAtUnsafe(position, level);
+}
+
+// a unit can stand in a cell if it is empty and the cell below it is solid
+int cellIsWalkable(Vector3 position, Level *level)
+{
+    if (position.y < 1 || !cellIsEmpty(position, level)) return 0;
+    position.y--;
+    return getTileAtUnsafe(position, level) != 0;
+}
+
+int canStepBetween(Vector3 from, Vector3 to, Level *level)
+{
+    if (!cellIsWalkable(to, level)) return 0;
+    // climbing needs headroom above the unit, and dropping needs
+    // the space above the lower cell to be clear
+    if (to.y > from.y) return cellIsEmpty((Vector3) { from.x, to.y, from.z }, level);
+    if (to.y < from.y) return cellIsEmpty((Vector3) { to.x, from.y, to.z }, level);
+    return 1;
+}
+
+// every step moves one tile along x or z, and may also move one tile along y,
+// so this never overestimates
+int aStarHeuristic(Vector3 position, Vector3 goal)
+{
+    int horizontal = abs(position.x - goal.x) + abs(position.z - goal.z);
+    int vertical = abs(position.y - goal.y);
+    return (horizontal > vertical) ? horizontal : vertical;
+}
+
+void resetSearchData(SearchData *search_data)
+{
+    // after a big search, wiping all the control bytes in one go is cheaper than removing node by node,
+    // it takes about as long as removing one node for every 512 slots
+    if (search_data->node_count > search_data->open_set.flat.capacity / 512) clearHashTable(&search_data->open_set);
+    else
+    {
+        for (size_t i = 0; i < search_data->node_count; i++)
+        {
+            removeFromTable(&search_data->open_set, hashVector3(search_data->nodes[i].node_position));
+        }
+    }
+    search_data->node_count = 0;
+    search_data->open_f_min_heap.count = 0;
+    search_data->path_length = 0;
+}
+
+// returns NULL when the SearchData has run out of nodes
+AStarNode *getSearchNode(SearchData *search_data, Vector3 position)
+{
+    uint64_t key = hashVector3(position);
+    AStarNode *node = findInTable(&search_data->open_set, key);
+    if (node) return node;
+    if (search_data->node_count >= search_data->max_nodes) return NULL;
+    node = &search_data->nodes[search_data->node_count++];
+    *node = (AStarNode) { position, INT_MAX, INT_MAX, 0, NULL };
+    insertToTable(&search_data->open_set, key, node);
+    return node;
+}
+
+int pushOpenNode(SearchData *search_data, AStarNode *node, int heuristic)
+{
+    Heap *heap = &search_data->open_f_min_heap;
+    // ties on f are broken in favor of the node closest to the goal
+    uint64_t key = ((uint64_t)node->f_score << 32) | (uint32_t)heuristic;
+    if (insertToMinHeap(heap, key, node)) return 1;
+    // the heap is full, so throw out the entries that were superseded or already closed and rebuild it
+    size_t kept = 0;
+    for (size_t i = 0; i < heap->count; i++)
+    {
+        AStarNode *entry = heap->pairs[i].value;
+        if (!entry->closed && (int)(heap->pairs[i].key >> 32) == entry->f_score) heap->pairs[kept++] = heap->pairs[i];
+    }
+    heap->count = 0;
+    for (size_t i = 0; i < kept; i++)
+    {
+        KeyValuePair pair = heap->pairs[i];
+        insertToMinHeap(heap, pair.key, pair.value);
+    }
+    return insertToMinHeap(heap, key, node);
+}
+
+// copy the chain of came_from pointers into search_data->path, start first
+size_t aStarBuildPath(SearchData *search_data, AStarNode *goal_node)
+{
+    size_t length = 0;
+    for (AStarNode *node = goal_node; node; node = node->came_from) length++;
+    size_t index = length;
+    for (AStarNode *node = goal_node; node; node = node->came_from)
+    {
+        search_data->path[--index] = node->node_position;
+    }
+    search_data->path_length = length;
+    return length;
+}
+
+// Finds a walking path between two cells that never leaves the columns between bounds_min (inclusive)
+// and bounds_max (exclusive) on x and z. This never allocates, all of the working memory comes
+// from search_data, so max_nodes is also the limit on how much of the level a single search can explore.
+// Returns the goal node (follow came_from back to the start) or NULL if there is no path,
+// and on success the whole path is also left in search_data->path
+AStarNode *aStarPathFindBounded(Vector3 start_position, Vector3 goal, Vector3 bounds_min, Vector3 bounds_max, SearchData *search_data, Level *level)
 {
     // reset the SearchData
-}
\ No newline at end of file
+    resetSearchData(search_data);
+    if (!cellIsWalkable(start_position, level) || !cellIsWalkable(goal, level)) return NULL;
+
+    AStarNode *start_node = getSearchNode(search_data, start_position);
+    int start_heuristic = aStarHeuristic(start_position, goal);
+    start_node->g_score = 0;
+    start_node->f_score = start_heuristic;
+    pushOpenNode(search_data, start_node, start_heuristic);
+
+    Heap *heap = &search_data->open_f_min_heap;
+    while (heap->count)
+    {
+        AStarNode *current = heap->pairs[0].value;
+        minHeapify(heap);
+        // stale entries from lazy decrease-key get skipped here
+        if (current->closed) continue;
+        current->closed = 1;
+
+        Vector3 position = current->node_position;
+        if (position.x == goal.x && position.y == goal.y && position.z == goal.z)
+        {
+            aStarBuildPath(search_data, current);
+            return current;
+        }
+
+        for (int i = 0; i < A_STAR_NEIGHBOR_COUNT; i++)
+        {
+            Vector3 next_position = addVector3(position, a_star_neighbor_offsets[i]);
+            if (next_position.x < bounds_min.x || next_position.x >= bounds_max.x
+            || next_position.z < bounds_min.z || next_position.z >= bounds_max.z) continue;
+            if (!canStepBetween(position, next_position, level)) continue;
+            AStarNode *neighbor = getSearchNode(search_data, next_position);
+            if (!neighbor) return NULL;
+            if (neighbor->closed) continue;
+            int tentative_g_score = current->g_score + 1;
+            if (tentative_g_score < neighbor->g_score)
+            {
+                int heuristic = aStarHeuristic(next_position, goal);
+                neighbor->g_score = tentative_g_score;
+                neighbor->f_score = tentative_g_score + heuristic;
+                neighbor->came_from = current;
+                if (!pushOpenNode(search_data, neighbor, heuristic)) return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+AStarNode *aStarPathFind(Vector3 start_position, Vector3 goal, SearchData *search_data, Level *level)
+{
+    return aStarPathFindBounded(start_position, goal, (Vector3) { 0, 0, 0 }, level->size, search_data, level);
+}
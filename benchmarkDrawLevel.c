@@ -0,0 +1,309 @@
+// Draws levels with drawLevel, with no window, over scripted camera paths, and writes per-phase
+// timings and allocation counts to a file that can be diffed between builds. Uses the dummy video
+// driver and the software renderer, so every run does the same work wherever it runs.
+// Run from the directory with tiles/ in it:
+// gcc -O3 benchmarkDrawLevel.c $(sdl2-config --cflags --libs) -lm -o benchmarkDrawLevel
+// ./benchmarkDrawLevel [output file, benchmark_draw_level.tsv by default]
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Everything the game allocates during a frame is counted, both its own mallocs, which are all
+// in this translation unit, and SDL's. The counters are swapped in before the game headers.
+size_t benchmark_allocations = 0;
+
+void *benchmarkMalloc(size_t size)
+{
+    benchmark_allocations++;
+    return malloc(size);
+}
+
+void *benchmarkCalloc(size_t count, size_t size)
+{
+    benchmark_allocations++;
+    return calloc(count, size);
+}
+
+void *benchmarkRealloc(void *memory, size_t size)
+{
+    benchmark_allocations++;
+    return realloc(memory, size);
+}
+
+SDL_malloc_func sdl_malloc;
+SDL_calloc_func sdl_calloc;
+SDL_realloc_func sdl_realloc;
+SDL_free_func sdl_free;
+
+void *benchmarkSDLMalloc(size_t size)
+{
+    benchmark_allocations++;
+    return sdl_malloc(size);
+}
+
+void *benchmarkSDLCalloc(size_t count, size_t size)
+{
+    benchmark_allocations++;
+    return sdl_calloc(count, size);
+}
+
+void *benchmarkSDLRealloc(void *memory, size_t size)
+{
+    benchmark_allocations++;
+    return sdl_realloc(memory, size);
+}
+
+#define malloc benchmarkMalloc
+#define calloc benchmarkCalloc
+#define realloc benchmarkRealloc
+// drawLevel only times its overlap testing when asked to
+#define DRAW_LEVEL_OVERLAP_TIMING
+
+#include "vector.h"
+#include "level.h"
+#include "textures_generated.h"
+#include "entity_store.h"
+#include "entity.h"
+#include "math_utils.h"
+#include "draw_level.h"
+#include "benchmark_utils.h"
+
+#define FRAMES_PER_PATH 240
+#define CAMERA_PAN_SPEED_PX 6
+#define CAMERA_ORBIT_RADIUS_PX 400
+
+SpatialGrid entity_by_location = { 0 };
+EntityStore entity_store;
+TerrainCache terrain_cache;
+
+typedef struct
+{
+    const char *name;
+    Vector3 size;
+} BenchmarkLevelSize;
+
+typedef struct
+{
+    const char *name;
+    int count;
+    // how far from the middle of the level the entities are put, in cells, 0 for anywhere
+    int spread;
+} BenchmarkDensity;
+
+typedef struct
+{
+    const char *name;
+    int width, height;
+} BenchmarkView;
+
+enum { CAMERA_STILL, CAMERA_PAN, CAMERA_ORBIT, CAMERA_PATH_COUNT };
+const char *camera_path_names[CAMERA_PATH_COUNT] = { "still", "pan", "orbit" };
+
+BenchmarkLevelSize level_sizes[] = { { "128x6x128", { 128, 6, 128 } }, { "512x16x512", { 512, 16, 512 } } };
+BenchmarkDensity densities[] = { { "empty", 0, 0 }, { "sparse", 16, 0 }, { "crowd", 100, 6 } };
+BenchmarkView views[] = { { "480x270", 480, 270 }, { "1920x1080", 1920, 1080 } };
+
+enum
+{
+    METRIC_FRAME,
+    METRIC_SETUP,
+    METRIC_TERRAIN,
+    METRIC_DRAW_LIST_WAIT,
+    METRIC_ENTITY_PASS,
+    METRIC_TILE_PASS,
+    METRIC_OVERLAP_TESTING,
+    METRIC_MASK_COMPOSITING,
+    METRIC_ALLOCATIONS,
+    METRIC_COUNT
+};
+const char *metric_names[METRIC_COUNT] = { "frame_us", "setup_us", "terrain_us", "draw_list_wait_us", "entity_pass_us", "tile_pass_us",
+    "overlap_testing_us", "mask_compositing_us", "allocations" };
+
+int compareDoubles(const void *a, const void *b)
+{
+    double difference = *(const double *)a - *(const double *)b;
+    return (difference > 0) - (difference < 0);
+}
+
+// nearest rank, the samples get sorted
+double percentile(double *samples, int count, double fraction)
+{
+    qsort(samples, count, sizeof(double), compareDoubles);
+    int rank = (int)ceil(fraction * count) - 1;
+    return samples[(rank < 0) ? 0 : rank];
+}
+
+// where the top left of the screen goes on a frame of a camera path, centered on the level
+void cameraPosition(int path, int frame, Level *level, BenchmarkView *view, int *camera_x, int *camera_y)
+{
+    int center_x, center_y;
+    worldToScreen((Vector3) { level->size.x / 2, 0, level->size.z / 2 }, 0, 0, &center_x, &center_y);
+    center_x -= view->width / 2;
+    center_y -= view->height / 2;
+    if (path == CAMERA_PAN)
+    {
+        // from one side of the middle to the other, along the screen's x
+        center_x += (frame - FRAMES_PER_PATH / 2) * CAMERA_PAN_SPEED_PX;
+    }
+    else if (path == CAMERA_ORBIT)
+    {
+        double angle = 2 * M_PI * frame / FRAMES_PER_PATH;
+        center_x += (int)(CAMERA_ORBIT_RADIUS_PX * cos(angle));
+        center_y += (int)(CAMERA_ORBIT_RADIUS_PX * sin(angle) / 2);
+    }
+    *camera_x = center_x;
+    *camera_y = center_y;
+}
+
+void addBenchmarkEntities(SDL_Renderer *renderer, Level *level, BenchmarkDensity *density, PlacementCursor *cursors)
+{
+    for (int i = 0; i < density->count; i++)
+    {
+        cursors[i].tile_id = 1 + i % (TILE_TYPE_COUNT - 1);
+        EntityHandle entity = createEntity(&entity_store);
+        uint32_t index = entityIndex(&entity_store, entity);
+        entity_store.types[index] = ENTITY_EDITOR_CURSOR;
+        entity_store.draw_on_top[index] = (i % 8 == 0);
+        entity_store.draw[index] = drawEditorCursor;
+        entity_store.specific_data[index] = &cursors[i];
+        TextureData *texture_data = entity_store.texture_data[index] = newEntityTextureData();
+        texture_data->temporary_frame_buffer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
+        SDL_SetTextureBlendMode(texture_data->temporary_frame_buffer, SDL_BLENDMODE_BLEND);
+
+        Vector3 cell;
+        if (density->spread)
+        {
+            cell = benchmarkColumnTop(level, level->size.x / 2 + benchmarkRandomRange(-density->spread, density->spread),
+                level->size.z / 2 + benchmarkRandomRange(-density->spread, density->spread));
+            if (cell.y < 0) cell = benchmarkRandomSurfaceCell(level);
+        }
+        else cell = benchmarkRandomSurfaceCell(level);
+        // off the grid a little, so they straddle cells like moving units do
+        Vector3 offset = { benchmarkRandomRange(0, ENTITY_POSITION_MULTIPLIER * TILE_HALF_WIDTH_PX - 1), 0,
+            benchmarkRandomRange(0, ENTITY_POSITION_MULTIPLIER * TILE_HALF_WIDTH_PX - 1) };
+        Vector3 size = { TILE_HALF_WIDTH_PX - 1, TILE_HEIGHT_PX - 1, TILE_HALF_WIDTH_PX - 1 };
+        addEntity(&entity_store, entity, addVector3(worldToEntityPosition(cell), offset), size, &entity_by_location);
+    }
+}
+
+void removeBenchmarkEntities()
+{
+    while (entity_store.count)
+    {
+        EntityHandle entity = entity_store.handles[entity_store.count - 1];
+        uint32_t index = entityIndex(&entity_store, entity);
+        SDL_DestroyTexture(entity_store.texture_data[index]->temporary_frame_buffer);
+        removeEntity(&entity_store, entity, &entity_by_location);
+        destroyEntity(&entity_store, entity);
+    }
+    clearEntityTextureData();
+}
+
+int main(int argc, char **argv)
+{
+    const char *output_path = (argc > 1) ? argv[1] : "benchmark_draw_level.tsv";
+    SDL_GetMemoryFunctions(&sdl_malloc, &sdl_calloc, &sdl_realloc, &sdl_free);
+    SDL_SetMemoryFunctions(benchmarkSDLMalloc, benchmarkSDLCalloc, benchmarkSDLRealloc, sdl_free);
+    // the environment rather than a hint, older SDLs only look there
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    if (SDL_Init(SDL_INIT_VIDEO))
+    {
+        printf("Couldn't start SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+    FILE *output = fopen(output_path, "w");
+    if (!output)
+    {
+        printf("Couldn't open %s\n", output_path);
+        return 1;
+    }
+    fprintf(output, "scenario\tmetric\tp50\tp99\n");
+    // the tile pass's lists get built on every core, like in the game
+    createDrawListBuilder(&draw_list_builder, -1);
+
+    // one software renderer per view size, drawing into a surface instead of a window
+    double ticks_per_microsecond = SDL_GetPerformanceFrequency() / 1e6;
+    double *samples[METRIC_COUNT];
+    for (int i = 0; i < METRIC_COUNT; i++) samples[i] = malloc(FRAMES_PER_PATH * sizeof(double));
+    // a cursor for each entity of the biggest density
+    int most_entities = 0;
+    for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) most_entities = max(most_entities, densities[d].count);
+    PlacementCursor *cursors = malloc(most_entities * sizeof(PlacementCursor));
+
+    for (size_t v = 0; v < sizeof(views) / sizeof(views[0]); v++)
+    {
+        BenchmarkView *view = &views[v];
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, view->width, view->height, 32, SDL_PIXELFORMAT_RGBA8888);
+        SDL_Renderer *renderer = SDL_CreateSoftwareRenderer(surface);
+        loadAllTextures(renderer);
+        if (!tile_atlas)
+        {
+            puts("Couldn't load the tiles, run this from the directory with tiles/ in it");
+            return 1;
+        }
+        SDL_QueryTexture(tile_textures[GRASS_TILE], NULL, NULL, &texture_width, &texture_height);
+        SDL_Texture *game_window_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, view->width, view->height);
+
+        for (size_t l = 0; l < sizeof(level_sizes) / sizeof(level_sizes[0]); l++)
+        {
+            Level level;
+            generateBenchmarkLevel(&level, level_sizes[l].size, 1 + l);
+            createSpatialGrid(&entity_by_location, level.size);
+            createEntityStore(&entity_store, 16);
+            for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++)
+            {
+                benchmark_random_state = 1 + d;
+                addBenchmarkEntities(renderer, &level, &densities[d], cursors);
+                for (int path = 0; path < CAMERA_PATH_COUNT; path++)
+                {
+                    // every path starts from nothing cached, like after loading a level
+                    freeTerrainCache(&terrain_cache);
+                    terrain_cache = makeTerrainCache(texture_width, texture_height);
+                    for (int frame = 0; frame < FRAMES_PER_PATH; frame++)
+                    {
+                        int camera_x, camera_y;
+                        cameraPosition(path, frame, &level, view, &camera_x, &camera_y);
+                        size_t allocations = benchmark_allocations;
+                        uint64_t start = SDL_GetPerformanceCounter();
+                        drawLevel(renderer, level, game_window_texture, camera_x, camera_y);
+                        uint64_t frame_ticks = SDL_GetPerformanceCounter() - start;
+                        samples[METRIC_FRAME][frame] = frame_ticks / ticks_per_microsecond;
+                        samples[METRIC_SETUP][frame] = draw_level_timings.setup / ticks_per_microsecond;
+                        samples[METRIC_TERRAIN][frame] = draw_level_timings.terrain / ticks_per_microsecond;
+                        samples[METRIC_DRAW_LIST_WAIT][frame] = draw_level_timings.draw_list_wait / ticks_per_microsecond;
+                        samples[METRIC_ENTITY_PASS][frame] = draw_level_timings.entity_pass / ticks_per_microsecond;
+                        samples[METRIC_TILE_PASS][frame] = draw_level_timings.tile_pass / ticks_per_microsecond;
+                        samples[METRIC_OVERLAP_TESTING][frame] = draw_level_timings.overlap_testing / ticks_per_microsecond;
+                        samples[METRIC_MASK_COMPOSITING][frame] = draw_level_timings.mask_compositing / ticks_per_microsecond;
+                        samples[METRIC_ALLOCATIONS][frame] = benchmark_allocations - allocations;
+                    }
+
+                    char scenario[128];
+                    snprintf(scenario, sizeof(scenario), "%s/%s/%s/%s", view->name, level_sizes[l].name, densities[d].name, camera_path_names[path]);
+                    for (int m = 0; m < METRIC_COUNT; m++)
+                    {
+                        double p50 = percentile(samples[m], FRAMES_PER_PATH, 0.5);
+                        double p99 = percentile(samples[m], FRAMES_PER_PATH, 0.99);
+                        fprintf(output, "%s\t%s\t%.1f\t%.1f\n", scenario, metric_names[m], p50, p99);
+                        if (m == METRIC_FRAME) printf("%-40s frame p50 %8.1f us, p99 %8.1f us", scenario, p50, p99);
+                        if (m == METRIC_ALLOCATIONS) printf(", %.0f allocations p99\n", p99);
+                    }
+                }
+                removeBenchmarkEntities();
+            }
+            freeEntityStore(&entity_store);
+            freeSpatialGrid(&entity_by_location);
+            freeLevel(&level);
+        }
+        freeTerrainCache(&terrain_cache);
+        SDL_DestroyTexture(game_window_texture);
+        SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+    }
+    destroyDrawListBuilder(&draw_list_builder);
+    fclose(output);
+    printf("wrote %s\n", output_path);
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Runs a per-tick update over 100K entities, once with the components in EntityStore's
+// separate arrays and once with them in an array of structs laid out like the old Entity
+// gcc -O3 -march=native benchmarkEntityStore.c $(sdl2-config --cflags) -o benchmarkEntityStore
+// (the store loops only get vectorized with -O3, and are at their best with AVX2)
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+#include "entity_store.h"
+
+#define ENTITY_COUNT 100000
+#define TICK_COUNT 200
+#define WORLD_SIZE (1 << 20)
+
+// the layout Entity had before the store
+typedef struct LegacyEntity
+{
+    Vector3 position;
+    Vector3 size;
+    int draw_on_top;
+    int layer;
+    int type;
+    void *specific_data;
+    TextureData *texture_data;
+    void (*free_callback)(struct LegacyEntity *);
+    void (*draw)(struct LegacyEntity *, SDL_Renderer *, int, int, SDL_Rect);
+} LegacyEntity;
+
+// What a tick does: move every entity by its velocity, bouncing off the edges of the world,
+// then count the ones inside the view and add up their depth keys, like culling and sorting would
+typedef struct
+{
+    size_t visible;
+    int64_t depth_sum;
+} TickResult;
+
+int bounce(int *position, int *velocity)
+{
+    *position += *velocity;
+    if (*position < 0 || *position >= WORLD_SIZE)
+    {
+        *velocity = -*velocity;
+        *position += 2 * *velocity;
+    }
+    return *position;
+}
+
+TickResult storeTick(EntityStore *store, Vector3 *velocities, Vector3 view_min, Vector3 view_max)
+{
+    Vector3 *positions = store->positions;
+    Vector3 *sizes = store->sizes;
+    for (uint32_t i = 0; i < store->count; i++)
+    {
+        bounce(&positions[i].x, &velocities[i].x);
+        bounce(&positions[i].z, &velocities[i].z);
+    }
+    TickResult result = { 0 };
+    for (uint32_t i = 0; i < store->count; i++)
+    {
+        int visible = positions[i].x + sizes[i].x >= view_min.x && positions[i].x <= view_max.x
+            && positions[i].z + sizes[i].z >= view_min.z && positions[i].z <= view_max.z;
+        result.visible += visible;
+        result.depth_sum += visible * (store->layers[i] + componentSum(addVector3(positions[i], sizes[i])));
+    }
+    return result;
+}
+
+TickResult legacyTick(LegacyEntity *entities, size_t count, Vector3 *velocities, Vector3 view_min, Vector3 view_max)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        bounce(&entities[i].position.x, &velocities[i].x);
+        bounce(&entities[i].position.z, &velocities[i].z);
+    }
+    TickResult result = { 0 };
+    for (size_t i = 0; i < count; i++)
+    {
+        LegacyEntity *entity = &entities[i];
+        int visible = entity->position.x + entity->size.x >= view_min.x && entity->position.x <= view_max.x
+            && entity->position.z + entity->size.z >= view_min.z && entity->position.z <= view_max.z;
+        result.visible += visible;
+        result.depth_sum += visible * (entity->layer + componentSum(addVector3(entity->position, entity->size)));
+    }
+    return result;
+}
+
+int main()
+{
+    EntityStore store;
+    createEntityStore(&store, 16);
+    LegacyEntity *legacy_entities = calloc(ENTITY_COUNT, sizeof(LegacyEntity));
+    Vector3 *store_velocities = malloc(ENTITY_COUNT * sizeof(Vector3));
+    Vector3 *legacy_velocities = malloc(ENTITY_COUNT * sizeof(Vector3));
+    EntityHandle *handles = malloc(ENTITY_COUNT * sizeof(EntityHandle));
+
+    // make more than we need and destroy some, so the handles don't line up with the indices
+    for (int i = 0; i < ENTITY_COUNT + ENTITY_COUNT / 4; i++) createEntity(&store);
+    for (int i = 0; i < ENTITY_COUNT / 4; i++) destroyEntity(&store, store.handles[benchmarkRandom() % store.count]);
+    for (uint32_t i = 0; i < store.count; i++)
+    {
+        Vector3 position = { benchmarkRandom() % WORLD_SIZE, 0, benchmarkRandom() % WORLD_SIZE };
+        Vector3 size = { 256, 288, 256 };
+        Vector3 velocity = { benchmarkRandomRange(-64, 64), 0, benchmarkRandomRange(-64, 64) };
+        int layer = benchmarkRandomRange(0, 3);
+        store.positions[i] = position;
+        store.sizes[i] = size;
+        store.layers[i] = layer;
+        store_velocities[i] = legacy_velocities[i] = velocity;
+        legacy_entities[i] = (LegacyEntity) { .position = position, .size = size, .layer = layer };
+        handles[i] = store.handles[i];
+    }
+    Vector3 view_min = { WORLD_SIZE / 4, 0, WORLD_SIZE / 4 };
+    Vector3 view_max = { WORLD_SIZE / 2, 0, WORLD_SIZE / 2 };
+    printf("%d entities, %d bytes per legacy entity\n", ENTITY_COUNT, (int)sizeof(LegacyEntity));
+
+    TickResult store_result = { 0 }, legacy_result = { 0 };
+    double start_time = benchmarkSeconds();
+    for (int tick = 0; tick < TICK_COUNT; tick++) store_result = storeTick(&store, store_velocities, view_min, view_max);
+    double store_time = benchmarkSeconds() - start_time;
+
+    start_time = benchmarkSeconds();
+    for (int tick = 0; tick < TICK_COUNT; tick++) legacy_result = legacyTick(legacy_entities, ENTITY_COUNT, legacy_velocities, view_min, view_max);
+    double legacy_time = benchmarkSeconds() - start_time;
+
+    // and what it costs to go from a handle, like the spatial grid hands out, to the components
+    int64_t lookup_sum = 0;
+    start_time = benchmarkSeconds();
+    for (int tick = 0; tick < TICK_COUNT; tick++)
+    {
+        for (int i = 0; i < ENTITY_COUNT; i++) lookup_sum += store.positions[entityIndex(&store, handles[i])].x;
+    }
+    double lookup_time = benchmarkSeconds() - start_time;
+
+    printf("  store  %7.3f ms per tick (%zu visible)\n", store_time * 1e3 / TICK_COUNT, store_result.visible);
+    printf("  legacy %7.3f ms per tick (%zu visible)\n", legacy_time * 1e3 / TICK_COUNT, legacy_result.visible);
+    printf("  handle lookups %.2f ns each (%lld)\n", lookup_time * 1e9 / ((double)TICK_COUNT * ENTITY_COUNT), (long long)lookup_sum);
+    if (store_result.depth_sum != legacy_result.depth_sum) puts("  results differ!");
+
+    freeEntityStore(&store);
+    free(legacy_entities);
+    free(store_velocities);
+    free(legacy_velocities);
+    free(handles);
+    return 0;
+}
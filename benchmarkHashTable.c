@@ -0,0 +1,184 @@
+// Times insert, find, find-all and remove-by-value on the flat hash table, both grown from empty and
+// sized up front, and on a copy of the separate chaining table it replaced, with buckets to spare
+// gcc -O2 benchmarkHashTable.c -o benchmarkHashTable  (add -mavx2 for 32 wide groups)
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+#include "BlockAllocate.h"
+#include "HashTable.h"
+
+// every key gets this many values, like a cell with a few entities in it
+#define VALUES_PER_KEY 2
+// the fastest of this many runs is reported
+#define RUNS 3
+
+// *** The old separate chaining table, for comparison ***
+typedef struct ChainedItem
+{
+    uint64_t key;
+    void *value;
+    struct ChainedItem *next;
+} ChainedItem;
+
+typedef struct ChainedTable
+{
+    ChainedItem **items;
+    BlockPage page;
+    size_t len;
+} ChainedTable;
+
+void chainedInsert(ChainedTable *table, uint64_t key, void *value)
+{
+    size_t hash = key % table->len;
+    ChainedItem *item = blockAlloc(&table->page);
+    item->key = key;
+    item->value = value;
+    item->next = table->items[hash];
+    table->items[hash] = item;
+}
+
+void *chainedFind(ChainedTable *table, uint64_t key)
+{
+    ChainedItem *item = table->items[key % table->len];
+    while (item && item->key != key) item = item->next;
+    return item ? item->value : NULL;
+}
+
+size_t chainedFindAll(ChainedTable *table, uint64_t key, void **return_buffer, size_t buffer_size)
+{
+    size_t index = 0;
+    for (ChainedItem *item = table->items[key % table->len]; item && index < buffer_size; item = item->next)
+    {
+        if (item->key == key) return_buffer[index++] = item->value;
+    }
+    return index;
+}
+
+int chainedRemoveByValue(ChainedTable *table, uint64_t key, void *value)
+{
+    size_t hash = key % table->len;
+    ChainedItem *item = table->items[hash], *previous = NULL;
+    int key_matches_count = 0;
+    while (item && (item->key != key || item->value != value)) { key_matches_count += item->key == key; previous = item; item = item->next; }
+    if (!item) return 0;
+    for (ChainedItem *remaining = item; remaining; remaining = remaining->next) key_matches_count += remaining->key == key;
+    if (previous) previous->next = item->next; else table->items[hash] = item->next;
+    blockFree(&table->page, item);
+    return key_matches_count;
+}
+
+typedef struct
+{
+    double insert, find, find_all, remove;
+} HashTableTimes;
+
+void printTimes(const char *label, size_t count, HashTableTimes times)
+{
+    printf("  %-12s insert %7.1f ns  find %7.1f ns  find-all %7.1f ns  remove-by-value %7.1f ns\n", label,
+        times.insert * 1e9 / count, times.find * 1e9 / count, times.find_all * 1e9 / (count / VALUES_PER_KEY), times.remove * 1e9 / count);
+}
+
+size_t checksum = 0;
+
+void keepFastest(HashTableTimes *fastest, HashTableTimes times)
+{
+    if (times.insert < fastest->insert) fastest->insert = times.insert;
+    if (times.find < fastest->find) fastest->find = times.find;
+    if (times.find_all < fastest->find_all) fastest->find_all = times.find_all;
+    if (times.remove < fastest->remove) fastest->remove = times.remove;
+}
+
+// The game gave each chained table a fixed number of buckets, enough for the most it would ever hold,
+// and ran it well under that, so bucket_count should be more than count for a fair comparison.
+// Lookups and removals go through keys in the shuffled order, so neither table gets to walk its
+// memory in the order it was filled.
+HashTableTimes benchmarkChained(uint64_t *keys, size_t *order, size_t count, size_t bucket_count)
+{
+    HashTableTimes times;
+    size_t key_count = count / VALUES_PER_KEY;
+    void *results[64];
+    ChainedTable chained = { calloc(bucket_count, sizeof(ChainedItem *)), { 0 }, bucket_count };
+    makePage(&chained.page, count, sizeof(ChainedItem));
+    double start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) chainedInsert(&chained, keys[i], (void *)(i + 1));
+    times.insert = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) checksum += (size_t)chainedFind(&chained, keys[order[i]]);
+    times.find = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < key_count; i++) checksum += chainedFindAll(&chained, keys[order[i]], results, 64);
+    times.find_all = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) checksum += chainedRemoveByValue(&chained, keys[order[i]], (void *)(order[i] + 1));
+    times.remove = benchmarkSeconds() - start_time;
+    free(chained.items);
+    free(chained.page.pool);
+    free(chained.page.free);
+    return times;
+}
+
+// expected_items of 16 makes growing part of the insert time, count sizes it up front like the chained table
+HashTableTimes benchmarkFlat(uint64_t *keys, size_t *order, size_t count, size_t expected_items)
+{
+    HashTableTimes times;
+    size_t key_count = count / VALUES_PER_KEY;
+    void *results[64];
+    HashTable flat;
+    makeHashTable(&flat, expected_items);
+    double start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) insertToTable(&flat, keys[i], (void *)(i + 1));
+    times.insert = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) checksum += (size_t)findInTable(&flat, keys[order[i]]);
+    times.find = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < key_count; i++) checksum += findAllInTable(&flat, keys[order[i]], results, 64);
+    times.find_all = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (size_t i = 0; i < count; i++) checksum += removeFromTableByValue(&flat, keys[order[i]], (void *)(order[i] + 1));
+    times.remove = benchmarkSeconds() - start_time;
+    freeHashTable(&flat);
+    return times;
+}
+
+int main()
+{
+    size_t sizes[] = { 1000, 100000, 10000000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t count = sizes[s];
+        size_t key_count = count / VALUES_PER_KEY;
+        // keys are cell hashes in random order, values are just distinct pointers
+        uint64_t *keys = malloc(count * sizeof(uint64_t));
+        size_t *order = malloc(count * sizeof(size_t));
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t cell = benchmarkRandom() % key_count;
+            keys[i] = hashVector3((Vector3) { (int)(cell % 1024), (int)(cell / (1024 * 1024)), (int)(cell / 1024 % 1024) });
+            order[i] = i;
+        }
+        for (size_t i = count - 1; i > 0; i--)
+        {
+            size_t j = benchmarkRandom() % (i + 1);
+            size_t swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+        printf("%zu entries\n", count);
+        HashTableTimes chained = { 1e9, 1e9, 1e9, 1e9 }, grown = chained, sized = chained;
+        // the three are interleaved so that a slow patch on the machine doesn't land on just one of them
+        for (int run = 0; run < RUNS; run++)
+        {
+            keepFastest(&chained, benchmarkChained(keys, order, count, 2 * count));
+            keepFastest(&grown, benchmarkFlat(keys, order, count, 16));
+            keepFastest(&sized, benchmarkFlat(keys, order, count, count));
+        }
+        printTimes("chained", count, chained);
+        printTimes("flat", count, grown);
+        printTimes("flat sized", count, sized);
+        printf("  (checksum %zu)\n", checksum);
+        free(keys);
+        free(order);
+    }
+    return 0;
+}
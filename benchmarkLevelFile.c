@@ -0,0 +1,80 @@
+// Time to first frame: how long it takes to go from a level file on disk to having read every tile
+// the first frame draws, for the old flat files and the mapped chunk files, at 16 MiB and 1 GiB.
+// The files are just written so they will be in the page cache, this measures the work done
+// on load rather than the disk.
+// gcc -O3 benchmarkLevelFile.c -o benchmarkLevelFile
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+
+// the size of the patch of columns the first frame looks at, about a screen's worth
+#define FIRST_FRAME_VIEW 64
+
+void writeLegacyLevel(Level *level, const char *path)
+{
+    FILE *level_file = fopen(path, "wb");
+    fwrite(&level->size, sizeof(Vector3), 1, level_file);
+    size_t slice_size = (size_t)level->size.x * level->size.y;
+    char *slice = malloc(slice_size);
+    for (int z = 0; z < level->size.z; z++)
+    {
+        for (int x = 0; x < level->size.x; x++)
+        {
+            for (int y = 0; y < level->size.y; y++) slice[y + x * level->size.y] = getTileAtUnsafe((Vector3) { x, y, z }, level);
+        }
+        fwrite(slice, 1, slice_size, level_file);
+    }
+    fwrite(&level->start_positions, sizeof(level->start_positions), 1, level_file);
+    fclose(level_file);
+    free(slice);
+}
+
+// loads the level and reads the tiles of the first frame, returns the time it took in seconds
+double timeFirstFrame(const char *path, int64_t *tile_sum)
+{
+    double start_time = benchmarkSeconds();
+    Level level;
+    if (!loadLevel(&level, path))
+    {
+        printf("  couldn't load %s\n", path);
+        return 0;
+    }
+    *tile_sum = 0;
+    for (int z = 0; z < FIRST_FRAME_VIEW && z < level.size.z; z++)
+        for (int x = 0; x < FIRST_FRAME_VIEW && x < level.size.x; x++)
+            for (int y = 0; y < level.size.y; y++) *tile_sum += getTileAtUnsafe((Vector3) { x, y, z }, &level);
+    double first_frame_time = benchmarkSeconds() - start_time;
+    freeLevel(&level);
+    return first_frame_time;
+}
+
+void benchmarkLevelFile(Vector3 size)
+{
+    double start_time = benchmarkSeconds();
+    Level level;
+    generateBenchmarkLevel(&level, size, 42);
+    printf("%dx%dx%d level (%.0f MiB flat), generated in %.1f s\n", size.x, size.y, size.z,
+        (double)size.x * size.y * size.z / 1048576.0, benchmarkSeconds() - start_time);
+    writeLegacyLevel(&level, "benchmark_level_legacy");
+    start_time = benchmarkSeconds();
+    saveLevel(&level, "benchmark_level_chunked");
+    printf("  saved in %.2f s\n", benchmarkSeconds() - start_time);
+    freeLevel(&level);
+
+    int64_t legacy_sum = 0, chunked_sum = 0;
+    double legacy_time = timeFirstFrame("benchmark_level_legacy", &legacy_sum);
+    double chunked_time = timeFirstFrame("benchmark_level_chunked", &chunked_sum);
+    printf("  first frame: legacy %9.3f ms, mapped %9.3f ms\n", legacy_time * 1e3, chunked_time * 1e3);
+    if (legacy_sum != chunked_sum) puts("  results differ!");
+    remove("benchmark_level_legacy");
+    remove("benchmark_level_chunked");
+}
+
+int main()
+{
+    // 16 MiB
+    benchmarkLevelFile((Vector3) { 1024, 16, 1024 });
+    // 1 GiB
+    benchmarkLevelFile((Vector3) { 4096, 64, 4096 });
+    return 0;
+}
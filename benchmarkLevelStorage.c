@@ -0,0 +1,114 @@
+// Compares getTileAtUnsafe on the chunked level against the flat array the tiles used to be
+// stored in, for random lookups and for walking every tile in order, and how much memory each takes.
+// The walks are also done with a LevelTileReader, the way drawLevel and the terrain cache read tiles.
+// gcc -O3 benchmarkLevelStorage.c -o benchmarkLevelStorage
+// (at -O2 gcc doesn't inline getTileAtUnsafe into the loops, which costs more than the lookup itself)
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+
+#define LOOKUP_COUNT 20000000
+
+// the old layout, y varying fastest, then x, then z
+char flatTileAt(Vector3 position, char *tiles, Vector3 size)
+{
+    return tiles[position.y + position.x * size.y + (size_t)position.z * size.y * size.x];
+}
+
+void benchmarkLevelSize(Vector3 size)
+{
+    Level level;
+    generateBenchmarkLevel(&level, size, 42);
+    size_t tile_count = (size_t)size.x * size.y * size.z;
+    char *flat_tiles = malloc(tile_count);
+    for (int z = 0; z < size.z; z++)
+        for (int x = 0; x < size.x; x++)
+            for (int y = 0; y < size.y; y++)
+            {
+                Vector3 cell = { x, y, z };
+                flat_tiles[y + x * size.y + (size_t)z * size.y * size.x] = getTileAtUnsafe(cell, &level);
+            }
+
+    size_t dense_chunks = 0, palette_chunks = 0;
+    for (size_t i = 0; i < levelChunkTotal(&level); i++)
+    {
+        dense_chunks += level.chunks[i].kind == LEVEL_CHUNK_DENSE;
+        palette_chunks += level.chunks[i].kind == LEVEL_CHUNK_PALETTE;
+    }
+    printf("%dx%dx%d level, %zu chunks (%zu palette, %zu dense)\n", size.x, size.y, size.z,
+        levelChunkTotal(&level), palette_chunks, dense_chunks);
+    printf("  memory: flat %.2f MiB, chunked %.2f MiB\n", tile_count / 1048576.0, levelMemoryUsage(&level) / 1048576.0);
+
+    Vector3 *cells = malloc(LOOKUP_COUNT * sizeof(Vector3));
+    for (int i = 0; i < LOOKUP_COUNT; i++)
+    {
+        cells[i] = (Vector3) { benchmarkRandomRange(0, size.x - 1), benchmarkRandomRange(0, size.y - 1), benchmarkRandomRange(0, size.z - 1) };
+    }
+    int64_t flat_sum = 0, chunked_sum = 0;
+    double start_time = benchmarkSeconds();
+    for (int i = 0; i < LOOKUP_COUNT; i++) flat_sum += flatTileAt(cells[i], flat_tiles, size);
+    double flat_time = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (int i = 0; i < LOOKUP_COUNT; i++) chunked_sum += getTileAtUnsafe(cells[i], &level);
+    double chunked_time = benchmarkSeconds() - start_time;
+    printf("  random:     flat %6.2f ns, chunked %6.2f ns per lookup\n",
+        flat_time * 1e9 / LOOKUP_COUNT, chunked_time * 1e9 / LOOKUP_COUNT);
+    if (flat_sum != chunked_sum) puts("  results differ!");
+
+    // every tile, in the order drawLevel and the old flat array go through them
+    flat_sum = chunked_sum = 0;
+    start_time = benchmarkSeconds();
+    for (int z = 0; z < size.z; z++)
+        for (int x = 0; x < size.x; x++)
+            for (int y = 0; y < size.y; y++) flat_sum += flatTileAt((Vector3) { x, y, z }, flat_tiles, size);
+    flat_time = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (int z = 0; z < size.z; z++)
+        for (int x = 0; x < size.x; x++)
+            for (int y = 0; y < size.y; y++) chunked_sum += getTileAtUnsafe((Vector3) { x, y, z }, &level);
+    chunked_time = benchmarkSeconds() - start_time;
+    int64_t reader_sum = 0;
+    LevelTileReader reader = makeLevelTileReader(&level);
+    start_time = benchmarkSeconds();
+    for (int z = 0; z < size.z; z++)
+        for (int x = 0; x < size.x; x++)
+            for (int y = 0; y < size.y; y++) reader_sum += readTile(&reader, x, y, z);
+    double reader_time = benchmarkSeconds() - start_time;
+    printf("  sequential: flat %6.2f ns, chunked %6.2f ns, reader %6.2f ns per lookup\n",
+        flat_time * 1e9 / tile_count, chunked_time * 1e9 / tile_count, reader_time * 1e9 / tile_count);
+    if (flat_sum != chunked_sum || flat_sum != reader_sum) puts("  results differ!");
+
+    // the q-bert rows drawLevel goes through, a row for each height and each x + z, in order of x
+    flat_sum = chunked_sum = reader_sum = 0;
+    start_time = benchmarkSeconds();
+    for (int d = 0; d < size.x + size.z - 1; d++)
+        for (int y = 0; y < size.y; y++)
+            for (int x = diagonalRowStart(&level, d); x <= diagonalRowEnd(&level, d); x++) flat_sum += flatTileAt((Vector3) { x, y, d - x }, flat_tiles, size);
+    flat_time = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    for (int d = 0; d < size.x + size.z - 1; d++)
+        for (int y = 0; y < size.y; y++)
+            for (int x = diagonalRowStart(&level, d); x <= diagonalRowEnd(&level, d); x++) chunked_sum += getTileAtUnsafe((Vector3) { x, y, d - x }, &level);
+    chunked_time = benchmarkSeconds() - start_time;
+    reader = makeLevelTileReader(&level);
+    start_time = benchmarkSeconds();
+    for (int d = 0; d < size.x + size.z - 1; d++)
+        for (int y = 0; y < size.y; y++)
+            for (int x = diagonalRowStart(&level, d); x <= diagonalRowEnd(&level, d); x++) reader_sum += readTile(&reader, x, y, d - x);
+    reader_time = benchmarkSeconds() - start_time;
+    printf("  diagonal:   flat %6.2f ns, chunked %6.2f ns, reader %6.2f ns per lookup\n",
+        flat_time * 1e9 / tile_count, chunked_time * 1e9 / tile_count, reader_time * 1e9 / tile_count);
+    if (flat_sum != chunked_sum || flat_sum != reader_sum) puts("  results differ!");
+
+    free(cells);
+    free(flat_tiles);
+    freeLevel(&level);
+}
+
+int main()
+{
+    benchmarkLevelSize((Vector3) { 128, 6, 128 });
+    benchmarkLevelSize((Vector3) { 512, 32, 512 });
+    benchmarkLevelSize((Vector3) { 2048, 64, 2048 });
+    return 0;
+}
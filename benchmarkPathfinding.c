@@ -0,0 +1,202 @@
+// Reports A* queries per second on generated levels, and compares
+// long-distance latency of flat A* against hierarchical pathfinding, and
+// one A* per unit against a single shared flow field
+// gcc -O2 benchmarkPathfinding.c -o benchmarkPathfinding
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+#include "a_star.h"
+#include "hierarchical_path.h"
+#include "flow_field.h"
+
+typedef struct
+{
+    Vector3 size;
+    // this doubles as the search budget, a query that can't reach its goal explores until it runs out
+    int max_nodes;
+    int local_queries;
+    int long_queries;
+} PathfindingBenchmarkCase;
+
+// goals within this many tiles of the start are like typical unit orders
+#define LOCAL_QUERY_RADIUS 32
+
+void runQueries(const char *label, Level *level, SearchData *search_data, int query_count, int radius)
+{
+    Vector3 *starts = malloc(query_count * sizeof(Vector3));
+    Vector3 *goals = malloc(query_count * sizeof(Vector3));
+    for (int i = 0; i < query_count; i++)
+    {
+        starts[i] = benchmarkRandomSurfaceCell(level);
+        if (radius)
+        {
+            int x, z;
+            do
+            {
+                x = starts[i].x + benchmarkRandomRange(-radius, radius);
+                z = starts[i].z + benchmarkRandomRange(-radius, radius);
+            } while (x < 0 || x >= level->size.x || z < 0 || z >= level->size.z || benchmarkColumnTop(level, x, z).y <= 0);
+            goals[i] = benchmarkColumnTop(level, x, z);
+        }
+        else goals[i] = benchmarkRandomSurfaceCell(level);
+    }
+
+    int found = 0;
+    size_t total_length = 0, total_expanded = 0;
+    double start_time = benchmarkSeconds();
+    for (int i = 0; i < query_count; i++)
+    {
+        if (aStarPathFind(starts[i], goals[i], search_data, level))
+        {
+            found++;
+            total_length += search_data->path_length;
+        }
+        total_expanded += search_data->node_count;
+    }
+    double elapsed = benchmarkSeconds() - start_time;
+    printf("  %-10s %6d queries  %10.1f queries/s  %5.1f%% found  avg path %6.1f  avg nodes touched %9.1f\n",
+        label, query_count, query_count / elapsed, 100.0 * found / query_count,
+        found ? (double)total_length / found : 0.0, (double)total_expanded / query_count);
+    free(starts);
+    free(goals);
+}
+
+// long orders are this many tiles apart (manhattan), whatever the size of the map
+#define LONG_QUERY_DISTANCE 200
+#define LONG_QUERY_COUNT 20
+
+Vector3 randomCellAtDistance(Level *level, Vector3 start, int distance)
+{
+    for (;;)
+    {
+        int dx = benchmarkRandomRange(-distance, distance);
+        int dz = (distance - abs(dx)) * ((benchmarkRandom() & 1) ? 1 : -1);
+        int x = start.x + dx, z = start.z + dz;
+        if (x < 0 || x >= level->size.x || z < 0 || z >= level->size.z) continue;
+        Vector3 goal = benchmarkColumnTop(level, x, z);
+        if (goal.y > 0) return goal;
+    }
+}
+
+void compareLongQueries(Vector3 size)
+{
+    Level level;
+    generateBenchmarkLevel(&level, size, 99);
+    Vector3 starts[LONG_QUERY_COUNT], goals[LONG_QUERY_COUNT];
+    for (int i = 0; i < LONG_QUERY_COUNT; i++)
+    {
+        starts[i] = benchmarkRandomSurfaceCell(&level);
+        goals[i] = randomCellAtDistance(&level, starts[i], LONG_QUERY_DISTANCE);
+    }
+
+    SearchData search_data = createSearchData(1 << 20);
+    int flat_found = 0;
+    double start_time = benchmarkSeconds();
+    for (int i = 0; i < LONG_QUERY_COUNT; i++) flat_found += aStarPathFind(starts[i], goals[i], &search_data, &level) != NULL;
+    double flat_time = (benchmarkSeconds() - start_time) / LONG_QUERY_COUNT;
+    freeSearchData(&search_data);
+
+    HpaGraph graph;
+    createHpaGraph(&graph, &level, 1 << 16, 1 << 14);
+    start_time = benchmarkSeconds();
+    buildHpaGraph(&graph);
+    double build_time = benchmarkSeconds() - start_time;
+    int hpa_found = 0;
+    start_time = benchmarkSeconds();
+    for (int i = 0; i < LONG_QUERY_COUNT; i++) hpa_found += hpaFindPath(&graph, starts[i], goals[i]) != 0;
+    double hpa_time = (benchmarkSeconds() - start_time) / LONG_QUERY_COUNT;
+
+    // edit one tile and time the query that has to rebuild its chunk
+    Vector3 edit = benchmarkRandomSurfaceCell(&level);
+    setTileAt(BENCHMARK_WALL_TILE, edit, &level);
+    start_time = benchmarkSeconds();
+    buildHpaGraph(&graph);
+    double rebuild_time = benchmarkSeconds() - start_time;
+
+    printf("  %4dx%2dx%-4d  flat A* %9.1f us (%2d found)  HPA* %8.1f us (%2d found)  full build %8.1f ms  rebuild after one edit %6.1f us\n",
+        size.x, size.y, size.z, flat_time * 1e6, flat_found, hpa_time * 1e6, hpa_found, build_time * 1e3, rebuild_time * 1e6);
+    freeHpaGraph(&graph);
+    freeLevel(&level);
+}
+
+#define SQUAD_RADIUS 48
+#define FLOW_FIELD_RADIUS 64
+
+void compareSquadOrders(Level *level, int unit_count)
+{
+    Vector3 goal = benchmarkColumnTop(level, level->size.x / 2, level->size.z / 2);
+    Vector3 *units = malloc(unit_count * sizeof(Vector3));
+    for (int i = 0; i < unit_count; i++)
+    {
+        Vector3 unit;
+        do
+        {
+            unit = benchmarkColumnTop(level, goal.x + benchmarkRandomRange(-SQUAD_RADIUS, SQUAD_RADIUS), goal.z + benchmarkRandomRange(-SQUAD_RADIUS, SQUAD_RADIUS));
+        } while (unit.y <= 0);
+        units[i] = unit;
+    }
+
+    SearchData search_data = createSearchData(1 << 18);
+    int a_star_found = 0;
+    double start_time = benchmarkSeconds();
+    for (int i = 0; i < unit_count; i++) a_star_found += aStarPathFind(units[i], goal, &search_data, level) != NULL;
+    double a_star_time = benchmarkSeconds() - start_time;
+    freeSearchData(&search_data);
+
+    FlowFieldCache cache = createFlowFieldCache(level, 4, FLOW_FIELD_RADIUS);
+    start_time = benchmarkSeconds();
+    FlowField *field = getFlowField(&cache, goal);
+    double generate_time = benchmarkSeconds() - start_time;
+    // walk every unit all the way to the goal, which is more than a tick would ask for
+    int flow_found = 0;
+    start_time = benchmarkSeconds();
+    for (int i = 0; i < unit_count; i++)
+    {
+        Vector3 position = units[i], step;
+        while (flowFieldDirection(field, position, &step)) position = addVector3(position, step);
+        flow_found += position.x == goal.x && position.y == goal.y && position.z == goal.z;
+    }
+    double walk_time = benchmarkSeconds() - start_time;
+    start_time = benchmarkSeconds();
+    getFlowField(&cache, goal);
+    double cached_time = benchmarkSeconds() - start_time;
+    freeFlowFieldCache(&cache);
+
+    printf("  %5d units  A* %9.2f ms (%4d found)  flow field %7.2f ms generate + %7.3f ms walking (%4d found), cached lookup %6.2f us\n",
+        unit_count, a_star_time * 1e3, a_star_found, generate_time * 1e3, walk_time * 1e3, flow_found, cached_time * 1e6);
+    free(units);
+}
+
+int main()
+{
+    PathfindingBenchmarkCase cases[] =
+    {
+        { { 128, 6, 128 }, 128 * 6 * 128, 5000, 200 },
+        { { 1024, 16, 1024 }, 1 << 18, 2000, 20 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        Level level;
+        generateBenchmarkLevel(&level, cases[i].size, 1234 + i);
+        SearchData search_data = createSearchData(cases[i].max_nodes);
+        printf("%dx%dx%d level, %d max nodes\n", level.size.x, level.size.y, level.size.z, cases[i].max_nodes);
+        runQueries("local", &level, &search_data, cases[i].local_queries, LOCAL_QUERY_RADIUS);
+        runQueries("cross-map", &level, &search_data, cases[i].long_queries, 0);
+        freeSearchData(&search_data);
+        freeLevel(&level);
+    }
+
+    printf("%d tile orders, average latency per query\n", LONG_QUERY_DISTANCE);
+    compareLongQueries((Vector3) { 256, 16, 256 });
+    compareLongQueries((Vector3) { 512, 16, 512 });
+    compareLongQueries((Vector3) { 1024, 16, 1024 });
+
+    Level level;
+    generateBenchmarkLevel(&level, (Vector3) { 256, 16, 256 }, 42);
+    printf("units up to %d tiles from a shared goal on a 256x16x256 level\n", SQUAD_RADIUS);
+    compareSquadOrders(&level, 10);
+    compareSquadOrders(&level, 100);
+    compareSquadOrders(&level, 1000);
+    freeLevel(&level);
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Moves 10K entities around a level every tick with moveEntity, keeping the spatial grid up to date
+// with the cells each one covers, and does the same with a copy of the hash table version it replaced
+// gcc -O2 benchmarkSpatialGrid.c $(sdl2-config --cflags --libs) -o benchmarkSpatialGrid
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark_utils.h"
+#include "HashTable.h"
+#include "spatial_grid.h"
+#include "entity_store.h"
+#include "entity.h"
+
+#define ENTITY_COUNT 10000
+#define TICK_COUNT 200
+// the most an entity moves along x and z in a tick, a quarter of a cell
+#define MAX_STEP (TILE_HALF_WIDTH_PX * ENTITY_POSITION_MULTIPLIER / 4)
+#define QUERY_AREA 64
+// the fastest of this many runs is reported
+#define QUERY_REPEATS 20
+
+// only one of the two is set, the branch is the same every call so it costs next to nothing
+typedef struct
+{
+    HashTable *table;
+    SpatialGrid *grid;
+} EntityIndex;
+
+// *** addEntity and moveEntity on the old hash table, for comparison ***
+// moveEntity's early out for moves that stay in the same cells is kept, so only the index differs
+void addHashEntity(EntityStore *store, EntityHandle entity, Vector3 position, Vector3 size, HashTable *table)
+{
+    uint32_t index = entityIndex(store, entity);
+    store->positions[index] = position;
+    size.x *= ENTITY_POSITION_MULTIPLIER;
+    size.y *= ENTITY_POSITION_MULTIPLIER;
+    size.z *= ENTITY_POSITION_MULTIPLIER;
+    store->sizes[index] = size;
+    Vector3 world_floor = entityToWorldPosition(position);
+    Vector3 world_ceil = entityToWorldPosition(addVector3(position, size));
+    for (int z = world_floor.z; z <= world_ceil.z; z++)
+        for (int x = world_floor.x; x <= world_ceil.x; x++)
+            for (int y = world_floor.y; y <= world_ceil.y; y++)
+                insertToTable(table, hashVector3((Vector3) { x, y, z }), (void *)(uintptr_t)entity);
+}
+
+void moveHashEntity(EntityStore *store, EntityHandle entity, Vector3 new_position, HashTable *table)
+{
+    uint32_t index = entityIndex(store, entity);
+    Vector3 old_floor = entityToWorldPosition(store->positions[index]);
+    Vector3 old_ceil = entityToWorldPosition(addVector3(store->positions[index], store->sizes[index]));
+    Vector3 new_floor = entityToWorldPosition(new_position);
+    Vector3 new_ceil = entityToWorldPosition(addVector3(new_position, store->sizes[index]));
+    store->positions[index] = new_position;
+    if (sameCellFootprint(old_floor, old_ceil, new_floor, new_ceil)) return;
+    for (int z = old_floor.z; z <= old_ceil.z; z++)
+        for (int x = old_floor.x; x <= old_ceil.x; x++)
+            for (int y = old_floor.y; y <= old_ceil.y; y++)
+            {
+                Vector3 cell = { x, y, z };
+                if (!pointIsInPrism(new_floor, new_ceil, cell)) removeFromTableByValue(table, hashVector3(cell), (void *)(uintptr_t)entity);
+            }
+    for (int z = new_floor.z; z <= new_ceil.z; z++)
+        for (int x = new_floor.x; x <= new_ceil.x; x++)
+            for (int y = new_floor.y; y <= new_ceil.y; y++)
+            {
+                Vector3 cell = { x, y, z };
+                if (!pointIsInPrism(old_floor, old_ceil, cell)) insertToTable(table, hashVector3(cell), (void *)(uintptr_t)entity);
+            }
+}
+
+void indexAddEntity(EntityIndex *index, EntityStore *store, EntityHandle entity, Vector3 position, Vector3 size)
+{
+    if (index->grid) addEntity(store, entity, position, size, index->grid);
+    else addHashEntity(store, entity, position, size, index->table);
+}
+
+void indexMoveEntity(EntityIndex *index, EntityStore *store, EntityHandle entity, Vector3 new_position)
+{
+    if (index->grid) moveEntity(store, entity, new_position, index->grid);
+    else moveHashEntity(store, entity, new_position, index->table);
+}
+
+// results has to hold 64 entries
+size_t indexQuery(EntityIndex *index, Vector3 cell, uint32_t *results)
+{
+    if (index->grid) return spatialGridQuery(index->grid, cell, results, 64);
+    void *table_results[64];
+    size_t count = findAllInTable(index->table, hashVector3(cell), table_results, 64);
+    for (size_t i = 0; i < count; i++) results[i] = (uint32_t)(uintptr_t)table_results[i];
+    return count;
+}
+
+void runBenchmark(const char *label, EntityIndex *index, Vector3 level_size)
+{
+    EntityStore store;
+    createEntityStore(&store, ENTITY_COUNT);
+    EntityHandle *entities = malloc(ENTITY_COUNT * sizeof(EntityHandle));
+    // entities stay one cell up, and just inside the far edges
+    Vector3 most = worldToEntityPosition((Vector3) { level_size.x - 2, 1, level_size.z - 2 });
+    benchmark_random_state = 0x12345678;
+    for (int i = 0; i < ENTITY_COUNT; i++)
+    {
+        entities[i] = createEntity(&store);
+        Vector3 position = { benchmarkRandomRange(0, most.x), most.y, benchmarkRandomRange(0, most.z) };
+        // the same size as the game's entities, just under a cell
+        Vector3 size = { TILE_HALF_WIDTH_PX - 1, TILE_HEIGHT_PX - 1, TILE_HALF_WIDTH_PX - 1 };
+        indexAddEntity(index, &store, entities[i], position, size);
+    }
+
+    double start_time = benchmarkSeconds();
+    for (int tick = 0; tick < TICK_COUNT; tick++)
+    {
+        for (int i = 0; i < ENTITY_COUNT; i++)
+        {
+            Vector3 position = entityPosition(&store, entities[i]);
+            position.x = clamp(position.x + benchmarkRandomRange(-MAX_STEP, MAX_STEP), 0, most.x);
+            position.z = clamp(position.z + benchmarkRandomRange(-MAX_STEP, MAX_STEP), 0, most.z);
+            indexMoveEntity(index, &store, entities[i], position);
+        }
+    }
+    double move_time = benchmarkSeconds() - start_time;
+
+    // and look up every cell in a screen sized patch, like drawLevel would
+    uint32_t results[64];
+    size_t found = 0;
+    double query_time = 1e9;
+    for (int repeat = 0; repeat < QUERY_REPEATS; repeat++)
+    {
+        found = 0;
+        start_time = benchmarkSeconds();
+        for (int z = 0; z < QUERY_AREA; z++)
+            for (int x = 0; x < QUERY_AREA; x++)
+                for (int y = 0; y < level_size.y; y++) found += indexQuery(index, (Vector3) { x, y, z }, results);
+        double time = benchmarkSeconds() - start_time;
+        if (time < query_time) query_time = time;
+    }
+
+    printf("  %-6s %8.3f ms per tick, %dx%d column query %8.3f ms (%zu found)\n", label,
+        move_time * 1e3 / TICK_COUNT, QUERY_AREA, QUERY_AREA, query_time * 1e3, found);
+    free(entities);
+    freeEntityStore(&store);
+}
+
+int main()
+{
+    Vector3 sizes[] = { { 128, 6, 128 }, { 1024, 16, 1024 } };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        Vector3 size = sizes[s];
+        printf("%d entities on a %dx%dx%d level\n", ENTITY_COUNT, size.x, size.y, size.z);
+
+        HashTable table;
+        makeHashTable(&table, ENTITY_COUNT * 8);
+        EntityIndex table_index = { &table, NULL };
+        runBenchmark("hash", &table_index, size);
+        freeHashTable(&table);
+
+        SpatialGrid grid;
+        createSpatialGrid(&grid, size);
+        EntityIndex grid_index = { NULL, &grid };
+        runBenchmark("grid", &grid_index, size);
+        freeSpatialGrid(&grid);
+    }
+    return 0;
+}
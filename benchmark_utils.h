@@ -0,0 +1,105 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "vector.h"
+#include "level.h"
+
+// Shared helpers for the standalone benchmark programs, these don't need SDL
+
+#define BENCHMARK_HILL_SPACING 16
+// tile ids from textures_generated.h, which can't be included without SDL
+#define BENCHMARK_WALL_TILE 8
+
+double benchmarkSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+uint64_t benchmark_random_state = 0x9E3779B97F4A7C15ull;
+
+uint64_t benchmarkRandom()
+{
+    uint64_t x = benchmark_random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return benchmark_random_state = x;
+}
+
+int benchmarkRandomRange(int minimum, int maximum)
+{
+    return minimum + (int)(benchmarkRandom() % (uint64_t)(maximum - minimum + 1));
+}
+
+// Makes rolling hills out of bilinearly interpolated random heights, with some walls
+// thrown in so paths have to go around things. Every column has at least one solid tile.
+void generateBenchmarkLevel(Level *level, Vector3 size, uint64_t seed)
+{
+    benchmark_random_state = seed ? seed : 1;
+    createLevel(level, size);
+
+    int grid_x = size.x / BENCHMARK_HILL_SPACING + 2;
+    int grid_z = size.z / BENCHMARK_HILL_SPACING + 2;
+    int max_height = (size.y > 3) ? size.y - 3 : 1;
+    int *heights = malloc(grid_x * grid_z * sizeof(int));
+    for (int i = 0; i < grid_x * grid_z; i++) heights[i] = benchmarkRandomRange(1, max_height);
+
+    for (int z = 0; z < size.z; z++)
+    {
+        for (int x = 0; x < size.x; x++)
+        {
+            int cell_x = x / BENCHMARK_HILL_SPACING, cell_z = z / BENCHMARK_HILL_SPACING;
+            int fraction_x = x % BENCHMARK_HILL_SPACING, fraction_z = z % BENCHMARK_HILL_SPACING;
+            int top = heights[cell_x + cell_z * grid_x] * (BENCHMARK_HILL_SPACING - fraction_x) * (BENCHMARK_HILL_SPACING - fraction_z)
+                + heights[cell_x + 1 + cell_z * grid_x] * fraction_x * (BENCHMARK_HILL_SPACING - fraction_z)
+                + heights[cell_x + (cell_z + 1) * grid_x] * (BENCHMARK_HILL_SPACING - fraction_x) * fraction_z
+                + heights[cell_x + 1 + (cell_z + 1) * grid_x] * fraction_x * fraction_z;
+            top /= BENCHMARK_HILL_SPACING * BENCHMARK_HILL_SPACING;
+            for (int y = 0; y < top && y < size.y; y++)
+            {
+                setTileAt(1 + (x ^ z ^ y) % 3, (Vector3) { x, y, z }, level);
+            }
+        }
+    }
+    free(heights);
+
+    // walls two tiles tall, with gaps
+    int wall_count = size.x * size.z / 512;
+    for (int i = 0; i < wall_count; i++)
+    {
+        Vector3 corner = { benchmarkRandomRange(0, size.x - 1), 0, benchmarkRandomRange(0, size.z - 1) };
+        int length = benchmarkRandomRange(4, 24);
+        int along_x = benchmarkRandom() & 1;
+        for (int j = 0; j < length; j++)
+        {
+            Vector3 cell = corner;
+            if (along_x) cell.x += j; else cell.z += j;
+            if (cell.x >= size.x || cell.z >= size.z) break;
+            while (cell.y < size.y && getTileAtUnsafe(cell, level)) cell.y++;
+            for (int k = 0; k < 2 && cell.y < size.y; k++, cell.y++) setTileAt(BENCHMARK_WALL_TILE, cell, level);
+        }
+    }
+    compactLevel(level);
+}
+
+// returns the first empty cell above the ground in a column, or y = -1 if the column is full
+Vector3 benchmarkColumnTop(Level *level, int x, int z)
+{
+    Vector3 cell = { x, 0, z };
+    while (cell.y < level->size.y && getTileAtUnsafe(cell, level)) cell.y++;
+    if (cell.y >= level->size.y) cell.y = -1;
+    return cell;
+}
+
+Vector3 benchmarkRandomSurfaceCell(Level *level)
+{
+    for (;;)
+    {
+        Vector3 cell = benchmarkColumnTop(level, benchmarkRandomRange(0, level->size.x - 1), benchmarkRandomRange(0, level->size.z - 1));
+        if (cell.y > 0) return cell;
+    }
+}
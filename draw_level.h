@@ -5,31 +5,104 @@
 #include "vector.h"
 #include "level.h"
 #include "entity.h"
-#include "HashTable.h"
+#include "spatial_grid.h"
 #include "math_utils.h"
 #include "textures_generated.h"
+#include "terrain_cache.h"
+#include "draw_order.h"
+#include "screen_grid.h"
+#include "FlatHashTable.h"
+#include "frame_arena.h"
+#include "draw_list.h"
+#include "trace.h"
 
-#define MAX_ENTITIES_PER_CELL 64
-#define TOP_ENTITIES_PER_LAYER 64
-#define SCREEN_GRID_SIZE_PX 70
-#define RENDER_TARGET_STACK_MAX 32
-#define MAX_ENTITIES 128
+// texture data is made in chunks of this many, so it stays put as more is made
+#define TEXTURE_DATA_CHUNK_SIZE 64
 
-Entity *entity_search_results[MAX_ENTITIES_PER_CELL];
-Entity *top_entity_array[TOP_ENTITIES_PER_LAYER];
-SDL_Rect top_clipping_rectangle_array[TOP_ENTITIES_PER_LAYER];
-TextureData entity_texture_data[MAX_ENTITIES] = { 0 };
-SDL_Texture *render_target_stack[RENDER_TARGET_STACK_MAX];
+typedef struct TopEntity
+{
+    EntityHandle entity;
+    SDL_Rect clipping_rectangle;
+} TopEntity;
+
+// Everything drawLevel only needs until the end of the frame comes out of draw_level_arena,
+// which is reset at the start of every drawLevel, so these grow as big as they need to be
+FrameArena draw_level_arena = { 0 };
+TopEntity *top_entities = NULL;
+size_t top_entity_capacity = 0;
+SDL_Texture **render_target_stack = NULL;
 size_t render_target_top = 0;
+size_t render_target_capacity = 0;
+
+TextureData **entity_texture_data_chunks = NULL;
+size_t entity_texture_data_chunk_count = 0;
 size_t entity_texture_data_count = 0;
-uint64_t *screen_grid;
-size_t screen_grid_width, screen_grid_height;
 int texture_width, texture_height;
-extern HashTable entity_by_location;
+// the (behind, in front) pairs of entities that have been stamped this frame
+FlatHashTable stamped_pairs = { 0 };
+extern SpatialGrid entity_by_location;
+extern EntityStore entity_store;
+extern TerrainCache terrain_cache;
+
+// How long each part of the last drawLevel took, in SDL_GetPerformanceCounter ticks.
+// The tile pass includes the overlap testing it does. That's timed for every tile it redraws, which is
+// too often for the game, so overlap_testing stays 0 unless DRAW_LEVEL_OVERLAP_TIMING is defined.
+typedef struct DrawLevelTimings
+{
+    uint64_t setup;
+    uint64_t terrain;
+    // waiting for the tile pass's lists after the terrain is done, see draw_list.h
+    uint64_t draw_list_wait;
+    uint64_t entity_pass;
+    uint64_t tile_pass;
+    uint64_t overlap_testing;
+    uint64_t mask_compositing;
+} DrawLevelTimings;
+
+DrawLevelTimings draw_level_timings;
+
+TextureData *entityTextureData(size_t index)
+{
+    return &entity_texture_data_chunks[index / TEXTURE_DATA_CHUNK_SIZE][index % TEXTURE_DATA_CHUNK_SIZE];
+}
+
+// Returns cleared texture data for an entity, which lasts until clearEntityTextureData
+TextureData *newEntityTextureData()
+{
+    if (entity_texture_data_count == entity_texture_data_chunk_count * TEXTURE_DATA_CHUNK_SIZE)
+    {
+        entity_texture_data_chunks = realloc(entity_texture_data_chunks, (entity_texture_data_chunk_count + 1) * sizeof(TextureData *));
+        entity_texture_data_chunks[entity_texture_data_chunk_count++] = malloc(TEXTURE_DATA_CHUNK_SIZE * sizeof(TextureData));
+    }
+    TextureData *texture_data = entityTextureData(entity_texture_data_count++);
+    *texture_data = (TextureData) { 0 };
+    return texture_data;
+}
+
+// Lets go of all of the texture data, the chunks are kept to be used again
+void clearEntityTextureData()
+{
+    entity_texture_data_count = 0;
+}
+
+void freeEntityTextureData()
+{
+    for (size_t i = 0; i < entity_texture_data_chunk_count; i++) free(entity_texture_data_chunks[i]);
+    free(entity_texture_data_chunks);
+    entity_texture_data_chunks = NULL;
+    entity_texture_data_chunk_count = 0;
+    entity_texture_data_count = 0;
+}
 
 void pushRenderTarget(SDL_Renderer *renderer, SDL_Texture *target)
 {
-    assert(render_target_top < RENDER_TARGET_STACK_MAX);
+    if (render_target_top == render_target_capacity)
+    {
+        size_t capacity = render_target_capacity ? 2 * render_target_capacity : 16;
+        render_target_stack = frameArenaGrow(&draw_level_arena, render_target_stack,
+            render_target_capacity * sizeof(SDL_Texture *), capacity * sizeof(SDL_Texture *));
+        render_target_capacity = capacity;
+    }
     render_target_stack[render_target_top++] = SDL_GetRenderTarget(renderer);
     SDL_SetRenderTarget(renderer, target);
 }
@@ -40,43 +113,56 @@ void popRenderTarget(SDL_Renderer *renderer)
     SDL_SetRenderTarget(renderer, render_target_stack[--render_target_top]);
 }
 
+// Grows the union rectangle of every entity drawn under screen_rectangle to its overlap with it,
+// if that's bigger. Returns whether anything was drawn there.
 int doOverlapTesting(SDL_Rect screen_rectangle)
 {
-    int min_x = clamp(screen_rectangle.x / SCREEN_GRID_SIZE_PX, 0, screen_grid_width - 1);
-    int max_x = clamp((screen_rectangle.x + screen_rectangle.w) / SCREEN_GRID_SIZE_PX, 0, screen_grid_width - 1);
-    int min_y = clamp(screen_rectangle.y / SCREEN_GRID_SIZE_PX, 0, screen_grid_height - 1);
-    int max_y = clamp((screen_rectangle.y + screen_rectangle.h) / SCREEN_GRID_SIZE_PX, 0, screen_grid_height - 1);
-    uint64_t checks = 0;
-    for (int x = min_x; x <= max_x; x++)
+    ScreenGridRange range = screenGridRange(&screen_grid, screen_rectangle);
+    int found = 0;
+    for (int y = range.min_y; y <= range.max_y; y++)
     {
-        for (int y = min_y; y <= max_y; y++)
+        for (int x = range.min_x; x <= range.max_x; x++)
         {
-            checks |= screen_grid[x + y * screen_grid_width];
+            for (int32_t entry = screen_grid.heads[x + y * screen_grid.width]; entry >= 0; entry = screen_grid.entries[entry].next)
+            {
+                TextureData *texture_data = screen_grid.entries[entry].texture_data;
+                SDL_Rect *union_rect = &texture_data->union_rectangle;
+                SDL_Rect intersect_rect = rectangleIntersect(texture_data->bounds_rectangle, screen_rectangle);
+                *union_rect = (intersect_rect.w * intersect_rect.h > union_rect->w * union_rect->h) ? intersect_rect : *union_rect;
+                found = 1;
+            }
         }
     }
-    if (checks)
+    return found;
+}
+
+// The terrain cache already has every tile drawn in the right order, except where entities have been
+// drawn over it since. So a tile only has to be drawn again in the screen grid cells that have been marked,
+// and only those parts of it, or it would end up on top of the tiles in front of it outside of them.
+// The parts go in tile_batch, which has to be flushed before anything else is drawn.
+void redrawTileOverEntities(uint8_t tile, SDL_Rect destination_rectangle)
+{
+    ScreenGridRange range = screenGridRange(&screen_grid, destination_rectangle);
+    for (int x = range.min_x; x <= range.max_x; x++)
     {
-        for (int i = 0; i < 64; i++)
+        for (int y = range.min_y; y <= range.max_y; y++)
         {
-            if ((checks >> i) & 1)
-            {
-                for (int j = 0; j < (MAX_ENTITIES + 63) / 64; j++)
-                {
-                    SDL_Rect *union_rect = &entity_texture_data[i * ((MAX_ENTITIES + 63) / 64) + j].union_rectangle;
-                    SDL_Rect intersect_rect = rectangleIntersect(entity_texture_data[i * ((MAX_ENTITIES + 63) / 64) + j].bounds_rectangle, screen_rectangle);
-                    *union_rect = (intersect_rect.w * intersect_rect.h > union_rect->w * union_rect->h) ? intersect_rect : *union_rect;
-                }
-            }
+            if (!screenGridSquareMarked(&screen_grid, x, y)) continue;
+            SDL_Rect grid_cell = { x * SCREEN_GRID_SIZE_PX, y * SCREEN_GRID_SIZE_PX, SCREEN_GRID_SIZE_PX, SCREEN_GRID_SIZE_PX };
+            SDL_Rect part = rectangleIntersect(destination_rectangle, grid_cell);
+            if (part.w <= 0 || part.h <= 0) continue;
+            batchTilePart(&tile_batch, tile, destination_rectangle, part);
         }
-        return 1;
-    } else return 0;
+    }
 }
 
-void drawEditorCursor(Entity *cursor_entity, SDL_Renderer *renderer, int camera_x, int camera_y, SDL_Rect clipping_rectangle)
+void drawEditorCursor(EntityStore *store, EntityHandle cursor_entity, SDL_Renderer *renderer, int camera_x, int camera_y, SDL_Rect clipping_rectangle)
 {
-    char tile = ((PlacementCursor *)cursor_entity->specific_data)->tile_id;
+    uint32_t index = entityIndex(store, cursor_entity);
+    TextureData *texture_data = store->texture_data[index];
+    uint8_t tile = ((PlacementCursor *)store->specific_data[index])->tile_id;
     int screen_x, screen_y;
-    entityToScreen(cursor_entity->position, camera_x, camera_y, &screen_x, &screen_y);
+    entityToScreen(store->positions[index], camera_x, camera_y, &screen_x, &screen_y);
     if (tile_textures[tile])
     {
         int texture_width, texture_height;
@@ -91,35 +177,76 @@ void drawEditorCursor(Entity *cursor_entity, SDL_Renderer *renderer, int camera_
             intersection_max_x - intersection_min_x, intersection_max_y - intersection_min_y };
         SDL_Rect dest_rect = { intersection_min_x, intersection_min_y, intersection_max_x - intersection_min_x,
             intersection_max_y - intersection_min_y };
-        SDL_RenderCopy(renderer, cursor_entity->texture_data->temporary_frame_buffer, &src_rect, &dest_rect);
+        SDL_RenderCopy(renderer, texture_data->temporary_frame_buffer, &src_rect, &dest_rect);
         // TODO: Update the animation frames before calling drawLevel
-        cursor_entity->texture_data->amimation_frame = tile_textures[tile];
-        cursor_entity->texture_data->animation_frame_mask = tile_mask_textures[tile];
+        texture_data->amimation_frame = tile_textures[tile];
+        texture_data->animation_frame_mask_rect = tile_mask_atlas_rects[tile];
+        texture_data->animation_frame_mask = tile_mask_atlas_rects[tile].w ? tile_atlas : NULL;
         SDL_Rect bounds = { screen_x, screen_y, texture_width, texture_height };
-        cursor_entity->texture_data->bounds_rectangle = bounds;
-        cursor_entity->texture_data->union_rectangle = bounds;
-        cursor_entity->texture_data->union_rectangle.w = 0;
-        cursor_entity->texture_data->union_rectangle.h = 0;
+        texture_data->bounds_rectangle = bounds;
+        texture_data->union_rectangle = bounds;
+        texture_data->union_rectangle.w = 0;
+        texture_data->union_rectangle.h = 0;
+        markScreenGrid(&screen_grid, bounds, texture_data);
+    }
+}
 
-        int min_x = clamp(bounds.x / SCREEN_GRID_SIZE_PX, 0, screen_grid_width - 1);
-        int max_x = clamp((bounds.x + bounds.w) / SCREEN_GRID_SIZE_PX, 0, screen_grid_width - 1);
-        int min_y = clamp(bounds.y / SCREEN_GRID_SIZE_PX, 0, screen_grid_height - 1);
-        int max_y = clamp((bounds.y + bounds.h) / SCREEN_GRID_SIZE_PX, 0, screen_grid_height - 1);
-        uint64_t index_bitflag = 1 << ((cursor_entity->texture_data - entity_texture_data) / (sizeof(TextureData) * ((MAX_ENTITIES + 63) / 64)));
-        //printf("%lu flag\n", index_bitflag);
-        for (int x = min_x; x <= max_x; x++)
+// To prevent weirdness with entities that are behind others and halfway occupying a cell that gets drawn after,
+// we stamp the frames of the entities in a cell onto the frames of the ones behind them in it.
+// Two entities can share a lot of cells, but each pair only needs stamping once a frame, and only if they
+// overlap on screen at all. The stamps onto each entity go together so its frame is only made the target once.
+// Going from the back, an entity's frame is stamped onto the ones behind it before anything is stamped onto it.
+void stampCellEntities(SDL_Renderer *renderer, EntityHandle *cell_entities, size_t count, int camera_x, int camera_y)
+{
+    for (size_t j = 0; j + 1 < count; j++)
+    {
+        uint32_t back_index = entityIndex(&entity_store, cell_entities[j]);
+        TextureData *back_texture_data = entity_store.texture_data[back_index];
+        if (!back_texture_data) continue;
+        int rectangle_screen_x, rectangle_screen_y;
+        entityToScreen(entity_store.positions[back_index], camera_x, camera_y, &rectangle_screen_x, &rectangle_screen_y);
+        SDL_Rect back_entity_rect = { rectangle_screen_x, rectangle_screen_y, back_texture_data->bounds_rectangle.w, back_texture_data->bounds_rectangle.h };
+        int target_pushed = 0;
+        for (size_t i = j + 1; i < count; i++)
         {
-            for (int y = min_y; y <= max_y; y++)
+            uint32_t front_index = entityIndex(&entity_store, cell_entities[i]);
+            TextureData *front_texture_data = entity_store.texture_data[front_index];
+            if (!front_texture_data) continue;
+            uint64_t pair = ((uint64_t)cell_entities[j] << 32) | cell_entities[i];
+            if (flatTableFind(&stamped_pairs, pair)) continue;
+            flatTableInsert(&stamped_pairs, pair, &stamped_pairs);
+            entityToScreen(entity_store.positions[front_index], camera_x, camera_y, &rectangle_screen_x, &rectangle_screen_y);
+            SDL_Rect front_entity_rect = { rectangle_screen_x, rectangle_screen_y, front_texture_data->bounds_rectangle.w, front_texture_data->bounds_rectangle.h };
+            SDL_Rect overlap = rectangleIntersect(front_entity_rect, back_entity_rect);
+            if (overlap.w <= 0 || overlap.h <= 0) continue;
+            if (!target_pushed)
             {
-                screen_grid[x + y * screen_grid_width] |= index_bitflag;
+                pushRenderTarget(renderer, back_texture_data->temporary_frame_buffer);
+                target_pushed = 1;
             }
+            SDL_RenderCopy(renderer, front_texture_data->temporary_frame_buffer,
+                &(SDL_Rect) { overlap.x - front_entity_rect.x, overlap.y - front_entity_rect.y, overlap.w, overlap.h },
+                &(SDL_Rect) { overlap.x - back_entity_rect.x, overlap.y - back_entity_rect.y, overlap.w, overlap.h });
+        }
+        if (target_pushed)
+        {
+            popRenderTarget(renderer);
+            back_texture_data->buffer_stamped = 1;
         }
     }
 }
 
+// The entities' frame buffers have to be drawn again after the renderer loses its targets
+void invalidateEntityFrameBuffers()
+{
+    for (size_t i = 0; i < entity_texture_data_count; i++) entityTextureData(i)->buffer_valid = 0;
+}
+
 // TODO remove the window_rect argument
 void drawLevel(SDL_Renderer *main_renderer, Level current_level, SDL_Texture *game_window_texture, int camera_position_x, int camera_position_y)
 {
+    TRACE_BEGIN(drawLevel);
+    TRACE_BEGIN(drawLevelSetup);
     // Find the game window's bounds
     SDL_Rect window_rect;
     {
@@ -128,13 +255,28 @@ void drawLevel(SDL_Renderer *main_renderer, Level current_level, SDL_Texture *ga
         window_rect = (SDL_Rect) { 0, 0, window_width, window_height };
     }
 
+    // last frame's scratch goes, the render target stack is always empty between frames
+    assert(render_target_top == 0);
+    frameArenaReset(&draw_level_arena);
+    top_entities = NULL;
+    top_entity_capacity = 0;
+    render_target_stack = NULL;
+    render_target_capacity = 0;
+
+    draw_level_timings = (DrawLevelTimings) { 0 };
+    uint64_t phase_start = SDL_GetPerformanceCounter();
     SDL_SetRenderDrawColor(main_renderer, 128, 180, 255, 0);
-    // Reset all of the sprite's frame_buffers
-    for (int i = 0; i < entity_texture_data_count; i++)
+    // Reset the sprite's frame_buffers that have changed since they were last drawn
+    for (size_t i = 0; i < entity_texture_data_count; i++)
     {
-        pushRenderTarget(main_renderer, entity_texture_data[i].temporary_frame_buffer);
+        TextureData *texture_data = entityTextureData(i);
+        if (texture_data->buffer_valid && !texture_data->buffer_stamped && texture_data->buffer_frame == texture_data->amimation_frame) continue;
+        texture_data->buffer_frame = texture_data->amimation_frame;
+        texture_data->buffer_valid = 1;
+        texture_data->buffer_stamped = 0;
+        pushRenderTarget(main_renderer, texture_data->temporary_frame_buffer);
         SDL_RenderClear(main_renderer);
-        SDL_RenderCopy(main_renderer, entity_texture_data[i].amimation_frame, NULL, NULL);
+        SDL_RenderCopy(main_renderer, texture_data->amimation_frame, NULL, NULL);
         popRenderTarget(main_renderer);
     }
 
@@ -151,111 +293,165 @@ void drawLevel(SDL_Renderer *main_renderer, Level current_level, SDL_Texture *ga
 
     SDL_Rect source_rectangle = { 0, 0, texture_width, texture_height };
 
+    // The tile pass below only visits the cells the solid bits say aren't air, so they have to be
+    // filled in for everything it can reach: x between the left and right edges, z no further back
+    // than the bottom left corner, and no further forward than the top layer lets it get
+    int z_min = a_min - (current_level.size.y - 1) - (camera_world_bottom_right.x - 1);
+    Vector3 visible_min = { camera_world_top_left.x, 0, z_min };
+    Vector3 visible_max = { camera_world_bottom_right.x - 1, current_level.size.y - 1, camera_world_bottom_left.z - 1 };
+    prepareLevelSolidity(&current_level, visible_min, visible_max);
+
+    // which entities go in which cells and in what order is all worked out up front,
+    // then the entity pass takes the cells of each layer in turn
+    buildEntityDrawOrder(&entity_draw_order, &entity_store, visible_min, visible_max);
+    // The tile pass has nothing to cover until the first entity is drawn, so its lists only start at that
+    // layer. They're built while the terrain is drawn.
+    int tiles_a_start = entity_draw_order.cell_count ? max(a_min, componentSum(drawOrderKeyCell(entity_draw_order.cell_keys[0]))) : a_max + 1;
+    if (!draw_list_builder.workers) createDrawListBuilder(&draw_list_builder, 0);
+    startDrawListBuild(&draw_list_builder, &current_level, camera_position_x, camera_position_y, tiles_a_start, a_max,
+        camera_world_top_left.x, camera_world_bottom_right.x, camera_world_bottom_left.z);
+
     // *** Drawing Code ***
     // It is critical that everything is drawn in the correct order.
     // We are drawing in "q-bert layers", where the components of the
     // coordinates each tile in each layer add up to 'a'. 
     // They remind me of the background in q-bert, hence the name.
+    // The terrain goes down first, in one piece from the terrain cache, so the tile pass
+    // only has to draw the tiles that are in front of an entity again
     pushRenderTarget(main_renderer, game_window_texture);
     SDL_RenderClear(main_renderer);
+    uint64_t phase_end = SDL_GetPerformanceCounter();
+    draw_level_timings.setup = phase_end - phase_start;
+    phase_start = phase_end;
+    TRACE_END(drawLevelSetup);
+    TRACE_BEGIN(drawTerrain);
+    drawTerrain(&terrain_cache, main_renderer, &current_level, visible_min, visible_max,
+        camera_position_x, camera_position_y, window_rect.w, window_rect.h);
+    phase_end = SDL_GetPerformanceCounter();
+    draw_level_timings.terrain = phase_end - phase_start;
+    phase_start = phase_end;
+    TRACE_END(drawTerrain);
+    TRACE_BEGIN(drawListWait);
+    finishDrawListBuild(&draw_list_builder);
+    phase_end = SDL_GetPerformanceCounter();
+    draw_level_timings.draw_list_wait = phase_end - phase_start;
+    phase_start = phase_end;
+    TRACE_END(drawListWait);
+    // the entity and tile passes take turns every layer, draw_level_timings has them apart
+    TRACE_BEGIN(drawLevelLayers);
+    resizeScreenGrid(&screen_grid, window_rect.w, window_rect.h);
+    clearScreenGrid(&screen_grid);
+    if (!stamped_pairs.capacity) makeFlatHashTable(&stamped_pairs, 64);
+    clearFlatHashTable(&stamped_pairs);
+    size_t next_cell = 0;
     for (int a = a_min; a <= a_max; a++)
     {
-        int top_entities_index = 0;
+        size_t top_entities_index = 0;
         int b_max = min(a, current_level.size.y - 1);
-        for (int b = 0; b <= b_max; b++)
+        uint64_t layer_end = (uint64_t)(a + 1) << (2 * DRAW_ORDER_CELL_BITS);
+        while (next_cell < entity_draw_order.cell_count && entity_draw_order.cell_keys[next_cell] < layer_end)
         {
+            // the entities in a cell are all next to each other, in the order they get drawn in
+            size_t cell_start = next_cell;
+            uint64_t cell_key = entity_draw_order.cell_keys[cell_start];
+            while (next_cell < entity_draw_order.cell_count && entity_draw_order.cell_keys[next_cell] == cell_key) next_cell++;
+            EntityHandle *cell_entities = &entity_draw_order.cell_entities[cell_start];
+            size_t return_count = next_cell - cell_start;
+
+            Vector3 world = drawOrderKeyCell(cell_key);
+            int b = world.y, c = world.x;
             int c_max = min(a - b, camera_world_bottom_right.x - 1);
-            for (int c = -min(-camera_world_top_left.x, -(a - camera_world_bottom_left.z - b + 1)); c <= c_max; c++)
-            {
-                Vector3 world = { c, b, a - b - c };
-                char current_tile = getTileAtUnsafe(world, &current_level);
-                int cell_has_entity = current_tile & CELL_HAS_ENTITY_FLAG;
-                if (cell_has_entity)
+            int c_min = -min(-camera_world_top_left.x, -(a - camera_world_bottom_left.z - b + 1));
+            // cells from layers before a_min, or off the sides of the screen
+            if (componentSum(world) != a || b > b_max || c < c_min || c > c_max) continue;
+            int screen_x, screen_y;
+            worldToScreen(world, camera_position_x, camera_position_y, &screen_x, &screen_y);
+            SDL_Rect clipping_rect = { screen_x, screen_y, texture_width, texture_height };
+            
+            for (size_t i = 0; i < return_count; i++)
+            {   
+                EntityHandle cell_entity = cell_entities[i];
+                uint32_t cell_index = entityIndex(&entity_store, cell_entity);
+                // Some entities need to be drawn on top of tiles, so we will save them for later
+                if (entity_store.draw_on_top[cell_index])
                 {
-                    uint64_t key = hashVector3(world);
-                    int screen_x, screen_y;
-                    worldToScreen(world, camera_position_x, camera_position_y, &screen_x, &screen_y);
-                    SDL_Rect clipping_rect = { screen_x, screen_y, texture_width, texture_height };
-                    size_t return_count = findAllInTable(&entity_by_location, key, entity_search_results, MAX_ENTITIES_PER_CELL);
-                    // If multiple entities are in the same cell, we want it to make sense to the eye
-                    // So we sort first by the entities' layer value, then if that is the same, by the
-                    // sum of their entity space x y and z components
-                    if (return_count > 1) { qsort(entity_search_results, return_count, sizeof(Entity *), entityLayerCompare); }
-                    
-                    for (size_t i = 0; i < return_count; i++)
-                    {   
-                        Entity *cell_entity = entity_search_results[i];
-                        // Some entities need to be drawn on top of tiles, so we will save them for later
-                        if (cell_entity->draw_on_top && top_entities_index < TOP_ENTITIES_PER_LAYER)
-                        {
-                            top_entity_array[top_entities_index] = cell_entity;
-                            top_clipping_rectangle_array[top_entities_index++] = clipping_rect;
-                        }
-                        else if (cell_entity->draw) cell_entity->draw(cell_entity, main_renderer, camera_position_x, camera_position_y, clipping_rect);
-                        // To prevent weirdness with other that are behind cell_entity and halfway occupying a cell that gets drawn after,
-                        // we just stamp cell_entity's frame to the entities that are behind it but sharing this cell
-                        for (int j = i - 1; j >= 0; j--)
-                        {
-                            int rectangle_screen_x, rectangle_screen_y;
-                            entityToScreen(cell_entity->position, camera_position_x, camera_position_y, &rectangle_screen_x, &rectangle_screen_y);
-                            SDL_Rect cell_entity_rect = { rectangle_screen_x, rectangle_screen_y, cell_entity->texture_data->bounds_rectangle.w, cell_entity->texture_data->bounds_rectangle.h };
-                            entityToScreen(entity_search_results[j]->position, camera_position_x, camera_position_y, &rectangle_screen_x, &rectangle_screen_y);
-                            SDL_Rect other_entity_rect = { rectangle_screen_x, rectangle_screen_y, entity_search_results[j]->texture_data->bounds_rectangle.w, entity_search_results[j]->texture_data->bounds_rectangle.h };
-                            pushRenderTarget(main_renderer, entity_search_results[j]->texture_data->temporary_frame_buffer);
-                            SDL_Rect overlap = rectangleIntersect(cell_entity_rect, other_entity_rect);
-                            SDL_RenderCopy(main_renderer, cell_entity->texture_data->temporary_frame_buffer, 
-                                &(SDL_Rect) { overlap.x - cell_entity_rect.x, overlap.y - cell_entity_rect.y, overlap.w, overlap.h },
-                                &(SDL_Rect) { overlap.x - other_entity_rect.x, overlap.y - other_entity_rect.y, overlap.w, overlap.h }); 
-                            popRenderTarget(main_renderer);
-                        }
+                    if (top_entities_index == top_entity_capacity)
+                    {
+                        size_t capacity = top_entity_capacity ? 2 * top_entity_capacity : 64;
+                        top_entities = frameArenaGrow(&draw_level_arena, top_entities,
+                            top_entity_capacity * sizeof(TopEntity), capacity * sizeof(TopEntity));
+                        top_entity_capacity = capacity;
                     }
+                    top_entities[top_entities_index++] = (TopEntity) { cell_entity, clipping_rect };
                 }
+                else if (entity_store.draw[cell_index]) entity_store.draw[cell_index](&entity_store, cell_entity, main_renderer, camera_position_x, camera_position_y, clipping_rect);
             }
+            stampCellEntities(main_renderer, cell_entities, return_count, camera_position_x, camera_position_y);
         }
         
-        for (int b = 0; b <= b_max; b++)
+        phase_end = SDL_GetPerformanceCounter();
+        draw_level_timings.entity_pass += phase_end - phase_start;
+        phase_start = phase_end;
+
+        // until an entity has been drawn there is nothing for the tiles to cover
+        if (a >= tiles_a_start && screen_grid.entry_count)
         {
-            int c_max = min(a - b, camera_world_bottom_right.x - 1);
-            for (int c = -min(-camera_world_top_left.x, -(a - camera_world_bottom_left.z - b + 1)); c <= c_max; c++)
+            size_t tile_count;
+            DrawListTile *tiles = drawListLayerTiles(&draw_list_builder, a, &tile_count);
+            for (size_t i = 0; i < tile_count; i++)
             {
-                Vector3 world = { c, b, a - b - c };
-                char current_tile = getTileAtUnsafe(world, &current_level);
-                int screen_x, screen_y;
-                worldToScreen(world, camera_position_x, camera_position_y, &screen_x, &screen_y);
-                current_tile &= (char)~CELL_HAS_ENTITY_FLAG;
-                if (current_tile && tile_textures[current_tile])
-                {
-                    // calculate the position at which to draw it
-                    SDL_Rect destination_rectangle = { screen_x, screen_y, source_rectangle.w, source_rectangle.h};
-                    SDL_RenderCopy(main_renderer, tile_textures[current_tile], NULL, &destination_rectangle);
-                    destination_rectangle.y += TILE_HALF_DEPTH_PX;
-                    destination_rectangle.h -= TILE_HALF_DEPTH_PX;
-                    doOverlapTesting(destination_rectangle);
-                }
+                // calculate the position at which to draw it
+                SDL_Rect destination_rectangle = { tiles[i].screen_x, tiles[i].screen_y, source_rectangle.w, source_rectangle.h};
+                redrawTileOverEntities(tiles[i].tile, destination_rectangle);
+                destination_rectangle.y += TILE_HALF_DEPTH_PX;
+                destination_rectangle.h -= TILE_HALF_DEPTH_PX;
+#ifdef DRAW_LEVEL_OVERLAP_TIMING
+                uint64_t overlap_start = SDL_GetPerformanceCounter();
+                doOverlapTesting(destination_rectangle);
+                draw_level_timings.overlap_testing += SDL_GetPerformanceCounter() - overlap_start;
+#else
+                doOverlapTesting(destination_rectangle);
+#endif
             }
         }
+        // the whole layer's tiles go out in one call
+        flushTileBatch(&tile_batch, main_renderer);
+        phase_end = SDL_GetPerformanceCounter();
+        draw_level_timings.tile_pass += phase_end - phase_start;
+        phase_start = phase_end;
         // loop through and draw the entities that are meant to be drawn last on this q-bert layer
-        for (int i = 0; i < top_entities_index; i++)
+        for (size_t i = 0; i < top_entities_index; i++)
         {
-            if (top_entity_array[i]->draw) 
+            uint32_t top_index = entityIndex(&entity_store, top_entities[i].entity);
+            if (entity_store.draw[top_index]) 
             {
-                top_entity_array[i]->draw(top_entity_array[i], main_renderer, 
-                    camera_position_x, camera_position_y, top_clipping_rectangle_array[i]);
+                entity_store.draw[top_index](&entity_store, top_entities[i].entity, main_renderer, 
+                    camera_position_x, camera_position_y, top_entities[i].clipping_rectangle);
             }
         }
+        phase_end = SDL_GetPerformanceCounter();
+        draw_level_timings.entity_pass += phase_end - phase_start;
+        phase_start = phase_end;
     }
+    TRACE_END(drawLevelLayers);
 
-    for (int i = 0; i < entity_texture_data_count; i++)
+    TRACE_BEGIN(drawLevelMasks);
+    for (size_t i = 0; i < entity_texture_data_count; i++)
     {
-        if (entity_texture_data[i].animation_frame_mask)
+        TextureData *texture_data = entityTextureData(i);
+        if (texture_data->animation_frame_mask)
         {
-            SDL_Rect union_rect = entity_texture_data[i].union_rectangle;
+            SDL_Rect union_rect = texture_data->union_rectangle;
             // Set the cover shadow's alpha based on how much its corresponding entity is covered up
-            SDL_SetTextureAlphaMod(entity_texture_data[i].animation_frame_mask, min(194 * (float)(union_rect.w * union_rect.h) / (float)(entity_texture_data[i].bounds_rectangle.w * entity_texture_data[i].bounds_rectangle.h), 64));
-            SDL_RenderCopy(main_renderer, entity_texture_data[i].animation_frame_mask, NULL, &entity_texture_data[i].bounds_rectangle);
-            SDL_SetTextureAlphaMod(entity_texture_data[i].animation_frame_mask, SDL_ALPHA_OPAQUE);
+            SDL_SetTextureAlphaMod(texture_data->animation_frame_mask, min(194 * (float)(union_rect.w * union_rect.h) / (float)(texture_data->bounds_rectangle.w * texture_data->bounds_rectangle.h), 64));
+            SDL_Rect *mask_rect = texture_data->animation_frame_mask_rect.w ? &texture_data->animation_frame_mask_rect : NULL;
+            SDL_RenderCopy(main_renderer, texture_data->animation_frame_mask, mask_rect, &texture_data->bounds_rectangle);
+            SDL_SetTextureAlphaMod(texture_data->animation_frame_mask, SDL_ALPHA_OPAQUE);
         }
     }
 
     popRenderTarget(main_renderer);
+    draw_level_timings.mask_compositing = SDL_GetPerformanceCounter() - phase_start;
+    TRACE_END(drawLevelMasks);
+    TRACE_END(drawLevel);
 }
\ No newline at end of file
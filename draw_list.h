@@ -0,0 +1,223 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "vector.h"
+#include "level.h"
+#include "entity.h"
+#include "math_utils.h"
+#include "textures_generated.h"
+#include "trace.h"
+
+// Working out which tiles drawLevel's tile pass has to look at doesn't need the renderer, or anything
+// the entity pass does, so it's done up front on a pool of threads while the main thread draws the terrain.
+// Each layer gets a list of the solid cells on screen, in the order the tile pass goes through them,
+// with their tile and where they are on the screen. The threads take DRAW_LIST_LAYERS_PER_JOB layers
+// at a time and write them into lists of their own, and the main thread joins in once it's done with
+// the terrain. Then the tile pass just replays the lists in order.
+// The level mustn't be edited while a build is going, which can't happen since it is all inside drawLevel.
+
+#define DRAW_LIST_LAYERS_PER_JOB 8
+
+typedef struct DrawListTile
+{
+    int screen_x, screen_y;
+    uint8_t tile;
+} DrawListTile;
+
+// where a layer's tiles are, the worker that built it and the range of its tiles
+typedef struct DrawListLayer
+{
+    int worker;
+    size_t start, count;
+} DrawListLayer;
+
+typedef struct DrawListWorker
+{
+    struct DrawListBuilder *builder;
+    SDL_Thread *thread;
+    DrawListTile *tiles;
+    size_t tile_count, tile_capacity;
+} DrawListWorker;
+
+typedef struct DrawListBuilder
+{
+    SDL_mutex *lock;
+    SDL_cond *work_available;
+    SDL_cond *work_done;
+    // bumped for every build, so the threads can tell a new one from the one they just did
+    uint32_t generation;
+    int running;
+    // threads that haven't finished with the current build
+    int busy_threads;
+    SDL_atomic_t next_job;
+
+    // what the current build is of, the screen's edges are the same ones drawLevel works out
+    Level *level;
+    int camera_x, camera_y;
+    int a_start, a_end;
+    int left_x, right_x, front_z;
+    DrawListLayer *layers;
+    size_t layer_capacity;
+
+    // the main thread is worker 0, the rest have threads of their own
+    DrawListWorker *workers;
+    int worker_count;
+} DrawListBuilder;
+
+DrawListBuilder draw_list_builder = { 0 };
+
+void buildDrawListLayer(DrawListBuilder *builder, DrawListWorker *worker, int a)
+{
+    Level *level = builder->level;
+    DrawListLayer *layer = &builder->layers[a - builder->a_start];
+    layer->worker = worker - builder->workers;
+    layer->start = worker->tile_count;
+    LevelTileReader reader = makeLevelTileReader(level);
+    int b_max = min(a, level->size.y - 1);
+    for (int b = 0; b <= b_max; b++)
+    {
+        int c_max = min(a - b, builder->right_x - 1);
+        int c_min = max(builder->left_x, a - builder->front_z - b + 1);
+        for (int c = nextSolidCell(level, b, a - b, c_min, c_max); c <= c_max; c = nextSolidCell(level, b, a - b, c + 1, c_max))
+        {
+            Vector3 world = { c, b, a - b - c };
+            uint8_t tile = readTile(&reader, world.x, world.y, world.z);
+            if (!tile_atlas_rects[tile].w) continue;
+            if (worker->tile_count == worker->tile_capacity)
+            {
+                worker->tile_capacity = worker->tile_capacity ? 2 * worker->tile_capacity : 1024;
+                worker->tiles = realloc(worker->tiles, worker->tile_capacity * sizeof(DrawListTile));
+            }
+            DrawListTile *draw_tile = &worker->tiles[worker->tile_count++];
+            worldToScreen(world, builder->camera_x, builder->camera_y, &draw_tile->screen_x, &draw_tile->screen_y);
+            draw_tile->tile = tile;
+        }
+    }
+    layer->count = worker->tile_count - layer->start;
+}
+
+// takes jobs until there are none left
+void runDrawListJobs(DrawListBuilder *builder, DrawListWorker *worker)
+{
+    for (;;)
+    {
+        int first = builder->a_start + SDL_AtomicAdd(&builder->next_job, 1) * DRAW_LIST_LAYERS_PER_JOB;
+        if (first > builder->a_end) return;
+        int last = min(first + DRAW_LIST_LAYERS_PER_JOB - 1, builder->a_end);
+        for (int a = first; a <= last; a++) buildDrawListLayer(builder, worker, a);
+    }
+}
+
+int drawListWorkerThread(void *data)
+{
+    DrawListWorker *worker = data;
+    DrawListBuilder *builder = worker->builder;
+    uint32_t generation = 0;
+    SDL_LockMutex(builder->lock);
+    for (;;)
+    {
+        while (builder->running && builder->generation == generation) SDL_CondWait(builder->work_available, builder->lock);
+        if (!builder->running) break;
+        generation = builder->generation;
+        SDL_UnlockMutex(builder->lock);
+
+        TRACE_BEGIN(buildDrawList);
+        runDrawListJobs(builder, worker);
+        TRACE_END(buildDrawList);
+
+        SDL_LockMutex(builder->lock);
+        if (!--builder->busy_threads) SDL_CondSignal(builder->work_done);
+    }
+    SDL_UnlockMutex(builder->lock);
+    return 0;
+}
+
+// thread_count of less than 0 means one thread per core, leaving one for the main thread.
+// Returns 0 if not all of the threads could be started, the builder still works with the ones that did.
+int createDrawListBuilder(DrawListBuilder *builder, int thread_count)
+{
+    if (thread_count < 0) thread_count = SDL_GetCPUCount() - 1;
+    if (thread_count < 0) thread_count = 0;
+    *builder = (DrawListBuilder) { 0 };
+    builder->lock = SDL_CreateMutex();
+    builder->work_available = SDL_CreateCond();
+    builder->work_done = SDL_CreateCond();
+    builder->running = 1;
+    builder->worker_count = thread_count + 1;
+    builder->workers = calloc(builder->worker_count, sizeof(DrawListWorker));
+    for (int i = 0; i < builder->worker_count; i++) builder->workers[i].builder = builder;
+    for (int i = 1; i < builder->worker_count; i++)
+    {
+        builder->workers[i].thread = SDL_CreateThread(drawListWorkerThread, "draw list worker", &builder->workers[i]);
+        if (!builder->workers[i].thread)
+        {
+            // builds only wait for the threads that are running
+            builder->worker_count = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void destroyDrawListBuilder(DrawListBuilder *builder)
+{
+    SDL_LockMutex(builder->lock);
+    builder->running = 0;
+    SDL_CondBroadcast(builder->work_available);
+    SDL_UnlockMutex(builder->lock);
+    for (int i = 0; i < builder->worker_count; i++)
+    {
+        if (builder->workers[i].thread) SDL_WaitThread(builder->workers[i].thread, NULL);
+        free(builder->workers[i].tiles);
+    }
+    SDL_DestroyCond(builder->work_available);
+    SDL_DestroyCond(builder->work_done);
+    SDL_DestroyMutex(builder->lock);
+    free(builder->workers);
+    free(builder->layers);
+    *builder = (DrawListBuilder) { 0 };
+}
+
+// Sets the threads going on layers a_start to a_end, which finishDrawListBuild waits for
+void startDrawListBuild(DrawListBuilder *builder, Level *level, int camera_x, int camera_y, int a_start, int a_end,
+    int left_x, int right_x, int front_z)
+{
+    size_t layer_count = (a_end >= a_start) ? a_end - a_start + 1 : 0;
+    if (layer_count > builder->layer_capacity)
+    {
+        builder->layer_capacity = layer_count;
+        builder->layers = realloc(builder->layers, layer_count * sizeof(DrawListLayer));
+    }
+    for (int i = 0; i < builder->worker_count; i++) builder->workers[i].tile_count = 0;
+    builder->level = level;
+    builder->camera_x = camera_x;
+    builder->camera_y = camera_y;
+    builder->a_start = a_start;
+    builder->a_end = a_end;
+    builder->left_x = left_x;
+    builder->right_x = right_x;
+    builder->front_z = front_z;
+    SDL_AtomicSet(&builder->next_job, 0);
+    SDL_LockMutex(builder->lock);
+    builder->generation++;
+    builder->busy_threads = builder->worker_count - 1;
+    SDL_CondBroadcast(builder->work_available);
+    SDL_UnlockMutex(builder->lock);
+}
+
+// Helps with whatever is left of the build, then waits for the threads to finish theirs
+void finishDrawListBuild(DrawListBuilder *builder)
+{
+    runDrawListJobs(builder, &builder->workers[0]);
+    SDL_LockMutex(builder->lock);
+    while (builder->busy_threads) SDL_CondWait(builder->work_done, builder->lock);
+    SDL_UnlockMutex(builder->lock);
+}
+
+DrawListTile *drawListLayerTiles(DrawListBuilder *builder, int a, size_t *count)
+{
+    DrawListLayer *layer = &builder->layers[a - builder->a_start];
+    *count = layer->count;
+    return builder->workers[layer->worker].tiles + layer->start;
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "vector.h"
+#include "math_utils.h"
+#include "entity.h"
+#include "entity_store.h"
+
+// The order entities get drawn in, worked out once at the start of a frame.
+// Every entity on screen gets a key out of its layer and depth, the same things cells used to
+// sort their entities by, and they're radix sorted by it. Then each of them adds a (cell, entity)
+// pair for every cell it covers, in that order, and the pairs are radix sorted by cell. Radix sorts
+// keep ties in order, so the pairs for each cell end up together and in draw order, and the cells
+// end up in the order drawLevel visits them in: q-bert layer, then y, then x.
+// So drawLevel just walks through the pairs as it goes, and never sorts or looks anything up.
+
+// cells are packed into keys with this many bits for each of the layer, y and x
+#define DRAW_ORDER_CELL_BITS 21
+
+typedef struct EntityDrawOrder
+{
+    // the cells' keys, and the entity for each, grouped by cell
+    uint64_t *cell_keys;
+    EntityHandle *cell_entities;
+    size_t cell_count, cell_capacity;
+
+    // the entities' keys and indices while they are being sorted
+    uint64_t *entity_keys;
+    uint32_t *entity_indices;
+    size_t entity_count, entity_capacity;
+
+    // room for the radix sort to work in, as big as the larger of the two
+    uint64_t *scratch_keys;
+    uint32_t *scratch_values;
+    size_t scratch_capacity;
+} EntityDrawOrder;
+
+EntityDrawOrder entity_draw_order = { 0 };
+
+uint64_t drawOrderCellKey(Vector3 cell)
+{
+    uint64_t layer = cell.x + cell.y + cell.z;
+    return (layer << (2 * DRAW_ORDER_CELL_BITS)) | ((uint64_t)cell.y << DRAW_ORDER_CELL_BITS) | (uint64_t)cell.x;
+}
+
+Vector3 drawOrderKeyCell(uint64_t key)
+{
+    uint64_t mask = (1ull << DRAW_ORDER_CELL_BITS) - 1;
+    int layer = key >> (2 * DRAW_ORDER_CELL_BITS);
+    int y = (key >> DRAW_ORDER_CELL_BITS) & mask;
+    int x = key & mask;
+    return (Vector3) { x, y, layer - x - y };
+}
+
+// layer first, then depth, both flipped into unsigned order
+uint64_t entityDrawKey(EntityStore *store, uint32_t index)
+{
+    uint32_t layer = (uint32_t)store->layers[index] ^ 0x80000000u;
+    uint32_t depth = (uint32_t)componentSum(addVector3(store->positions[index], store->sizes[index])) ^ 0x80000000u;
+    return ((uint64_t)layer << 32) | depth;
+}
+
+// Sorts keys, and values along with them, a byte at a time from the bottom, keeping ties in order.
+// Bytes that are the same in every key are skipped, which most of them usually are.
+// scratch_keys and scratch_values need to be as long as keys.
+void radixSortKeys(uint64_t *keys, uint32_t *values, uint64_t *scratch_keys, uint32_t *scratch_values, size_t count)
+{
+    uint64_t *from_keys = keys, *to_keys = scratch_keys;
+    uint32_t *from_values = values, *to_values = scratch_values;
+    for (int shift = 0; shift < 64 && count > 1; shift += 8)
+    {
+        size_t offsets[256] = { 0 };
+        for (size_t i = 0; i < count; i++) offsets[(from_keys[i] >> shift) & 255]++;
+        if (offsets[(from_keys[0] >> shift) & 255] == count) continue;
+        size_t total = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            size_t digit_count = offsets[digit];
+            offsets[digit] = total;
+            total += digit_count;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t destination = offsets[(from_keys[i] >> shift) & 255]++;
+            to_keys[destination] = from_keys[i];
+            to_values[destination] = from_values[i];
+        }
+        uint64_t *swap_keys = from_keys;
+        from_keys = to_keys;
+        to_keys = swap_keys;
+        uint32_t *swap_values = from_values;
+        from_values = to_values;
+        to_values = swap_values;
+    }
+    if (from_keys != keys)
+    {
+        memcpy(keys, from_keys, count * sizeof(uint64_t));
+        memcpy(values, from_values, count * sizeof(uint32_t));
+    }
+}
+
+void growDrawOrderScratch(EntityDrawOrder *order, size_t count)
+{
+    if (count <= order->scratch_capacity) return;
+    order->scratch_capacity = (count > 2 * order->scratch_capacity) ? count : 2 * order->scratch_capacity;
+    order->scratch_keys = realloc(order->scratch_keys, order->scratch_capacity * sizeof(uint64_t));
+    order->scratch_values = realloc(order->scratch_values, order->scratch_capacity * sizeof(uint32_t));
+}
+
+void addDrawOrderCell(EntityDrawOrder *order, Vector3 cell, EntityHandle entity)
+{
+    if (order->cell_count == order->cell_capacity)
+    {
+        order->cell_capacity = order->cell_capacity ? 2 * order->cell_capacity : 256;
+        order->cell_keys = realloc(order->cell_keys, order->cell_capacity * sizeof(uint64_t));
+        order->cell_entities = realloc(order->cell_entities, order->cell_capacity * sizeof(EntityHandle));
+    }
+    order->cell_keys[order->cell_count] = drawOrderCellKey(cell);
+    order->cell_entities[order->cell_count++] = entity;
+}
+
+// Works out the draw order of every entity with a cell from visible_min to visible_max, for the positions the store has now.
+// The cells each entity covers are worked out the same way addEntity does it.
+void buildEntityDrawOrder(EntityDrawOrder *order, EntityStore *store, Vector3 visible_min, Vector3 visible_max)
+{
+    order->entity_count = 0;
+    order->cell_count = 0;
+    if (order->entity_capacity < store->count)
+    {
+        order->entity_capacity = store->capacity;
+        order->entity_keys = realloc(order->entity_keys, order->entity_capacity * sizeof(uint64_t));
+        order->entity_indices = realloc(order->entity_indices, order->entity_capacity * sizeof(uint32_t));
+    }
+    for (uint32_t i = 0; i < store->count; i++)
+    {
+        Vector3 floor = entityToWorldPosition(store->positions[i]);
+        Vector3 ceil = entityToWorldPosition(addVector3(store->positions[i], store->sizes[i]));
+        if (ceil.x < visible_min.x || ceil.y < visible_min.y || ceil.z < visible_min.z
+            || floor.x > visible_max.x || floor.y > visible_max.y || floor.z > visible_max.z) continue;
+        order->entity_keys[order->entity_count] = entityDrawKey(store, i);
+        order->entity_indices[order->entity_count++] = i;
+    }
+    growDrawOrderScratch(order, order->entity_count);
+    radixSortKeys(order->entity_keys, order->entity_indices, order->scratch_keys, order->scratch_values, order->entity_count);
+
+    // clampVector3's ceiling is one past the end
+    Vector3 visible_end = addVector3(visible_max, (Vector3) { 1, 1, 1 });
+    for (size_t i = 0; i < order->entity_count; i++)
+    {
+        uint32_t index = order->entity_indices[i];
+        Vector3 floor = clampVector3(entityToWorldPosition(store->positions[index]), visible_min, visible_end);
+        Vector3 ceil = clampVector3(entityToWorldPosition(addVector3(store->positions[index], store->sizes[index])), visible_min, visible_end);
+        for (int z = floor.z; z <= ceil.z; z++)
+        {
+            for (int x = floor.x; x <= ceil.x; x++)
+            {
+                for (int y = floor.y; y <= ceil.y; y++) addDrawOrderCell(order, (Vector3) { x, y, z }, store->handles[index]);
+            }
+        }
+    }
+    growDrawOrderScratch(order, order->cell_count);
+    radixSortKeys(order->cell_keys, order->cell_entities, order->scratch_keys, order->scratch_values, order->cell_count);
+}
+
+void freeEntityDrawOrder(EntityDrawOrder *order)
+{
+    free(order->cell_keys);
+    free(order->cell_entities);
+    free(order->entity_keys);
+    free(order->entity_indices);
+    free(order->scratch_keys);
+    free(order->scratch_values);
+    *order = (EntityDrawOrder) { 0 };
+}
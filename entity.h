@@ -3,8 +3,10 @@
 #include <string.h>
 #include <stdint.h>
 #include "vector.h"
-#include "HashTable.h"
+#include "spatial_grid.h"
+#include "entity_store.h"
 #include "level.h"
+#include "trace.h"
 
 // This determines the size of the fractional part of the entity position
 #define ENTITY_POSITION_MULTIPLIER 16
@@ -69,47 +71,6 @@ enum
     ENTITY_EDITOR_CURSOR
 };
 
-typedef struct TextureData
-{
-    SDL_Texture *amimation_frame;
-    SDL_Texture *temporary_frame_buffer;
-    SDL_Texture *animation_frame_mask;
-    SDL_Rect bounds_rectangle;
-    SDL_Rect union_rectangle;
-} TextureData;
-
-typedef struct Entity
-{
-    // entity positions have sub-pixel-level precision
-    // to convert to block coordinates, divide x and z by TILE_HALF_WIDTH_PX
-    // and divide y by TILE_HEIGHT_PX
-    Vector3 position;
-    Vector3 size;
-    //unsigned int entity_id;
-    int draw_on_top;
-    int layer;
-    int type;
-    void *specific_data;
-    TextureData *texture_data;
-    // interface function pointers
-    void (*free_callback)(struct Entity *);
-    void (*draw)(struct Entity *, SDL_Renderer *, int, int, SDL_Rect);
-} Entity;
-
-int entityLayerCompare(const void *a, const void *b)
-{
-    Entity *a_e = *(Entity **)a;
-    Entity *b_e = *(Entity **)b;
-    int a_layer = a_e->layer;
-    int b_layer = b_e->layer;
-    if (a_layer != b_layer) return a_layer - b_layer;
-    //if (a_e->position.y != b_e->position.y) return (a_e->position.y - b_e->position.y);
-    //puts("Here");
-    return componentSum(addVector3(a_e->position, a_e->size)) - componentSum(addVector3(b_e->position, b_e->size));
-
-    //return -componentSum(addVector3(((Entity *)a)->position, ((Entity *)a)->size)) + componentSum(addVector3(((Entity *)b)->position, ((Entity *)b)->size));
-}
-
 int pointIsInPrism(Vector3 prism_least_corner, Vector3 prism_most_corner, Vector3 point)
 {
     return (point.x >= prism_least_corner.x) && (point.x <= prism_most_corner.x)
@@ -117,14 +78,16 @@ int pointIsInPrism(Vector3 prism_least_corner, Vector3 prism_most_corner, Vector
         && (point.z >= prism_least_corner.z) && (point.z <= prism_most_corner.z);
 }
 
-// this does not allocate
-void addEntity(Entity *entity, Vector3 position, Vector3 size, HashTable *table, Level *level)
+// Places an entity that was made with createEntity into the world.
+// The spatial grid allocates room for the entity's cells as needed.
+void addEntity(EntityStore *store, EntityHandle entity, Vector3 position, Vector3 size, SpatialGrid *grid)
 {
-    entity->position = position;
+    uint32_t index = entityIndex(store, entity);
+    store->positions[index] = position;
     size.x *= ENTITY_POSITION_MULTIPLIER;
     size.y *= ENTITY_POSITION_MULTIPLIER;
     size.z *= ENTITY_POSITION_MULTIPLIER;
-    entity->size = size;
+    store->sizes[index] = size;
     Vector3 world_floor = entityToWorldPosition(position);
     Vector3 world_ceil = entityToWorldPosition(addVector3(position, size));
     for (int z = world_floor.z; z <= world_ceil.z; z++)
@@ -134,54 +97,194 @@ void addEntity(Entity *entity, Vector3 position, Vector3 size, HashTable *table,
             for (int y = world_floor.y; y <= world_ceil.y; y++)
             {
                 Vector3 world = { x, y, z };
-                setFlagAt(world, level);
-                insertToTable(table, hashVector3(world), entity);
+                spatialGridInsert(grid, world, entity);
             }
         }
     }
 }
 
-void moveEntity(Entity *entity, Vector3 new_position, HashTable *table, Level *level)
+// Takes an entity back out of the world, do this before destroying it
+void removeEntity(EntityStore *store, EntityHandle entity, SpatialGrid *grid)
+{
+    uint32_t index = entityIndex(store, entity);
+    Vector3 world_floor = entityToWorldPosition(store->positions[index]);
+    Vector3 world_ceil = entityToWorldPosition(addVector3(store->positions[index], store->sizes[index]));
+    for (int z = world_floor.z; z <= world_ceil.z; z++)
+    {
+        for (int x = world_floor.x; x <= world_ceil.x; x++)
+        {
+            for (int y = world_floor.y; y <= world_ceil.y; y++)
+            {
+                Vector3 world = { x, y, z };
+                spatialGridRemove(grid, world, entity);
+            }
+        }
+    }
+}
+
+// Splits the cells of box a that are not in box b into at most 6 disjoint boxes, written to
+// floors and ceils (both corners inclusive), and returns how many there are
+int boxDifference(Vector3 a_floor, Vector3 a_ceil, Vector3 b_floor, Vector3 b_ceil, Vector3 *floors, Vector3 *ceils)
+{
+    if (b_floor.x > a_ceil.x || b_ceil.x < a_floor.x
+    || b_floor.y > a_ceil.y || b_ceil.y < a_floor.y
+    || b_floor.z > a_ceil.z || b_ceil.z < a_floor.z)
+    {
+        floors[0] = a_floor;
+        ceils[0] = a_ceil;
+        return 1;
+    }
+    int count = 0;
+    // peel off the slabs of a sticking out past b along x, then z, then y,
+    // shrinking a to the overlap after each axis so the slabs don't overlap each other
+    if (a_floor.x < b_floor.x) { floors[count] = a_floor; ceils[count] = a_ceil; ceils[count++].x = b_floor.x - 1; a_floor.x = b_floor.x; }
+    if (a_ceil.x > b_ceil.x) { floors[count] = a_floor; ceils[count] = a_ceil; floors[count++].x = b_ceil.x + 1; a_ceil.x = b_ceil.x; }
+    if (a_floor.z < b_floor.z) { floors[count] = a_floor; ceils[count] = a_ceil; ceils[count++].z = b_floor.z - 1; a_floor.z = b_floor.z; }
+    if (a_ceil.z > b_ceil.z) { floors[count] = a_floor; ceils[count] = a_ceil; floors[count++].z = b_ceil.z + 1; a_ceil.z = b_ceil.z; }
+    if (a_floor.y < b_floor.y) { floors[count] = a_floor; ceils[count] = a_ceil; ceils[count++].y = b_floor.y - 1; a_floor.y = b_floor.y; }
+    if (a_ceil.y > b_ceil.y) { floors[count] = a_floor; ceils[count] = a_ceil; floors[count++].y = b_ceil.y + 1; a_ceil.y = b_ceil.y; }
+    return count;
+}
+
+int sameCellFootprint(Vector3 old_floor, Vector3 old_ceil, Vector3 new_floor, Vector3 new_ceil)
+{
+    return old_floor.x == new_floor.x && old_floor.y == new_floor.y && old_floor.z == new_floor.z
+        && old_ceil.x == new_ceil.x && old_ceil.y == new_ceil.y && old_ceil.z == new_ceil.z;
+}
+
+void moveEntity(EntityStore *store, EntityHandle entity, Vector3 new_position, SpatialGrid *grid)
 {
-    // loop through the old prism, find the points that are not in the new prism and remove them
-    // then loop through the new prism and find the points that are not in the old prism and add them
-    Vector3 old_position_world_floor = entityToWorldPosition(entity->position);
-    Vector3 old_position_world_ceil = entityToWorldPosition(addVector3(entity->position, entity->size));
+    TRACE_BEGIN(moveEntity);
+    uint32_t index = entityIndex(store, entity);
+    Vector3 old_position_world_floor = entityToWorldPosition(store->positions[index]);
+    Vector3 old_position_world_ceil = entityToWorldPosition(addVector3(store->positions[index], store->sizes[index]));
     Vector3 new_position_world_floor = entityToWorldPosition(new_position);
-    Vector3 new_position_world_ceil = entityToWorldPosition(addVector3(new_position, entity->size));
-    for (int z = old_position_world_floor.z; z <= old_position_world_ceil.z; z++)
+    Vector3 new_position_world_ceil = entityToWorldPosition(addVector3(new_position, store->sizes[index]));
+    store->positions[index] = new_position;
+    // most moves are less than a tile, so usually there is nothing else to do
+    if (sameCellFootprint(old_position_world_floor, old_position_world_ceil, new_position_world_floor, new_position_world_ceil))
     {
-        for (int x = old_position_world_floor.x; x <= old_position_world_ceil.x; x++)
+        TRACE_END(moveEntity);
+        return;
+    }
+
+    // remove the cells that are only in the old prism, then add the ones only in the new prism
+    Vector3 floors[6], ceils[6];
+    int box_count = boxDifference(old_position_world_floor, old_position_world_ceil, new_position_world_floor, new_position_world_ceil, floors, ceils);
+    for (int i = 0; i < box_count; i++)
+    {
+        for (int z = floors[i].z; z <= ceils[i].z; z++)
         {
-            for (int y = old_position_world_floor.y; y <= old_position_world_ceil.y; y++)
+            for (int x = floors[i].x; x <= ceils[i].x; x++)
             {
-                Vector3 old_point = { x, y, z };
-                if (!pointIsInPrism(new_position_world_floor, new_position_world_ceil, old_point))
+                for (int y = floors[i].y; y <= ceils[i].y; y++)
                 {
-                    uint64_t key = hashVector3(old_point);
-                    // check if we are the last entity in the cell
-                    if (removeFromTableByValue(table, key, entity) < 2) clearFlagAt(old_point, level);
+                    Vector3 old_point = { x, y, z };
+                    spatialGridRemove(grid, old_point, entity);
                 }
             }
         }
     }
-    for (int z = new_position_world_floor.z; z <= new_position_world_ceil.z; z++)
+    box_count = boxDifference(new_position_world_floor, new_position_world_ceil, old_position_world_floor, old_position_world_ceil, floors, ceils);
+    for (int i = 0; i < box_count; i++)
     {
-        for (int x = new_position_world_floor.x; x <= new_position_world_ceil.x; x++)
+        for (int z = floors[i].z; z <= ceils[i].z; z++)
         {
-            for (int y = new_position_world_floor.y; y <= new_position_world_ceil.y; y++)
+            for (int x = floors[i].x; x <= ceils[i].x; x++)
             {
-                Vector3 new_point = { x, y, z };
-                if (!pointIsInPrism(old_position_world_floor, old_position_world_ceil, new_point))
+                for (int y = floors[i].y; y <= ceils[i].y; y++)
                 {
-                    setFlagAt(new_point, level);
-                    uint64_t key = hashVector3(new_point);
-                    assert(insertToTable(table, key, entity));
+                    Vector3 new_point = { x, y, z };
+                    spatialGridInsert(grid, new_point, entity);
                 }
             }
         }
     }
-    entity->position = new_position;
+    TRACE_END(moveEntity);
+}
+
+// One spatial index change queued up by a batch of moves
+typedef struct CellUpdate
+{
+    // the cell's spatial grid key shifted up one, with the low bit set for insertions,
+    // so sorting puts every update to a cell together and removals first
+    uint64_t sort_key;
+    Vector3 cell;
+    EntityHandle entity;
+} CellUpdate;
+
+// Collects a tick's worth of moves so that they can be applied all at once.
+// Make it with { 0 }, it grows as needed and keeps its memory between ticks.
+typedef struct EntityMoveBatch
+{
+    CellUpdate *updates;
+    size_t update_count;
+    size_t update_capacity;
+} EntityMoveBatch;
+
+void freeEntityMoveBatch(EntityMoveBatch *batch)
+{
+    free(batch->updates);
+    *batch = (EntityMoveBatch) { 0 };
+}
+
+void queueCellUpdate(EntityMoveBatch *batch, SpatialGrid *grid, Vector3 cell, EntityHandle entity, int insertion)
+{
+    // cells outside the grid aren't stored anyway
+    if (!spatialGridContains(grid, cell)) return;
+    if (batch->update_count == batch->update_capacity)
+    {
+        batch->update_capacity = batch->update_capacity ? batch->update_capacity * 2 : 256;
+        batch->updates = realloc(batch->updates, batch->update_capacity * sizeof(CellUpdate));
+    }
+    batch->updates[batch->update_count++] = (CellUpdate) { spatialGridCellKey(grid, cell) << 1 | insertion, cell, entity };
+}
+
+// Moves the entity right away, but only queues up the changes to the spatial index,
+// which applyEntityMoves then makes in cell order.
+// The entity must not be moved again before the batch is applied.
+void queueEntityMove(EntityMoveBatch *batch, EntityStore *store, EntityHandle entity, Vector3 new_position, SpatialGrid *grid)
+{
+    uint32_t index = entityIndex(store, entity);
+    Vector3 old_floor = entityToWorldPosition(store->positions[index]);
+    Vector3 old_ceil = entityToWorldPosition(addVector3(store->positions[index], store->sizes[index]));
+    Vector3 new_floor = entityToWorldPosition(new_position);
+    Vector3 new_ceil = entityToWorldPosition(addVector3(new_position, store->sizes[index]));
+    store->positions[index] = new_position;
+    if (sameCellFootprint(old_floor, old_ceil, new_floor, new_ceil)) return;
+
+    Vector3 floors[6], ceils[6];
+    int box_count = boxDifference(old_floor, old_ceil, new_floor, new_ceil, floors, ceils);
+    for (int i = 0; i < box_count; i++)
+        for (int z = floors[i].z; z <= ceils[i].z; z++)
+            for (int x = floors[i].x; x <= ceils[i].x; x++)
+                for (int y = floors[i].y; y <= ceils[i].y; y++) queueCellUpdate(batch, grid, (Vector3) { x, y, z }, entity, 0);
+    box_count = boxDifference(new_floor, new_ceil, old_floor, old_ceil, floors, ceils);
+    for (int i = 0; i < box_count; i++)
+        for (int z = floors[i].z; z <= ceils[i].z; z++)
+            for (int x = floors[i].x; x <= ceils[i].x; x++)
+                for (int y = floors[i].y; y <= ceils[i].y; y++) queueCellUpdate(batch, grid, (Vector3) { x, y, z }, entity, 1);
+}
+
+int cellUpdateCompare(const void *a, const void *b)
+{
+    uint64_t a_key = ((CellUpdate *)a)->sort_key;
+    uint64_t b_key = ((CellUpdate *)b)->sort_key;
+    return (a_key > b_key) - (a_key < b_key);
+}
+
+// Applies every queued move, walking the grid in memory order so that the updates to
+// one cell, and to neighboring cells, happen together. Leaves the batch empty.
+void applyEntityMoves(EntityMoveBatch *batch, SpatialGrid *grid)
+{
+    qsort(batch->updates, batch->update_count, sizeof(CellUpdate), cellUpdateCompare);
+    for (size_t i = 0; i < batch->update_count; i++)
+    {
+        CellUpdate *update = &batch->updates[i];
+        if (update->sort_key & 1) spatialGridInsert(grid, update->cell, update->entity);
+        else spatialGridRemove(grid, update->cell, update->entity);
+    }
+    batch->update_count = 0;
 }
 
 enum
@@ -192,7 +295,7 @@ enum
 
 typedef struct PlacementCursor
 {
-    char tile_id;
+    uint8_t tile_id;
     int mode;
 } PlacementCursor;
 
@@ -0,0 +1,217 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "vector.h"
+
+// All of the entities live in one EntityStore, with each component in its own array.
+// The arrays are packed, entries 0 to count - 1 are always live entities, so systems like
+// movement or culling can stream straight through the components they need.
+// Everything outside the store refers to an entity with a 32-bit handle: the low bits pick a slot,
+// which maps to the entity's current index in the arrays, and the high bits hold the slot's
+// generation, which goes up every time an entity in that slot is destroyed, so stale handles are caught.
+
+typedef uint32_t EntityHandle;
+
+#define ENTITY_INDEX_BITS 20
+#define ENTITY_MAX_COUNT (1 << ENTITY_INDEX_BITS)
+#define ENTITY_GENERATION_MASK ((1u << (32 - ENTITY_INDEX_BITS)) - 1)
+// generations start at 1, so no live entity ever has a handle of 0
+#define NO_ENTITY 0
+
+typedef struct TextureData
+{
+    SDL_Texture *amimation_frame;
+    SDL_Texture *temporary_frame_buffer;
+    SDL_Texture *animation_frame_mask;
+    // the part of animation_frame_mask that is the mask, for masks in an atlas, or empty for all of it
+    SDL_Rect animation_frame_mask_rect;
+    SDL_Rect bounds_rectangle;
+    SDL_Rect union_rectangle;
+    // what temporary_frame_buffer was last drawn from, so it's only drawn again when that changes
+    // or other entities have been stamped onto it
+    SDL_Texture *buffer_frame;
+    int buffer_valid;
+    int buffer_stamped;
+    // the screen grid's frame when this was last marked in it
+    uint32_t screen_grid_frame;
+} TextureData;
+
+struct EntityStore;
+typedef void (*EntityDrawFunction)(struct EntityStore *, EntityHandle, SDL_Renderer *, int, int, SDL_Rect);
+typedef void (*EntityFreeFunction)(struct EntityStore *, EntityHandle);
+
+typedef struct EntityStore
+{
+    // entity positions have sub-pixel-level precision
+    // to convert to block coordinates, divide x and z by TILE_HALF_WIDTH_PX
+    // and divide y by TILE_HEIGHT_PX
+    Vector3 *positions;
+    Vector3 *sizes;
+    int *layers;
+    uint8_t *draw_on_top;
+    int *types;
+    // the colder stuff, only touched when an entity is drawn or destroyed
+    void **specific_data;
+    TextureData **texture_data;
+    EntityDrawFunction *draw;
+    EntityFreeFunction *free_callbacks;
+    // the handle of the entity at each index
+    EntityHandle *handles;
+    uint32_t count;
+    uint32_t capacity;
+
+    // these are indexed by slot
+    uint32_t *indices;
+    uint32_t *generations;
+    uint32_t slot_count;
+    // slots of destroyed entities, waiting to be reused
+    uint32_t *free_slots;
+    uint32_t free_slot_count;
+} EntityStore;
+
+uint32_t entityHandleSlot(EntityHandle entity)
+{
+    return entity & (ENTITY_MAX_COUNT - 1);
+}
+
+uint32_t entityHandleGeneration(EntityHandle entity)
+{
+    return entity >> ENTITY_INDEX_BITS;
+}
+
+void growEntityStore(EntityStore *store, uint32_t capacity)
+{
+    store->positions = realloc(store->positions, capacity * sizeof(Vector3));
+    store->sizes = realloc(store->sizes, capacity * sizeof(Vector3));
+    store->layers = realloc(store->layers, capacity * sizeof(int));
+    store->draw_on_top = realloc(store->draw_on_top, capacity * sizeof(uint8_t));
+    store->types = realloc(store->types, capacity * sizeof(int));
+    store->specific_data = realloc(store->specific_data, capacity * sizeof(void *));
+    store->texture_data = realloc(store->texture_data, capacity * sizeof(TextureData *));
+    store->draw = realloc(store->draw, capacity * sizeof(EntityDrawFunction));
+    store->free_callbacks = realloc(store->free_callbacks, capacity * sizeof(EntityFreeFunction));
+    store->handles = realloc(store->handles, capacity * sizeof(EntityHandle));
+    // there is never more than one slot per entity
+    store->indices = realloc(store->indices, capacity * sizeof(uint32_t));
+    store->generations = realloc(store->generations, capacity * sizeof(uint32_t));
+    store->free_slots = realloc(store->free_slots, capacity * sizeof(uint32_t));
+    store->capacity = capacity;
+}
+
+// the store grows as needed, capacity just saves it from growing early on
+void createEntityStore(EntityStore *store, uint32_t capacity)
+{
+    *store = (EntityStore) { 0 };
+    growEntityStore(store, capacity ? capacity : 1);
+}
+
+// returns the entity's index into the component arrays, or -1 if the handle is stale
+ptrdiff_t findEntityIndex(EntityStore *store, EntityHandle entity)
+{
+    uint32_t slot = entityHandleSlot(entity);
+    if (slot >= store->slot_count || store->generations[slot] != entityHandleGeneration(entity)) return -1;
+    return store->indices[slot];
+}
+
+int entityIsAlive(EntityStore *store, EntityHandle entity)
+{
+    return findEntityIndex(store, entity) >= 0;
+}
+
+// for handles that are known to be live
+uint32_t entityIndex(EntityStore *store, EntityHandle entity)
+{
+    ptrdiff_t index = findEntityIndex(store, entity);
+    assert(index >= 0);
+    return index;
+}
+
+Vector3 entityPosition(EntityStore *store, EntityHandle entity)
+{
+    return store->positions[entityIndex(store, entity)];
+}
+
+// Makes an entity with every component zeroed.
+// Returns NO_ENTITY if the store already holds ENTITY_MAX_COUNT entities.
+EntityHandle createEntity(EntityStore *store)
+{
+    if (store->count >= ENTITY_MAX_COUNT) return NO_ENTITY;
+    if (store->count == store->capacity) growEntityStore(store, store->capacity * 2);
+    uint32_t slot;
+    if (store->free_slot_count) slot = store->free_slots[--store->free_slot_count];
+    else
+    {
+        slot = store->slot_count++;
+        store->generations[slot] = 1;
+    }
+    uint32_t index = store->count++;
+    store->indices[slot] = index;
+    EntityHandle entity = slot | store->generations[slot] << ENTITY_INDEX_BITS;
+
+    store->positions[index] = (Vector3) { 0 };
+    store->sizes[index] = (Vector3) { 0 };
+    store->layers[index] = 0;
+    store->draw_on_top[index] = 0;
+    store->types[index] = 0;
+    store->specific_data[index] = NULL;
+    store->texture_data[index] = NULL;
+    store->draw[index] = NULL;
+    store->free_callbacks[index] = NULL;
+    store->handles[index] = entity;
+    return entity;
+}
+
+// Calls the entity's free callback, then moves the last entity into its place to keep the arrays packed.
+// The entity should already be out of the spatial index. Returns 0 if the handle was stale.
+int destroyEntity(EntityStore *store, EntityHandle entity)
+{
+    ptrdiff_t found = findEntityIndex(store, entity);
+    if (found < 0) return 0;
+    if (store->free_callbacks[found]) store->free_callbacks[found](store, entity);
+
+    uint32_t index = found;
+    uint32_t last = --store->count;
+    if (index != last)
+    {
+        store->positions[index] = store->positions[last];
+        store->sizes[index] = store->sizes[last];
+        store->layers[index] = store->layers[last];
+        store->draw_on_top[index] = store->draw_on_top[last];
+        store->types[index] = store->types[last];
+        store->specific_data[index] = store->specific_data[last];
+        store->texture_data[index] = store->texture_data[last];
+        store->draw[index] = store->draw[last];
+        store->free_callbacks[index] = store->free_callbacks[last];
+        store->handles[index] = store->handles[last];
+        store->indices[entityHandleSlot(store->handles[index])] = index;
+    }
+    uint32_t slot = entityHandleSlot(entity);
+    uint32_t generation = store->generations[slot] + 1;
+    // skip 0 when the generation wraps around
+    store->generations[slot] = (generation > ENTITY_GENERATION_MASK) ? 1 : generation;
+    store->free_slots[store->free_slot_count++] = slot;
+    return 1;
+}
+
+// destroys every entity that is left, then frees the arrays
+void freeEntityStore(EntityStore *store)
+{
+    while (store->count) destroyEntity(store, store->handles[store->count - 1]);
+    free(store->positions);
+    free(store->sizes);
+    free(store->layers);
+    free(store->draw_on_top);
+    free(store->types);
+    free(store->specific_data);
+    free(store->texture_data);
+    free(store->draw);
+    free(store->free_callbacks);
+    free(store->handles);
+    free(store->indices);
+    free(store->generations);
+    free(store->free_slots);
+    *store = (EntityStore) { 0 };
+}
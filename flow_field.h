@@ -0,0 +1,157 @@
+#pragma once
+#include <string.h>
+#include "a_star.h"
+#include "level.h"
+#include "vector.h"
+
+// Flow fields, for when lots of units are headed to the same tile. One breadth first search outward
+// from the goal records, for every cell in a box around it, which step leads toward the goal.
+// Units then just follow the field instead of each running their own A* search.
+// Fields are cached by goal cell and regenerated once a tile inside their box has changed.
+
+#define FLOW_FIELD_UNREACHABLE 0xFF
+#define FLOW_FIELD_AT_GOAL 0xFE
+
+typedef struct FlowField
+{
+    Vector3 goal;
+    // the field covers the columns from bounds_min up to, but not including, bounds_max
+    Vector3 bounds_min, bounds_max;
+    // index into a_star_neighbor_offsets of the step to take from each cell,
+    // or FLOW_FIELD_UNREACHABLE / FLOW_FIELD_AT_GOAL
+    uint8_t *directions;
+    // the sum of the revisions of every level chunk in the box when the field was made
+    uint32_t revision;
+    uint32_t last_used;
+    int valid;
+} FlowField;
+
+typedef struct FlowFieldCache
+{
+    Level *level;
+    FlowField *fields;
+    int field_count;
+    // how far the fields reach from their goal along x and z
+    int radius;
+    Vector3 *queue;
+    uint32_t use_counter;
+} FlowFieldCache;
+
+FlowFieldCache createFlowFieldCache(Level *level, int field_count, int radius)
+{
+    FlowFieldCache cache = { level, calloc(field_count, sizeof(FlowField)), field_count, radius, NULL, 0 };
+    size_t field_volume = (size_t)(2 * radius + 1) * (2 * radius + 1) * level->size.y;
+    for (int i = 0; i < field_count; i++)
+    {
+        cache.fields[i].directions = malloc(field_volume);
+    }
+    cache.queue = calloc(field_volume, sizeof(Vector3));
+    return cache;
+}
+
+void freeFlowFieldCache(FlowFieldCache *cache)
+{
+    for (int i = 0; i < cache->field_count; i++) free(cache->fields[i].directions);
+    free(cache->fields);
+    free(cache->queue);
+    *cache = (FlowFieldCache) { 0 };
+}
+
+size_t flowFieldIndex(FlowField *field, Vector3 position)
+{
+    int width = field->bounds_max.x - field->bounds_min.x;
+    int depth = field->bounds_max.z - field->bounds_min.z;
+    return (position.x - field->bounds_min.x) + (position.z - field->bounds_min.z) * width + (size_t)position.y * width * depth;
+}
+
+int flowFieldContains(FlowField *field, Vector3 position)
+{
+    return position.x >= field->bounds_min.x && position.x < field->bounds_max.x
+        && position.y >= field->bounds_min.y && position.y < field->bounds_max.y
+        && position.z >= field->bounds_min.z && position.z < field->bounds_max.z;
+}
+
+uint32_t flowFieldRegionRevision(FlowField *field, Level *level)
+{
+    uint32_t revision = 0;
+    Vector3 chunk_min = { field->bounds_min.x / LEVEL_CHUNK_SIZE, 0, field->bounds_min.z / LEVEL_CHUNK_SIZE };
+    Vector3 chunk_max = { (field->bounds_max.x - 1) / LEVEL_CHUNK_SIZE, level->chunk_count.y - 1, (field->bounds_max.z - 1) / LEVEL_CHUNK_SIZE };
+    for (int y = chunk_min.y; y <= chunk_max.y; y++)
+    {
+        for (int z = chunk_min.z; z <= chunk_max.z; z++)
+        {
+            for (int x = chunk_min.x; x <= chunk_max.x; x++)
+            {
+                revision += level->chunk_revisions[x + z * level->chunk_count.x + y * level->chunk_count.x * level->chunk_count.z];
+            }
+        }
+    }
+    return revision;
+}
+
+void generateFlowField(FlowFieldCache *cache, FlowField *field, Vector3 goal)
+{
+    Level *level = cache->level;
+    field->goal = goal;
+    field->bounds_min = (Vector3) { goal.x - cache->radius, 0, goal.z - cache->radius };
+    field->bounds_max = (Vector3) { goal.x + cache->radius + 1, level->size.y, goal.z + cache->radius + 1 };
+    field->bounds_min = clampVector3(field->bounds_min, (Vector3) { 0, 0, 0 }, level->size);
+    field->bounds_max.x = clamp(field->bounds_max.x, 0, level->size.x);
+    field->bounds_max.z = clamp(field->bounds_max.z, 0, level->size.z);
+    size_t volume = (size_t)(field->bounds_max.x - field->bounds_min.x) * (field->bounds_max.z - field->bounds_min.z) * level->size.y;
+    memset(field->directions, FLOW_FIELD_UNREACHABLE, volume);
+    field->revision = flowFieldRegionRevision(field, level);
+    field->valid = 1;
+    if (!cellIsWalkable(goal, level)) return;
+
+    size_t head = 0, tail = 0;
+    field->directions[flowFieldIndex(field, goal)] = FLOW_FIELD_AT_GOAL;
+    cache->queue[tail++] = goal;
+    while (head < tail)
+    {
+        Vector3 position = cache->queue[head++];
+        for (int i = 0; i < A_STAR_NEIGHBOR_COUNT; i++)
+        {
+            Vector3 previous = subtractVector3(position, a_star_neighbor_offsets[i]);
+            if (!flowFieldContains(field, previous)) continue;
+            uint8_t *direction = &field->directions[flowFieldIndex(field, previous)];
+            if (*direction != FLOW_FIELD_UNREACHABLE) continue;
+            if (!cellIsWalkable(previous, level) || !canStepBetween(previous, position, level)) continue;
+            // taking step i from previous leads one step closer to the goal
+            *direction = i;
+            cache->queue[tail++] = previous;
+        }
+    }
+}
+
+// Returns the field leading to goal, regenerating it if it is missing or stale.
+// Making a new field throws out the least recently used one.
+FlowField *getFlowField(FlowFieldCache *cache, Vector3 goal)
+{
+    FlowField *least_recent = &cache->fields[0];
+    for (int i = 0; i < cache->field_count; i++)
+    {
+        FlowField *field = &cache->fields[i];
+        if (field->valid && field->goal.x == goal.x && field->goal.y == goal.y && field->goal.z == goal.z)
+        {
+            if (field->revision != flowFieldRegionRevision(field, cache->level)) generateFlowField(cache, field, goal);
+            field->last_used = ++cache->use_counter;
+            return field;
+        }
+        if (!field->valid || (least_recent->valid && field->last_used < least_recent->last_used)) least_recent = field;
+    }
+    generateFlowField(cache, least_recent, goal);
+    least_recent->last_used = ++cache->use_counter;
+    return least_recent;
+}
+
+// Sets *step to the offset that moves position toward the goal.
+// Returns 0 if the goal can't be reached from position inside the field, or it is already there.
+int flowFieldDirection(FlowField *field, Vector3 position, Vector3 *step)
+{
+    if (!flowFieldContains(field, position)) return 0;
+    uint8_t direction = field->directions[flowFieldIndex(field, position)];
+    if (direction >= A_STAR_NEIGHBOR_COUNT) return 0;
+    *step = a_star_neighbor_offsets[direction];
+    return 1;
+}
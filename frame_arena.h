@@ -0,0 +1,96 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// A linear allocator for things that only need to last until the end of a frame.
+// Allocating just moves along the block, and frameArenaReset at the start of the next frame lets go of
+// everything at once. When a frame needs more than the block has room for, new blocks are started and
+// the full ones are kept until the reset, which swaps them all for one block as big as the most any
+// frame has used. So once it has seen the biggest frame, it never allocates again.
+
+#define FRAME_ARENA_ALIGNMENT 16
+#define FRAME_ARENA_MIN_BLOCK (64 * 1024)
+
+typedef struct FrameArena
+{
+    uint8_t *block;
+    size_t used, capacity;
+    // the blocks that filled up since the last reset
+    void **full_blocks;
+    size_t full_block_count, full_block_capacity;
+    // bytes handed out since the last reset, and the most there have ever been
+    size_t frame_used, high_water;
+} FrameArena;
+
+size_t frameArenaRound(size_t size)
+{
+    return (size + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+}
+
+void *frameArenaAlloc(FrameArena *arena, size_t size)
+{
+    size = frameArenaRound(size);
+    if (arena->used + size > arena->capacity)
+    {
+        if (arena->block)
+        {
+            if (arena->full_block_count == arena->full_block_capacity)
+            {
+                arena->full_block_capacity = arena->full_block_capacity ? 2 * arena->full_block_capacity : 8;
+                arena->full_blocks = realloc(arena->full_blocks, arena->full_block_capacity * sizeof(void *));
+            }
+            arena->full_blocks[arena->full_block_count++] = arena->block;
+        }
+        arena->capacity = 2 * arena->capacity;
+        if (arena->capacity < size) arena->capacity = size;
+        if (arena->capacity < FRAME_ARENA_MIN_BLOCK) arena->capacity = FRAME_ARENA_MIN_BLOCK;
+        arena->block = malloc(arena->capacity);
+        arena->used = 0;
+    }
+    void *allocation = arena->block + arena->used;
+    arena->used += size;
+    arena->frame_used += size;
+    return allocation;
+}
+
+// Makes an allocation new_size bytes long, keeping what was in it. It's grown where it is if it was the
+// last thing allocated and there's room, otherwise it's copied. allocation can be NULL.
+void *frameArenaGrow(FrameArena *arena, void *allocation, size_t old_size, size_t new_size)
+{
+    old_size = frameArenaRound(old_size);
+    if (allocation && (uint8_t *)allocation + old_size == arena->block + arena->used
+        && (uint8_t *)allocation + frameArenaRound(new_size) <= arena->block + arena->capacity)
+    {
+        arena->used += frameArenaRound(new_size) - old_size;
+        arena->frame_used += frameArenaRound(new_size) - old_size;
+        return allocation;
+    }
+    void *grown = frameArenaAlloc(arena, new_size);
+    if (allocation) memcpy(grown, allocation, old_size);
+    return grown;
+}
+
+// Frees everything allocated since the last reset
+void frameArenaReset(FrameArena *arena)
+{
+    if (arena->frame_used > arena->high_water) arena->high_water = arena->frame_used;
+    if (arena->full_block_count)
+    {
+        for (size_t i = 0; i < arena->full_block_count; i++) free(arena->full_blocks[i]);
+        arena->full_block_count = 0;
+        free(arena->block);
+        arena->capacity = arena->high_water;
+        arena->block = malloc(arena->capacity);
+    }
+    arena->used = 0;
+    arena->frame_used = 0;
+}
+
+void freeFrameArena(FrameArena *arena)
+{
+    for (size_t i = 0; i < arena->full_block_count; i++) free(arena->full_blocks[i]);
+    free(arena->full_blocks);
+    free(arena->block);
+    *arena = (FrameArena) { 0 };
+}
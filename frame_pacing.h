@@ -0,0 +1,204 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "text_cache.h"
+#include "math_utils.h"
+
+// Decides when the next frame starts, and keeps track of how long frames have been taking.
+// paceFrame goes right after SDL_RenderPresent. How it waits depends on the mode:
+// - FRAME_PACING_VSYNC leaves the waiting to SDL_RenderPresent, frames are as long as the display's refresh
+// - FRAME_PACING_SLEEP_SPIN sleeps until just before the deadline, then spins the rest of the way,
+//   since SDL_Delay is only good to a millisecond or so and often oversleeps
+// - FRAME_PACING_UNCAPPED doesn't wait at all, for benchmarking
+// Deadlines are a frame apart rather than a frame from whenever the last one finished, so the frame
+// rate doesn't drift, and after a missed one the next is a whole frame away instead of trying to catch up.
+// The last FRAME_PACING_WINDOW frames go into a histogram, including the ones that went over.
+
+#define FRAME_PACING_WINDOW 512
+#define FRAME_HISTOGRAM_BUCKETS 100
+#define FRAME_HISTOGRAM_BUCKET_MICROSECONDS 500
+// how long before the deadline to stop sleeping and start spinning
+#define FRAME_PACING_SPIN_MICROSECONDS 2000
+
+enum { FRAME_PACING_VSYNC, FRAME_PACING_SLEEP_SPIN, FRAME_PACING_UNCAPPED, FRAME_PACING_MODE_COUNT };
+const char *frame_pacing_mode_names[FRAME_PACING_MODE_COUNT] = { "vsync", "sleep+spin", "uncapped" };
+
+typedef struct FramePacing
+{
+    int mode;
+    // in SDL_GetPerformanceCounter ticks
+    uint64_t frame_length;
+    uint64_t frame_start;
+    uint64_t deadline;
+    uint64_t frequency;
+
+    // the last FRAME_PACING_WINDOW frames, oldest first starting at window_next once it's full
+    uint32_t window_microseconds[FRAME_PACING_WINDOW];
+    uint8_t window_missed[FRAME_PACING_WINDOW];
+    uint32_t window_next, window_count;
+    // the frames in the window by length, the last bucket has everything longer
+    uint32_t histogram[FRAME_HISTOGRAM_BUCKETS];
+    uint32_t missed_in_window;
+    uint64_t frames, missed;
+} FramePacing;
+
+typedef struct FramePacingStats
+{
+    // over the frames in the window
+    uint32_t frames;
+    uint32_t missed;
+    double p50_ms, p99_ms, max_ms;
+    double target_ms;
+    // since the start
+    uint64_t total_frames, total_missed;
+} FramePacingStats;
+
+uint64_t framePacingTicks(FramePacing *pacing, uint64_t microseconds)
+{
+    return microseconds * pacing->frequency / 1000000;
+}
+
+uint64_t framePacingMicroseconds(FramePacing *pacing, uint64_t ticks)
+{
+    return ticks * 1000000 / pacing->frequency;
+}
+
+// Switches modes, vsync is turned on and off on the renderer to match.
+// Returns 0 if the mode isn't available, which leaves the mode as it was.
+int setFramePacingMode(FramePacing *pacing, SDL_Renderer *renderer, int mode, int frame_microseconds)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (SDL_RenderSetVSync(renderer, mode == FRAME_PACING_VSYNC) && mode == FRAME_PACING_VSYNC) return 0;
+#else
+    // vsync can only be picked when the renderer is made before 2.0.18
+    if (mode == FRAME_PACING_VSYNC) return 0;
+#endif
+    pacing->mode = mode;
+    pacing->frame_length = framePacingTicks(pacing, frame_microseconds);
+    pacing->frame_start = SDL_GetPerformanceCounter();
+    pacing->deadline = pacing->frame_start + pacing->frame_length;
+    return 1;
+}
+
+// frame_microseconds is how long frames are meant to take, the display's refresh in vsync mode
+FramePacing makeFramePacing(SDL_Renderer *renderer, int mode, int frame_microseconds)
+{
+    FramePacing pacing = { .frequency = SDL_GetPerformanceFrequency() };
+    if (!setFramePacingMode(&pacing, renderer, mode, frame_microseconds))
+    {
+        setFramePacingMode(&pacing, renderer, FRAME_PACING_SLEEP_SPIN, frame_microseconds);
+    }
+    return pacing;
+}
+
+void recordFrameTime(FramePacing *pacing, uint32_t microseconds, int missed)
+{
+    if (pacing->window_count == FRAME_PACING_WINDOW)
+    {
+        uint32_t oldest = pacing->window_microseconds[pacing->window_next];
+        pacing->histogram[min(oldest / FRAME_HISTOGRAM_BUCKET_MICROSECONDS, FRAME_HISTOGRAM_BUCKETS - 1)]--;
+        pacing->missed_in_window -= pacing->window_missed[pacing->window_next];
+    }
+    else pacing->window_count++;
+    pacing->window_microseconds[pacing->window_next] = microseconds;
+    pacing->window_missed[pacing->window_next] = missed;
+    pacing->window_next = (pacing->window_next + 1) % FRAME_PACING_WINDOW;
+    pacing->histogram[min(microseconds / FRAME_HISTOGRAM_BUCKET_MICROSECONDS, FRAME_HISTOGRAM_BUCKETS - 1)]++;
+    pacing->missed_in_window += missed;
+    pacing->missed += missed;
+    pacing->frames++;
+}
+
+// Waits for the next frame, call it right after SDL_RenderPresent
+void paceFrame(FramePacing *pacing)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    int missed;
+    // with vsync a missed deadline shows up as a frame that took another refresh
+    if (pacing->mode == FRAME_PACING_VSYNC) missed = now - pacing->frame_start > pacing->frame_length * 3 / 2;
+    else missed = now > pacing->deadline;
+
+    if (pacing->mode == FRAME_PACING_SLEEP_SPIN && !missed)
+    {
+        uint64_t spin_ticks = framePacingTicks(pacing, FRAME_PACING_SPIN_MICROSECONDS);
+        if (pacing->deadline - now > spin_ticks)
+        {
+            SDL_Delay(framePacingMicroseconds(pacing, pacing->deadline - now - spin_ticks) / 1000);
+        }
+        while (SDL_GetPerformanceCounter() < pacing->deadline);
+        now = SDL_GetPerformanceCounter();
+    }
+
+    recordFrameTime(pacing, framePacingMicroseconds(pacing, now - pacing->frame_start), missed);
+    pacing->frame_start = now;
+    if (pacing->mode == FRAME_PACING_SLEEP_SPIN && !missed) pacing->deadline += pacing->frame_length;
+    else pacing->deadline = now + pacing->frame_length;
+}
+
+// the length that fraction of the frames in the window are no longer than, to the bucket
+double frameHistogramPercentile(FramePacing *pacing, double fraction)
+{
+    uint32_t rank = fraction * pacing->window_count;
+    uint32_t seen = 0;
+    for (int i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += pacing->histogram[i];
+        if (seen > rank) return (i + 1) * FRAME_HISTOGRAM_BUCKET_MICROSECONDS / 1000.0;
+    }
+    return FRAME_HISTOGRAM_BUCKETS * FRAME_HISTOGRAM_BUCKET_MICROSECONDS / 1000.0;
+}
+
+FramePacingStats framePacingStats(FramePacing *pacing)
+{
+    FramePacingStats stats = { .frames = pacing->window_count, .missed = pacing->missed_in_window,
+        .target_ms = framePacingMicroseconds(pacing, pacing->frame_length) / 1000.0,
+        .total_frames = pacing->frames, .total_missed = pacing->missed };
+    if (!pacing->window_count) return stats;
+    uint32_t longest = 0;
+    for (uint32_t i = 0; i < pacing->window_count; i++) longest = max(longest, pacing->window_microseconds[i]);
+    stats.max_ms = longest / 1000.0;
+    stats.p50_ms = frameHistogramPercentile(pacing, 0.5);
+    stats.p99_ms = frameHistogramPercentile(pacing, 0.99);
+    return stats;
+}
+
+void formatFramePacingStats(FramePacing *pacing, char *buffer, size_t size)
+{
+    FramePacingStats stats = framePacingStats(pacing);
+    snprintf(buffer, size, "%s %.1fms: p50 %.1fms p99 %.1fms max %.1fms, %u of %u missed",
+        frame_pacing_mode_names[pacing->mode], stats.target_ms, stats.p50_ms, stats.p99_ms, stats.max_ms, stats.missed, stats.frames);
+}
+
+// Draws the histogram across area, with the frames that went past the target in red, and label
+// underneath it, which should only change every so often since every new string is rendered again
+void drawFramePacingOverlay(SDL_Renderer *renderer, FramePacing *pacing, TextCache *text_cache, TTF_Font *font, char *label, SDL_Rect area)
+{
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 128);
+    SDL_RenderFillRect(renderer, &area);
+    int label_height = area.h / 5;
+    int bars_height = area.h - label_height;
+    uint32_t tallest = 1;
+    for (int i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++) tallest = max(tallest, pacing->histogram[i]);
+    uint64_t target_microseconds = framePacingMicroseconds(pacing, pacing->frame_length);
+    for (int i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+    {
+        if (!pacing->histogram[i]) continue;
+        int height = (uint64_t)pacing->histogram[i] * bars_height / tallest;
+        if (!height) height = 1;
+        SDL_Rect bar = { area.x + i * area.w / FRAME_HISTOGRAM_BUCKETS, area.y + bars_height - height,
+            area.w / FRAME_HISTOGRAM_BUCKETS - 1, height };
+        if ((uint64_t)i * FRAME_HISTOGRAM_BUCKET_MICROSECONDS >= target_microseconds) SDL_SetRenderDrawColor(renderer, 230, 60, 60, 255);
+        else SDL_SetRenderDrawColor(renderer, 90, 200, 90, 255);
+        SDL_RenderFillRect(renderer, &bar);
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    SDL_Texture *text = getTextureFromString(renderer, text_cache, label, font);
+    int text_width = 0, text_height = 0;
+    SDL_QueryTexture(text, NULL, NULL, &text_width, &text_height);
+    if (!text_height) return;
+    int label_width = min(text_width * label_height / text_height, area.w);
+    SDL_RenderCopy(renderer, text, NULL, &(SDL_Rect) { area.x, area.y + bars_height, label_width, label_height });
+}
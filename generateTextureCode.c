@@ -31,8 +31,11 @@ int main(int argc, char **argv)
     fprintf(header_file, "#pragma once\n");
     fprintf(header_file, "#include \"texture_utils.h\"\n");
     fprintf(header_file, "SDL_Texture *tile_textures[256] = { NULL };\n");
-    fprintf(header_file, "SDL_Texture *tile_mask_textures[256] = { NULL }; \n");
-    fprintf(header_file, "SDL_Texture *tile_inverted_mask_textures[256] = { NULL }; \n");
+    // every tile and its mask also go in one atlas, so tiles can be drawn in batches, and the masks come from there too
+    fprintf(header_file, "SDL_Texture *tile_atlas = NULL;\n");
+    fprintf(header_file, "int tile_atlas_width, tile_atlas_height;\n");
+    fprintf(header_file, "SDL_Rect tile_atlas_rects[256] = { 0 };\n");
+    fprintf(header_file, "SDL_Rect tile_mask_atlas_rects[256] = { 0 };\n");
     // first, generate the enum
     fprintf(header_file, "enum\n{\n");
     if (argc < 2) exit(EXIT_FAILURE);
@@ -46,20 +49,27 @@ int main(int argc, char **argv)
         fprintf(header_file, ",\n\t%s_TILE", buffer);
     }
     fprintf(header_file, "\n};\n");
+    fprintf(header_file, "#define TILE_TYPE_COUNT %d\n", argc - 1);
 
     fprintf(header_file, "void loadAllTextures(SDL_Renderer *renderer)\n{\n\tSDL_Surface *temp_surface;");
+    fprintf(header_file, "\n\tSDL_Surface *atlas_surfaces[2 * TILE_TYPE_COUNT];");
+    fprintf(header_file, "\n\tSDL_Rect atlas_rects[2 * TILE_TYPE_COUNT];");
     for (int i = 1; i < argc; i++)
     {
         strncpy(buffer, argv[i], BUFFER_SIZE - 1);
         toAllCapsAndUnderScores(buffer);
         fprintf(header_file, "\n\ttemp_surface = SDL_LoadBMP(\"%s%s\");", prefix, argv[i]);
         fprintf(header_file, "\n\ttile_textures[%s_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);", buffer);
+        fprintf(header_file, "\n\tatlas_surfaces[2 * %s_TILE] = copySurface(temp_surface);", buffer);
         fprintf(header_file, "\n\tsurfaceToMask(temp_surface);");
-        fprintf(header_file, "\n\ttile_mask_textures[%s_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);", buffer);
-        fprintf(header_file, "\n\tinvertMask(temp_surface);");
-        fprintf(header_file, "\n\ttile_inverted_mask_textures[%s_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);", buffer);
-        fprintf(header_file, "\n\tSDL_FreeSurface(temp_surface);");
+        fprintf(header_file, "\n\tatlas_surfaces[2 * %s_TILE + 1] = temp_surface;", buffer);
     }
+    fprintf(header_file, "\n\ttile_atlas = packTextureAtlas(renderer, atlas_surfaces, atlas_rects, 2 * TILE_TYPE_COUNT, &tile_atlas_width, &tile_atlas_height);");
+    fprintf(header_file, "\n\tfor (int i = 0; i < TILE_TYPE_COUNT; i++)\n\t{");
+    fprintf(header_file, "\n\t\ttile_atlas_rects[i] = atlas_rects[2 * i];");
+    fprintf(header_file, "\n\t\ttile_mask_atlas_rects[i] = atlas_rects[2 * i + 1];");
+    fprintf(header_file, "\n\t\tfor (int j = 0; j < 2; j++) SDL_FreeSurface(atlas_surfaces[2 * i + j]);");
+    fprintf(header_file, "\n\t}");
     fprintf(header_file, "\n}\n");
 }
     
@@ -0,0 +1,439 @@
+#pragma once
+#include <string.h>
+#include "a_star.h"
+#include "level.h"
+#include "vector.h"
+
+// Hierarchical pathfinding (HPA*). The level is cut into columns of LEVEL_CHUNK_SIZE x LEVEL_CHUNK_SIZE tiles.
+// Wherever a unit can walk from one column into the next, the middle of each unbroken stretch of that border
+// becomes an entrance, and the walking distances between the entrances of each chunk are cached.
+// Long queries search the small graph of entrances first, and then fill in the steps between them with
+// A* searches that are confined to a single chunk. A chunk is rebuilt lazily once the level's chunk
+// revisions show its tiles were edited; an edit on the neighboring side of a shared border only makes
+// this chunk rescan that border, and rebuild if the entrances on it actually moved.
+
+#define HPA_SIDE_COUNT 4
+#define HPA_UNREACHABLE -1
+// queries at least this close together skip the entrance graph and use plain A*
+#define HPA_DIRECT_SEARCH_DISTANCE LEVEL_CHUNK_SIZE
+
+// going from an entrance into the neighboring chunk
+typedef struct HpaLink
+{
+    int entrance;
+    Vector3 target;
+} HpaLink;
+
+typedef struct HpaChunk
+{
+    Vector3 *entrances;
+    int entrance_count, entrance_capacity;
+    HpaLink *links;
+    int link_count, link_capacity;
+    // entrance_count * entrance_count walking distances that stay inside the chunk
+    int *distances;
+    int distances_capacity;
+    int built;
+    uint32_t revision;
+    uint32_t neighbor_revisions[HPA_SIDE_COUNT];
+    uint64_t side_signatures[HPA_SIDE_COUNT];
+} HpaChunk;
+
+typedef struct HpaGraph
+{
+    Level *level;
+    int chunks_x, chunks_z;
+    HpaChunk *chunks;
+    // breadth first search scratch that covers one chunk column
+    int *flood_distances;
+    Vector3 *flood_queue;
+    // distances from the query's start to the start chunk's entrances and from the goal chunk's entrances to the goal
+    int *start_distances, *goal_distances;
+    int endpoint_capacity;
+    SearchData abstract_search;
+    SearchData local_search;
+    Vector3 *path;
+    size_t path_length, path_capacity;
+} HpaGraph;
+
+// +x, -x, +z, -z
+Vector3 hpa_side_offsets[HPA_SIDE_COUNT] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+void createHpaGraph(HpaGraph *graph, Level *level, int max_abstract_nodes, int max_local_nodes)
+{
+    *graph = (HpaGraph) { 0 };
+    graph->level = level;
+    graph->chunks_x = (level->size.x + LEVEL_CHUNK_SIZE - 1) / LEVEL_CHUNK_SIZE;
+    graph->chunks_z = (level->size.z + LEVEL_CHUNK_SIZE - 1) / LEVEL_CHUNK_SIZE;
+    graph->chunks = calloc(graph->chunks_x * graph->chunks_z, sizeof(HpaChunk));
+    graph->flood_distances = calloc(LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE * level->size.y, sizeof(int));
+    graph->flood_queue = calloc(LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE * level->size.y, sizeof(Vector3));
+    graph->abstract_search = createSearchData(max_abstract_nodes);
+    graph->local_search = createSearchData(max_local_nodes);
+    graph->path_capacity = 4 * (level->size.x + level->size.z);
+    graph->path = calloc(graph->path_capacity, sizeof(Vector3));
+}
+
+void freeHpaGraph(HpaGraph *graph)
+{
+    for (int i = 0; i < graph->chunks_x * graph->chunks_z; i++)
+    {
+        free(graph->chunks[i].entrances);
+        free(graph->chunks[i].links);
+        free(graph->chunks[i].distances);
+    }
+    free(graph->chunks);
+    free(graph->flood_distances);
+    free(graph->flood_queue);
+    free(graph->start_distances);
+    free(graph->goal_distances);
+    freeSearchData(&graph->abstract_search);
+    freeSearchData(&graph->local_search);
+    free(graph->path);
+    *graph = (HpaGraph) { 0 };
+}
+
+// the revision of a whole column is the sum of the revisions of the level chunks stacked in it,
+// which changes whenever any of them does
+uint32_t hpaColumnRevision(Level *level, int chunk_x, int chunk_z)
+{
+    uint32_t revision = 0;
+    for (int y = 0; y < level->chunk_count.y; y++)
+    {
+        revision += level->chunk_revisions[chunk_x + chunk_z * level->chunk_count.x + y * level->chunk_count.x * level->chunk_count.z];
+    }
+    return revision;
+}
+
+int hpaChunkHasNeighbor(HpaGraph *graph, int chunk_x, int chunk_z, int side)
+{
+    int neighbor_x = chunk_x + hpa_side_offsets[side].x;
+    int neighbor_z = chunk_z + hpa_side_offsets[side].z;
+    return neighbor_x >= 0 && neighbor_x < graph->chunks_x && neighbor_z >= 0 && neighbor_z < graph->chunks_z;
+}
+
+int addHpaEntrance(HpaChunk *chunk, Vector3 position)
+{
+    for (int i = 0; i < chunk->entrance_count; i++)
+    {
+        Vector3 entrance = chunk->entrances[i];
+        if (entrance.x == position.x && entrance.y == position.y && entrance.z == position.z) return i;
+    }
+    if (chunk->entrance_count >= chunk->entrance_capacity)
+    {
+        chunk->entrance_capacity = chunk->entrance_capacity ? chunk->entrance_capacity * 2 : 16;
+        chunk->entrances = realloc(chunk->entrances, chunk->entrance_capacity * sizeof(Vector3));
+    }
+    chunk->entrances[chunk->entrance_count] = position;
+    return chunk->entrance_count++;
+}
+
+int findHpaEntrance(HpaChunk *chunk, Vector3 position)
+{
+    for (int i = 0; i < chunk->entrance_count; i++)
+    {
+        Vector3 entrance = chunk->entrances[i];
+        if (entrance.x == position.x && entrance.y == position.y && entrance.z == position.z) return i;
+    }
+    return -1;
+}
+
+// Walks one border of a chunk and finds the unbroken stretches that can be crossed, for every height
+// and every kind of step (level, climbing, dropping). Stepping is symmetric, so the chunk on the other
+// side of the border finds exactly the same stretches. If chunk is not NULL, the middle of each stretch
+// is added to it as an entrance. Returns a signature of the entrances, to cheaply tell if they moved.
+uint64_t scanHpaSide(HpaGraph *graph, int chunk_x, int chunk_z, int side, HpaChunk *chunk)
+{
+    Level *level = graph->level;
+    if (!hpaChunkHasNeighbor(graph, chunk_x, chunk_z, side)) return 0;
+    Vector3 offset = hpa_side_offsets[side];
+    // the border is a line along z for the x sides and along x for the z sides
+    Vector3 first = { chunk_x * LEVEL_CHUNK_SIZE, 0, chunk_z * LEVEL_CHUNK_SIZE };
+    if (offset.x > 0) first.x += LEVEL_CHUNK_SIZE - 1;
+    if (offset.z > 0) first.z += LEVEL_CHUNK_SIZE - 1;
+    Vector3 along = offset.x ? (Vector3) { 0, 0, 1 } : (Vector3) { 1, 0, 0 };
+    int length = offset.x ? level->size.z - first.z : level->size.x - first.x;
+    if (length > LEVEL_CHUNK_SIZE) length = LEVEL_CHUNK_SIZE;
+
+    uint64_t signature = 0;
+    for (int y = 1; y < level->size.y; y++)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            int run_start = -1;
+            for (int i = 0; i <= length; i++)
+            {
+                Vector3 cell = { first.x + along.x * i, y, first.z + along.z * i };
+                Vector3 target = { cell.x + offset.x, y + dy, cell.z + offset.z };
+                int crossable = i < length && cellIsWalkable(cell, level) && canStepBetween(cell, target, level);
+                if (crossable && run_start < 0) run_start = i;
+                if (!crossable && run_start >= 0)
+                {
+                    int middle = (run_start + i - 1) / 2;
+                    Vector3 entrance = { first.x + along.x * middle, y, first.z + along.z * middle };
+                    signature = signature * 31 + hashVector3(entrance) + dy;
+                    if (chunk)
+                    {
+                        int index = addHpaEntrance(chunk, entrance);
+                        if (chunk->link_count >= chunk->link_capacity)
+                        {
+                            chunk->link_capacity = chunk->link_capacity ? chunk->link_capacity * 2 : 16;
+                            chunk->links = realloc(chunk->links, chunk->link_capacity * sizeof(HpaLink));
+                        }
+                        chunk->links[chunk->link_count++] = (HpaLink) { index, (Vector3) { entrance.x + offset.x, y + dy, entrance.z + offset.z } };
+                    }
+                    run_start = -1;
+                }
+            }
+        }
+    }
+    return signature;
+}
+
+int hpaFloodIndex(Vector3 position, int chunk_x, int chunk_z)
+{
+    return (position.x - chunk_x * LEVEL_CHUNK_SIZE) + (position.z - chunk_z * LEVEL_CHUNK_SIZE) * LEVEL_CHUNK_SIZE
+        + position.y * LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE;
+}
+
+// breadth first search from source that never leaves its chunk, filling flood_distances
+void floodHpaChunk(HpaGraph *graph, int chunk_x, int chunk_z, Vector3 source)
+{
+    Level *level = graph->level;
+    memset(graph->flood_distances, 0xFF, LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE * level->size.y * sizeof(int));
+    int min_x = chunk_x * LEVEL_CHUNK_SIZE, min_z = chunk_z * LEVEL_CHUNK_SIZE;
+    size_t head = 0, tail = 0;
+    graph->flood_distances[hpaFloodIndex(source, chunk_x, chunk_z)] = 0;
+    graph->flood_queue[tail++] = source;
+    while (head < tail)
+    {
+        Vector3 position = graph->flood_queue[head++];
+        int distance = graph->flood_distances[hpaFloodIndex(position, chunk_x, chunk_z)];
+        for (int i = 0; i < A_STAR_NEIGHBOR_COUNT; i++)
+        {
+            Vector3 next_position = addVector3(position, a_star_neighbor_offsets[i]);
+            if (next_position.x < min_x || next_position.x >= min_x + LEVEL_CHUNK_SIZE
+            || next_position.z < min_z || next_position.z >= min_z + LEVEL_CHUNK_SIZE) continue;
+            int *next_distance = &graph->flood_distances[hpaFloodIndex(next_position, chunk_x, chunk_z)];
+            if (next_position.y < 0 || next_position.y >= level->size.y || *next_distance != HPA_UNREACHABLE) continue;
+            if (!canStepBetween(position, next_position, level)) continue;
+            *next_distance = distance + 1;
+            graph->flood_queue[tail++] = next_position;
+        }
+    }
+}
+
+int hpaFloodDistance(HpaGraph *graph, int chunk_x, int chunk_z, Vector3 position)
+{
+    return graph->flood_distances[hpaFloodIndex(position, chunk_x, chunk_z)];
+}
+
+void buildHpaChunk(HpaGraph *graph, int chunk_x, int chunk_z)
+{
+    HpaChunk *chunk = &graph->chunks[chunk_x + chunk_z * graph->chunks_x];
+    chunk->entrance_count = 0;
+    chunk->link_count = 0;
+    for (int side = 0; side < HPA_SIDE_COUNT; side++)
+    {
+        chunk->side_signatures[side] = scanHpaSide(graph, chunk_x, chunk_z, side, chunk);
+        if (hpaChunkHasNeighbor(graph, chunk_x, chunk_z, side))
+        {
+            chunk->neighbor_revisions[side] = hpaColumnRevision(graph->level, chunk_x + hpa_side_offsets[side].x, chunk_z + hpa_side_offsets[side].z);
+        }
+    }
+    int count = chunk->entrance_count;
+    if (count * count > chunk->distances_capacity)
+    {
+        chunk->distances_capacity = count * count;
+        chunk->distances = realloc(chunk->distances, chunk->distances_capacity * sizeof(int));
+    }
+    for (int i = 0; i < count; i++)
+    {
+        floodHpaChunk(graph, chunk_x, chunk_z, chunk->entrances[i]);
+        for (int j = 0; j < count; j++)
+        {
+            chunk->distances[i * count + j] = hpaFloodDistance(graph, chunk_x, chunk_z, chunk->entrances[j]);
+        }
+    }
+    chunk->revision = hpaColumnRevision(graph->level, chunk_x, chunk_z);
+    chunk->built = 1;
+}
+
+// returns the chunk, rebuilding it first if the level has changed underneath it
+HpaChunk *getHpaChunk(HpaGraph *graph, int chunk_x, int chunk_z)
+{
+    HpaChunk *chunk = &graph->chunks[chunk_x + chunk_z * graph->chunks_x];
+    if (!chunk->built || chunk->revision != hpaColumnRevision(graph->level, chunk_x, chunk_z))
+    {
+        buildHpaChunk(graph, chunk_x, chunk_z);
+        return chunk;
+    }
+    for (int side = 0; side < HPA_SIDE_COUNT; side++)
+    {
+        if (!hpaChunkHasNeighbor(graph, chunk_x, chunk_z, side)) continue;
+        uint32_t neighbor_revision = hpaColumnRevision(graph->level, chunk_x + hpa_side_offsets[side].x, chunk_z + hpa_side_offsets[side].z);
+        if (neighbor_revision == chunk->neighbor_revisions[side]) continue;
+        // the neighbor was edited, but unless it was right on our border the entrances are still the same
+        if (scanHpaSide(graph, chunk_x, chunk_z, side, NULL) != chunk->side_signatures[side])
+        {
+            buildHpaChunk(graph, chunk_x, chunk_z);
+            return chunk;
+        }
+        chunk->neighbor_revisions[side] = neighbor_revision;
+    }
+    return chunk;
+}
+
+// builds every chunk up front, instead of as queries first touch them
+void buildHpaGraph(HpaGraph *graph)
+{
+    for (int z = 0; z < graph->chunks_z; z++)
+    {
+        for (int x = 0; x < graph->chunks_x; x++) getHpaChunk(graph, x, z);
+    }
+}
+
+// returns 0 when the abstract search has run out of nodes
+int relaxHpaNode(HpaGraph *graph, AStarNode *current, Vector3 position, int cost, Vector3 goal)
+{
+    if (cost == HPA_UNREACHABLE) return 1;
+    AStarNode *neighbor = getSearchNode(&graph->abstract_search, position);
+    if (!neighbor) return 0;
+    if (neighbor->closed) return 1;
+    int tentative_g_score = current->g_score + cost;
+    if (tentative_g_score < neighbor->g_score)
+    {
+        int heuristic = aStarHeuristic(position, goal);
+        neighbor->g_score = tentative_g_score;
+        neighbor->f_score = tentative_g_score + heuristic;
+        neighbor->came_from = current;
+        return pushOpenNode(&graph->abstract_search, neighbor, heuristic);
+    }
+    return 1;
+}
+
+// fill distances with the walking distance from position to every entrance of its chunk
+void hpaEndpointDistances(HpaGraph *graph, int *distances, HpaChunk *chunk, int chunk_x, int chunk_z, Vector3 position)
+{
+    floodHpaChunk(graph, chunk_x, chunk_z, position);
+    for (int i = 0; i < chunk->entrance_count; i++)
+    {
+        distances[i] = hpaFloodDistance(graph, chunk_x, chunk_z, chunk->entrances[i]);
+    }
+}
+
+void appendHpaPath(HpaGraph *graph, Vector3 *steps, size_t count)
+{
+    if (graph->path_length + count > graph->path_capacity)
+    {
+        graph->path_capacity = (graph->path_length + count) * 2;
+        graph->path = realloc(graph->path, graph->path_capacity * sizeof(Vector3));
+    }
+    memcpy(&graph->path[graph->path_length], steps, count * sizeof(Vector3));
+    graph->path_length += count;
+}
+
+// Finds a path through the entrance graph, then refines it into single steps.
+// Returns the number of steps in graph->path, start and goal included, or 0 if there is no path.
+size_t hpaFindPath(HpaGraph *graph, Vector3 start, Vector3 goal)
+{
+    Level *level = graph->level;
+    graph->path_length = 0;
+    if (!cellIsWalkable(start, level) || !cellIsWalkable(goal, level)) return 0;
+
+    // short paths are quicker to find directly
+    if (aStarHeuristic(start, goal) <= HPA_DIRECT_SEARCH_DISTANCE && aStarPathFind(start, goal, &graph->local_search, level))
+    {
+        appendHpaPath(graph, graph->local_search.path, graph->local_search.path_length);
+        return graph->path_length;
+    }
+
+    int start_chunk_x = start.x / LEVEL_CHUNK_SIZE, start_chunk_z = start.z / LEVEL_CHUNK_SIZE;
+    int goal_chunk_x = goal.x / LEVEL_CHUNK_SIZE, goal_chunk_z = goal.z / LEVEL_CHUNK_SIZE;
+    HpaChunk *start_chunk = getHpaChunk(graph, start_chunk_x, start_chunk_z);
+    HpaChunk *goal_chunk = getHpaChunk(graph, goal_chunk_x, goal_chunk_z);
+    int most_entrances = (start_chunk->entrance_count > goal_chunk->entrance_count) ? start_chunk->entrance_count : goal_chunk->entrance_count;
+    if (most_entrances > graph->endpoint_capacity)
+    {
+        graph->endpoint_capacity = most_entrances * 2;
+        graph->start_distances = realloc(graph->start_distances, graph->endpoint_capacity * sizeof(int));
+        graph->goal_distances = realloc(graph->goal_distances, graph->endpoint_capacity * sizeof(int));
+    }
+    int *start_distances = graph->start_distances, *goal_distances = graph->goal_distances;
+    hpaEndpointDistances(graph, start_distances, start_chunk, start_chunk_x, start_chunk_z, start);
+    hpaEndpointDistances(graph, goal_distances, goal_chunk, goal_chunk_x, goal_chunk_z, goal);
+    // the flood from the goal is still around, which covers walking straight there when both are in one chunk
+    int direct_distance = (start_chunk == goal_chunk) ? hpaFloodDistance(graph, goal_chunk_x, goal_chunk_z, start) : HPA_UNREACHABLE;
+
+    SearchData *search_data = &graph->abstract_search;
+    resetSearchData(search_data);
+    AStarNode *start_node = getSearchNode(search_data, start);
+    int start_heuristic = aStarHeuristic(start, goal);
+    start_node->g_score = 0;
+    start_node->f_score = start_heuristic;
+    pushOpenNode(search_data, start_node, start_heuristic);
+
+    AStarNode *goal_node = NULL;
+    Heap *heap = &search_data->open_f_min_heap;
+    while (heap->count && !goal_node)
+    {
+        AStarNode *current = heap->pairs[0].value;
+        minHeapify(heap);
+        if (current->closed) continue;
+        current->closed = 1;
+
+        Vector3 position = current->node_position;
+        if (position.x == goal.x && position.y == goal.y && position.z == goal.z)
+        {
+            goal_node = current;
+            break;
+        }
+        int ok = 1;
+        if (current == start_node)
+        {
+            for (int i = 0; i < start_chunk->entrance_count && ok; i++)
+            {
+                ok = relaxHpaNode(graph, current, start_chunk->entrances[i], start_distances[i], goal);
+            }
+            if (ok) ok = relaxHpaNode(graph, current, goal, direct_distance, goal);
+        }
+        int chunk_x = position.x / LEVEL_CHUNK_SIZE, chunk_z = position.z / LEVEL_CHUNK_SIZE;
+        HpaChunk *chunk = getHpaChunk(graph, chunk_x, chunk_z);
+        int index = findHpaEntrance(chunk, position);
+        if (index >= 0)
+        {
+            for (int j = 0; j < chunk->entrance_count && ok; j++)
+            {
+                if (j != index) ok = relaxHpaNode(graph, current, chunk->entrances[j], chunk->distances[index * chunk->entrance_count + j], goal);
+            }
+            for (int j = 0; j < chunk->link_count && ok; j++)
+            {
+                if (chunk->links[j].entrance == index) ok = relaxHpaNode(graph, current, chunk->links[j].target, 1, goal);
+            }
+            if (chunk == goal_chunk && ok) ok = relaxHpaNode(graph, current, goal, goal_distances[index], goal);
+        }
+        if (!ok) return 0;
+    }
+    if (!goal_node) return 0;
+
+    // now turn each hop between entrances into actual steps
+    aStarBuildPath(search_data, goal_node);
+    appendHpaPath(graph, &start, 1);
+    for (size_t i = 0; i + 1 < search_data->path_length; i++)
+    {
+        Vector3 from = search_data->path[i];
+        Vector3 to = search_data->path[i + 1];
+        int chunk_x = from.x / LEVEL_CHUNK_SIZE, chunk_z = from.z / LEVEL_CHUNK_SIZE;
+        if (chunk_x != to.x / LEVEL_CHUNK_SIZE || chunk_z != to.z / LEVEL_CHUNK_SIZE)
+        {
+            // crossing a border is always a single step
+            appendHpaPath(graph, &to, 1);
+            continue;
+        }
+        Vector3 bounds_min = { chunk_x * LEVEL_CHUNK_SIZE, 0, chunk_z * LEVEL_CHUNK_SIZE };
+        Vector3 bounds_max = { bounds_min.x + LEVEL_CHUNK_SIZE, level->size.y, bounds_min.z + LEVEL_CHUNK_SIZE };
+        if (!aStarPathFindBounded(from, to, bounds_min, bounds_max, &graph->local_search, level)) return graph->path_length = 0;
+        appendHpaPath(graph, graph->local_search.path + 1, graph->local_search.path_length - 1);
+    }
+    return graph->path_length;
+}
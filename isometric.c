@@ -7,20 +7,35 @@
 #include "level.h"
 #include "textures_generated.h"
 #include "HashTable.h"
+#include "entity_store.h"
 #include "entity.h"
 #include "components.h"
 #include "text_cache.h"
 #include "math_utils.h"
 #include "draw_level.h"
+#include "path_service.h"
+#include "level_saver.h"
+#include "simulation.h"
+#include "frame_pacing.h"
+#include "trace.h"
+#include "trace_overlay.h"
 
 #define SCROLL_COOLDOWN 100
 #define FRAME_MILISECONDS 20
 #define TEXT_CACHE_SIZE 100
+#define PATH_QUEUE_SIZE 1024
+#define MAX_PATH_LENGTH 512
+#define MAX_PATH_SEARCH_NODES (1 << 16)
+#define AUTOSAVE_MILISECONDS 5000
 
 int camera_position_x, camera_position_y; // the top left corner of the viewport
 int render_scale = 2;
 int on_screen_tiles = 16;
-HashTable entity_by_location = { 0 };
+SpatialGrid entity_by_location = { 0 };
+EntityStore entity_store;
+PathService path_service;
+LevelSaver level_saver;
+TerrainCache terrain_cache;
 
 typedef struct 
 {
@@ -33,29 +48,28 @@ typedef struct
 
 int editor_selected_tile = AIR_TILE;
 
+// Nothing asks for paths that it can't do without yet, so for now the ones that fail are just counted,
+// and the counts go out with the once a second frame stats
+typedef struct PathResultCounts
+{
+    uint32_t not_found, truncated;
+} PathResultCounts;
 
-int periodicLogAverage(uint32_t value, uint32_t period, uint32_t *sum, uint32_t *count, uint32_t *last_print_time)
+void handlePathResult(PathResult *result, void *context)
 {
-    uint32_t ticks = SDL_GetTicks();
-    if (ticks - *last_print_time >= period)
-    {
-        printf("%f\n", (double)(*sum + value) / (double)(*count + 1));
-        *count = 0;
-        *sum = 0;
-        *last_print_time = ticks;
-        return 1;
-    }
-    else
-    {
-        *sum += value;
-        (*count)++;
-        return 0;
-    }
+    PathResultCounts *counts = context;
+    if (!result->found) counts->not_found++;
+    else if (result->truncated) counts->truncated++;
 }
 
-uint32_t start_time;
+// how long a frame should take in a pacing mode, vsync goes at the display's refresh rate
+int frameMicroseconds(int pacing_mode, SDL_DisplayMode display_mode)
+{
+    if (pacing_mode == FRAME_PACING_VSYNC && display_mode.refresh_rate > 0) return 1000000 / display_mode.refresh_rate;
+    return FRAME_MILISECONDS * 1000;
+}
 
-int main()
+int main(int argc, char **argv)
 {
     // All of that gross initialization code that always ends up at the start of main()
     SDL_Init(SDL_INIT_EVERYTHING);
@@ -72,34 +86,49 @@ int main()
         int maximum_dimension = (display_mode.w > display_mode.h) ? display_mode.w : display_mode.h;
         render_scale = maximum_dimension / (TILE_HALF_WIDTH_PX * on_screen_tiles);
     }
+    // frames are paced with a sleep then a spin unless -vsync or -uncapped says otherwise
+    int pacing_mode = FRAME_PACING_SLEEP_SPIN;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-vsync")) pacing_mode = FRAME_PACING_VSYNC;
+        else if (!strcmp(argv[i], "-uncapped")) pacing_mode = FRAME_PACING_UNCAPPED;
+    }
+    FramePacing frame_pacing = makeFramePacing(main_renderer, pacing_mode, frameMicroseconds(pacing_mode, display_mode));
     // This represents the size of the non-pixelated layer
     SDL_Rect ui_layer_rect = window_rect;
     window_rect.w /= render_scale;
     window_rect.h /= render_scale;
     // This texture is for the pixelated game layer
     SDL_Texture *game_window_texture = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, window_rect.w, window_rect.h);
-    screen_grid_width = (window_rect.w + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
-    screen_grid_height = (window_rect.h + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
-    screen_grid = malloc(screen_grid_width * screen_grid_height * sizeof(uint64_t));
 
     // We will use these values later when drawing
     SDL_QueryTexture(tile_textures[GRASS_TILE], NULL, NULL, &texture_width, &texture_height);
+    terrain_cache = makeTerrainCache(texture_width, texture_height);
 
     // Now initialize a level
     Level current_level;
     if (!loadLevel(&current_level, "level0"))
     {
         // if the file does not exist, create a blank level
-        current_level.size.x = 128;
-        current_level.size.y = 6;
-        current_level.size.z = 128;
-        current_level.tiles = calloc(current_level.size.x * current_level.size.y * current_level.size.z, 1);
+        createLevel(&current_level, (Vector3) { 128, 6, 128 });
+    }
+
+    // Pathfinding runs on its own threads, one per spare core
+    if (!createPathService(&path_service, &current_level, 0, PATH_QUEUE_SIZE, MAX_PATH_LENGTH, MAX_PATH_SEARCH_NODES))
+    {
+        puts("couldn't start the path finding threads");
+        return 1;
     }
+    // and so does working out what drawLevel's tile pass has to look at
+    if (!createDrawListBuilder(&draw_list_builder, -1)) printf("couldn't start all of the draw list threads, using %d\n", draw_list_builder.worker_count - 1);
+
+    // Edits are saved in the background, every AUTOSAVE_MILISECONDS and on the way out
+    createLevelSaver(&level_saver, &current_level, "level0");
+    uint32_t last_autosave = SDL_GetTicks();
 
-    // Initialize the hash table
-    entity_by_location.len = MAX_ENTITIES;
-    entity_by_location.items = calloc(entity_by_location.len, sizeof(HashItem *));
-    makePage(&entity_by_location.page, entity_by_location.len, sizeof(HashItem));
+    // Initialize the spatial index, it covers the same cells as the level
+    createSpatialGrid(&entity_by_location, current_level.size);
+    createEntityStore(&entity_store, 128);
 
     // Setup input stuff
     int mouse_x, mouse_y, last_mouse_x, last_mouse_y;
@@ -109,26 +138,32 @@ int main()
 
     // Initialize the entities for the editor mode
     PlacementCursor editor_cursor = { AIR_TILE };
-    Entity editor_cursor_entity = { 0 };
-    editor_cursor_entity.type = ENTITY_EDITOR_CURSOR;
-    editor_cursor_entity.draw_on_top = 0;
-    editor_cursor_entity.draw = drawEditorCursor;
-    editor_cursor_entity.specific_data = &editor_cursor;
-    editor_cursor_entity.texture_data = &entity_texture_data[entity_texture_data_count++];
-    editor_cursor_entity.texture_data->temporary_frame_buffer = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
-    SDL_SetTextureBlendMode(editor_cursor_entity.texture_data->temporary_frame_buffer, SDL_BLENDMODE_BLEND);
+    EntityHandle editor_cursor_entity = createEntity(&entity_store);
     {
+        uint32_t index = entityIndex(&entity_store, editor_cursor_entity);
+        entity_store.types[index] = ENTITY_EDITOR_CURSOR;
+        entity_store.draw_on_top[index] = 0;
+        entity_store.draw[index] = drawEditorCursor;
+        entity_store.specific_data[index] = &editor_cursor;
+        TextureData *texture_data = entity_store.texture_data[index] = newEntityTextureData();
+        texture_data->temporary_frame_buffer = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
+        SDL_SetTextureBlendMode(texture_data->temporary_frame_buffer, SDL_BLENDMODE_BLEND);
         Vector3 size = { TILE_HALF_WIDTH_PX - 1, TILE_HEIGHT_PX - 1, TILE_HALF_WIDTH_PX - 1 };
-        addEntity(&editor_cursor_entity, screenToEntity(mouse_x, mouse_y, camera_position_x, camera_position_y, 0), size, &entity_by_location, &current_level);
+        addEntity(&entity_store, editor_cursor_entity, screenToEntity(mouse_x, mouse_y, camera_position_x, camera_position_y, 0), size, &entity_by_location);
     }
 
     PlacementCursor dummy_cursor = { AIR_TILE };
-    Entity dummy_entity = { .type = ENTITY_EDITOR_CURSOR, .draw_on_top = 0, .draw = drawEditorCursor, .specific_data = &dummy_cursor, .texture_data = &entity_texture_data[entity_texture_data_count++] };
-    dummy_entity.texture_data->temporary_frame_buffer = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
-    SDL_SetTextureBlendMode(dummy_entity.texture_data->temporary_frame_buffer, SDL_BLENDMODE_BLEND);
+    EntityHandle dummy_entity = createEntity(&entity_store);
     {
+        uint32_t index = entityIndex(&entity_store, dummy_entity);
+        entity_store.types[index] = ENTITY_EDITOR_CURSOR;
+        entity_store.draw[index] = drawEditorCursor;
+        entity_store.specific_data[index] = &dummy_cursor;
+        TextureData *texture_data = entity_store.texture_data[index] = newEntityTextureData();
+        texture_data->temporary_frame_buffer = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, texture_width, texture_height);
+        SDL_SetTextureBlendMode(texture_data->temporary_frame_buffer, SDL_BLENDMODE_BLEND);
         Vector3 size = { TILE_HALF_WIDTH_PX - 1, TILE_HEIGHT_PX - 1, TILE_HALF_WIDTH_PX - 1 };
-        addEntity(&dummy_entity, addVector3(worldToEntityPosition((Vector3) { 10, 2, 10}), (Vector3) {64, 0, 0}), size, &entity_by_location, &current_level);
+        addEntity(&entity_store, dummy_entity, addVector3(worldToEntityPosition((Vector3) { 10, 2, 10}), (Vector3) {64, 0, 0}), size, &entity_by_location);
     }
 
     TTF_Init();
@@ -136,12 +171,22 @@ int main()
     default_font = TTF_OpenFont("./Renogare-Regular.ttf", 100);
     if (!default_font) puts("error loading font");
     char position_string_buf[20];
-    // logging variables
-    uint32_t ticks_log_sum, ticks_log_count, ticks_last_print;
+    // the frame times get printed every second, and shown with F2, F5 switches pacing modes
+    char frame_pacing_string[MAX_STRING_SIZE] = "";
+    uint32_t last_frame_pacing_print = SDL_GetTicks();
+    PathResultCounts path_result_counts = { 0 };
+    int show_frame_pacing = 0;
+    // the game ticks at its own fixed rate, and frames are drawn between the last two ticks
+    Simulation simulation = makeSimulation();
+#ifdef TRACING
+    // F3 shows the zones of the last frame, F4 writes everything traced so far to trace.json
+    int show_trace_overlay = 0;
+#endif
     for (;;)
     {
         // We want to reach a fixed frame rate, so we need to time the rendering 
-        start_time = SDL_GetTicks();
+        TRACE_BEGIN(frame);
+        TRACE_BEGIN(input);
         last_user_input = user_input;
         last_mouse_x = mouse_x;
         last_mouse_y = mouse_y;
@@ -152,7 +197,17 @@ int main()
             switch (user_event.type)
             {
             case SDL_QUIT:
-                saveLevel(&current_level, "level0");
+                destroyPathService(&path_service);
+                destroyLevelSaver(&level_saver, &current_level);
+                freeSimulation(&simulation);
+                freeTerrainCache(&terrain_cache);
+                freeTileBatch(&tile_batch);
+                freeEntityDrawOrder(&entity_draw_order);
+                freeFlatHashTable(&stamped_pairs);
+                freeScreenGrid(&screen_grid);
+                freeFrameArena(&draw_level_arena);
+                freeEntityTextureData();
+                destroyDrawListBuilder(&draw_list_builder);
                 SDL_DestroyRenderer(main_renderer);
                 SDL_DestroyWindow(main_window);
                 exit(0);
@@ -169,8 +224,11 @@ int main()
                 // Place tile   
                 case SDL_BUTTON_RIGHT:
                 {
-                    Vector3 world_position = entityToWorldPosition(editor_cursor_entity.position);
+                    Vector3 world_position = entityToWorldPosition(entityPosition(&entity_store, editor_cursor_entity));
+                    // the path workers read the level without locking it
+                    pausePathService(&path_service);
                     setTileAt(editor_cursor.tile_id, world_position, &current_level);
+                    resumePathService(&path_service);
                     printf("placed block at: %d %d %d\n", world_position.x, world_position.y, world_position.z);
                 }
                 break;
@@ -194,7 +252,7 @@ int main()
                 {
                     if (user_event.wheel.y > 0)
                     {
-                        if (tile_textures[editor_cursor.tile_id + 1])
+                        if ((editor_cursor.tile_id < 255) && tile_textures[editor_cursor.tile_id + 1])
                         {
                             editor_cursor.tile_id++;
                         }
@@ -230,6 +288,33 @@ int main()
                     user_input.cycle_editor_mode = 1;
                     break;
                 }
+                case SDLK_F2:
+                {
+                    show_frame_pacing = !show_frame_pacing;
+                    break;
+                }
+                case SDLK_F5:
+                {
+                    // skip over modes the renderer can't do
+                    int mode = frame_pacing.mode;
+                    do mode = (mode + 1) % FRAME_PACING_MODE_COUNT;
+                    while (!setFramePacingMode(&frame_pacing, main_renderer, mode, frameMicroseconds(mode, display_mode)));
+                    printf("frame pacing: %s\n", frame_pacing_mode_names[frame_pacing.mode]);
+                    break;
+                }
+#ifdef TRACING
+                case SDLK_F3:
+                {
+                    show_trace_overlay = !show_trace_overlay;
+                    break;
+                }
+                case SDLK_F4:
+                {
+                    if (writeChromeTrace("trace.json")) puts("wrote trace.json");
+                    else puts("couldn't write trace.json");
+                    break;
+                }
+#endif
                 }
                 break;
             }
@@ -261,12 +346,6 @@ int main()
                 {
                 case SDL_WINDOWEVENT_SIZE_CHANGED:
                 {
-                    if ((user_event.window.data1 + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX != screen_grid_width || (user_event.window.data2 + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX)
-                    {
-                        screen_grid_width = (user_event.window.data1 + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
-                        screen_grid_height = (user_event.window.data2 + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
-                        screen_grid = realloc(screen_grid, screen_grid_width * screen_grid_height * sizeof(uint64_t));
-                    }
                     window_rect = (SDL_Rect) { 0, 0, user_event.window.data1, user_event.window.data2 };
                     {
                         int maximum_dimension = (window_rect.w > window_rect.h) ? window_rect.w : window_rect.h;
@@ -280,35 +359,40 @@ int main()
                 }
                 break;
                 }
+                break;
+            }
+            // some renderers lose what was drawn to target textures, like when the window goes fullscreen
+            case SDL_RENDER_TARGETS_RESET:
+            {
+                invalidateTerrainCache(&terrain_cache);
+                invalidateEntityFrameBuffers();
+                break;
             }
             }
         }
 
-        // clear the screen grid
-        memset(screen_grid, 0, screen_grid_width * screen_grid_height * sizeof(uint64_t));
-
         // now do actions associated with each input
+        Vector3 cursor_position = entityPosition(&entity_store, editor_cursor_entity);
         if (user_input.decrease_level && !last_user_input.decrease_level)
         {
-            if (editor_cursor_entity.position.y >= TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER) 
+            if (cursor_position.y >= TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER) 
             {
-                Vector3 new_cursor_pos = editor_cursor_entity.position;
-                new_cursor_pos.y -= TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER;
-                moveEntity(&editor_cursor_entity, new_cursor_pos, &entity_by_location, &current_level);
+                cursor_position.y -= TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER;
+                moveEntity(&entity_store, editor_cursor_entity, cursor_position, &entity_by_location);
             }
         }
         if (user_input.increase_level && !last_user_input.increase_level)
         {
-            if (editor_cursor_entity.position.y < (current_level.size.y - 1) * TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER)
+            if (cursor_position.y < (current_level.size.y - 1) * TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER)
             {
-                Vector3 new_cursor_pos = editor_cursor_entity.position;
-                new_cursor_pos.y += TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER;
-                moveEntity(&editor_cursor_entity, new_cursor_pos, &entity_by_location, &current_level);
+                cursor_position.y += TILE_HEIGHT_PX * ENTITY_POSITION_MULTIPLIER;
+                moveEntity(&entity_store, editor_cursor_entity, cursor_position, &entity_by_location);
             }
         }
+        uint8_t *cursor_draw_on_top = &entity_store.draw_on_top[entityIndex(&entity_store, editor_cursor_entity)];
         if (user_input.cycle_editor_mode && !last_user_input.cycle_editor_mode)
         {
-            editor_cursor_entity.draw_on_top = !editor_cursor_entity.draw_on_top;
+            *cursor_draw_on_top = !*cursor_draw_on_top;
         }
         // do panning
         if (user_input.pan)
@@ -319,42 +403,84 @@ int main()
         // now move the cursor entity
         {
             // if the draw_on_top property is set to true, that sprite should be grid-locked to avoid spoiling the 3d effect
-            if (editor_cursor_entity.draw_on_top)
+            if (*cursor_draw_on_top)
             {
-                Vector3 cursor_world = screenToWorld(mouse_x / render_scale, mouse_y / render_scale - editor_cursor_entity.position.y,
-                        camera_position_x, camera_position_y, editor_cursor_entity.position.y / TILE_HEIGHT_PX);
-                cursor_world.y = editor_cursor_entity.position.y / (ENTITY_POSITION_MULTIPLIER * TILE_HEIGHT_PX);
-                moveEntity(&editor_cursor_entity, worldToEntityPosition(cursor_world), &entity_by_location, &current_level);
+                Vector3 cursor_world = screenToWorld(mouse_x / render_scale, mouse_y / render_scale - cursor_position.y,
+                        camera_position_x, camera_position_y, cursor_position.y / TILE_HEIGHT_PX);
+                cursor_world.y = cursor_position.y / (ENTITY_POSITION_MULTIPLIER * TILE_HEIGHT_PX);
+                moveEntity(&entity_store, editor_cursor_entity, worldToEntityPosition(cursor_world), &entity_by_location);
             }
             else
             {
-                moveEntity(&editor_cursor_entity, screenToEntity(mouse_x / render_scale - TILE_HALF_WIDTH_PX, mouse_y / render_scale - TILE_HALF_DEPTH_PX - editor_cursor_entity.position.y / ENTITY_POSITION_MULTIPLIER,
-                        camera_position_x, camera_position_y, editor_cursor_entity.position.y), &entity_by_location, &current_level);
+                moveEntity(&entity_store, editor_cursor_entity, screenToEntity(mouse_x / render_scale - TILE_HALF_WIDTH_PX, mouse_y / render_scale - TILE_HALF_DEPTH_PX - cursor_position.y / ENTITY_POSITION_MULTIPLIER,
+                        camera_position_x, camera_position_y, cursor_position.y), &entity_by_location);
             }
         }
+        TRACE_END(input);
+
+        // The input above moves things as soon as it comes in, the rest of the game goes a tick at a time
+        TRACE_BEGIN(simulation);
+        for (int ticks = simulationTicksDue(&simulation); ticks > 0; ticks--)
+        {
+            pollPathResults(&path_service, handlePathResult, &path_result_counts);
 
+            if (SDL_GetTicks() - last_autosave >= AUTOSAVE_MILISECONDS)
+            {
+                queueLevelSave(&level_saver, &current_level);
+                last_autosave = SDL_GetTicks();
+            }
+            endSimulationTick(&simulation, &entity_store);
+        }
+        TRACE_END(simulation);
+
+        beginInterpolatedDraw(&simulation, &entity_store);
         drawLevel(main_renderer, current_level, game_window_texture, camera_position_x, camera_position_y);
+        endInterpolatedDraw(&simulation, &entity_store);
         SDL_RenderCopy(main_renderer, game_window_texture, NULL, &ui_layer_rect);
 
         // UI stuff
         {
             memset(position_string_buf, 0, sizeof(position_string_buf));
             SDL_itoa(mouse_x / render_scale, position_string_buf, 10);
+            TRACE_BEGIN(getTextureFromString);
             SDL_Texture *text = getTextureFromString(main_renderer, &text_cache, position_string_buf, default_font);
+            TRACE_END(getTextureFromString);
             int text_width, text_height;
             SDL_QueryTexture(text, NULL, NULL, &text_width, &text_height);
             SDL_RenderCopy(main_renderer, text, NULL, &(SDL_Rect) { (ui_layer_rect.w - text_width) / 2, ui_layer_rect.h - text_height, text_width, text_height });
         }
 
+#ifdef TRACING
+        if (show_trace_overlay)
+        {
+            SDL_Rect overlay_rect = { 0, 0, ui_layer_rect.w, ui_layer_rect.h / 4 };
+            drawTraceOverlay(main_renderer, &text_cache, default_font, overlay_rect, frame_pacing.frame_length);
+        }
+#endif
+        if (show_frame_pacing)
+        {
+            SDL_Rect overlay_rect = { 0, ui_layer_rect.h * 3 / 4, ui_layer_rect.w / 2, ui_layer_rect.h / 4 };
+            drawFramePacingOverlay(main_renderer, &frame_pacing, &text_cache, default_font, frame_pacing_string, overlay_rect);
+        }
+
+        TRACE_BEGIN(SDL_RenderPresent);
         SDL_RenderPresent(main_renderer);
+        TRACE_END(SDL_RenderPresent);
         SDL_SetRenderDrawColor(main_renderer, 255, 255, 255, 255);
         SDL_RenderClear(main_renderer);
+        TRACE_END(frame);
 
-        uint32_t diff_time = SDL_GetTicks() - start_time;
-        if (diff_time < FRAME_MILISECONDS)
+        paceFrame(&frame_pacing);
+        if (SDL_GetTicks() - last_frame_pacing_print >= 1000)
         {
-            periodicLogAverage(diff_time, 1000, &ticks_log_sum, &ticks_log_count, &ticks_last_print);
-            SDL_Delay(FRAME_MILISECONDS - diff_time);
+            formatFramePacingStats(&frame_pacing, frame_pacing_string, sizeof(frame_pacing_string));
+            puts(frame_pacing_string);
+            if (path_result_counts.not_found || path_result_counts.truncated)
+            {
+                printf("paths: %u not found, %u cut off\n", path_result_counts.not_found, path_result_counts.truncated);
+                path_result_counts = (PathResultCounts) { 0 };
+            }
+            last_frame_pacing_print = SDL_GetTicks();
         }
     }
 }
\ No newline at end of file
@@ -2,116 +2,1106 @@
 #include "vector.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define TILE_HALF_WIDTH_PX 16
 #define TILE_HALF_DEPTH_PX TILE_HALF_WIDTH_PX / 2
 #define TILE_HEIGHT_PX 18
-#define CELL_HAS_ENTITY_FLAG 0x80
+#define LEVEL_CHUNK_BITS 4
+#define LEVEL_CHUNK_SIZE (1 << LEVEL_CHUNK_BITS)
+#define LEVEL_CHUNK_VOLUME (LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE)
+#define LEVEL_PALETTE_MAX 16
 
+#define LEVEL_FILE_MAGIC "ISOL"
+#define LEVEL_FILE_VERSION 1
+#define LEVEL_JOURNAL_MAGIC "ISOJ"
+// chunk data in the file starts on multiples of this
+#define LEVEL_FILE_ALIGNMENT 64
+
+enum
+{
+    // a chunk of a level file that hasn't been touched yet, it is checked and set up on first access
+    LEVEL_CHUNK_UNLOADED,
+    // every tile in the chunk is the same, and tiles points at a shared block of that tile
+    LEVEL_CHUNK_UNIFORM,
+    // up to LEVEL_PALETTE_MAX different tiles, each cell is a palette_bits wide index into palette
+    LEVEL_CHUNK_PALETTE,
+    // tiles points at the chunk's own LEVEL_CHUNK_VOLUME tiles
+    LEVEL_CHUNK_DENSE
+};
+
+typedef struct LevelChunk
+{
+    // NULL for palette chunks, which have to be decoded
+    uint8_t *tiles;
+    uint8_t *indices;
+    uint8_t palette[LEVEL_PALETTE_MAX];
+    uint8_t palette_count;
+    // 1, 2 or 4
+    uint8_t palette_bits;
+    // Chunks can be loaded by any thread that reads them, so kind is stored last with release once
+    // the rest is set up, and tiles and the palette are only looked at after it's read as loaded
+    _Atomic uint8_t kind;
+    // tiles or indices point into the level file's mapping rather than their own allocation
+    uint8_t mapped;
+} LevelChunk;
+
+// Level files start with a header, followed by a directory entry for every chunk, in the same
+// order as Level.chunks, followed by the chunk data. The file is mapped rather than read, and
+// a chunk's entry is only looked at the first time one of its tiles is, so opening a level
+// costs the same whatever its size, and only the parts that get used are ever paged in.
+typedef struct LevelFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    Vector3 size;
+    Vector3 start_positions[3];
+    uint32_t chunk_total;
+    // goes up by one with every save, a journal only applies to the file with the same generation
+    uint32_t generation;
+} LevelFileHeader;
+
+typedef struct LevelFileChunk
+{
+    // from the start of the file, uniform chunks have no data
+    uint64_t offset;
+    // covers the chunk's data and the rest of this entry, with the checksum taken as 0
+    uint32_t checksum;
+    uint8_t kind;
+    uint8_t palette_count;
+    uint8_t palette_bits;
+    uint8_t padding;
+    uint8_t palette[LEVEL_PALETTE_MAX];
+} LevelFileChunk;
+
+// Edits since the last full save are appended to a journal next to the level file, path.journal.
+// It has a header, then records of whole chunks, each a LevelJournalRecord followed by the chunk's data
+// padded to 8 bytes. Records are replayed in order on load, so the last one for a chunk wins, and
+// replaying stops at the first record that doesn't check out, which is where a write got cut off.
+// Old level files and missing ones count as generation 0.
+typedef struct LevelJournalHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t generation;
+    Vector3 size;
+} LevelJournalHeader;
+
+typedef struct LevelJournalRecord
+{
+    uint32_t chunk_index;
+    uint32_t padding;
+    // offset isn't used, the data follows right after
+    LevelFileChunk chunk;
+} LevelJournalRecord;
+
+// The tiles are stored in cubes of LEVEL_CHUNK_SIZE tiles on each side, so memory goes with what
+// is in the level rather than its size: a chunk that is all one tile (usually air) costs nothing,
+// and one with only a few kinds of tiles is stored as small indices into a palette.
+// Only chunks with lots of different tiles get a plain array.
 typedef struct Level
 {
     Vector3 size;
-    char *tiles;
+    LevelChunk *chunks;
     Vector3 start_positions[3];
     
     // TODO: number of enemies and such
     uint32_t entities_count;
+
+    // setTileAt bumps the revision of a chunk whenever one of its tiles changes. Anything cached
+    // from the tiles can remember the revisions it was built from to know when it has gone stale.
+    Vector3 chunk_count;
+    uint32_t *chunk_revisions;
+
+    // Which cells have a tile that isn't air, one bit per cell, so drawLevel can go from tile to tile
+    // without looking at the air in between. The bits go in rows along the q-bert diagonals drawLevel
+    // walks, one row for each height y and each d = x + z, holding the cells of that diagonal in order
+    // of x. Each row starts on a new word, at diagonal_row_offsets[d] words into its layer, so checking
+    // a row goes 64 cells at a time. The bits of a chunk are only filled in once something asks for
+    // them with prepareLevelSolidity, so big levels don't have to load every chunk up front, and
+    // setTileAt keeps them up to date from then on.
+    // Like setTileAt, this belongs to the main thread.
+    uint32_t *diagonal_row_offsets;
+    size_t diagonal_layer_words;
+    uint64_t *solid_cells;
+    uint8_t *chunk_solid_ready;
+
+    // setTileAt marks the chunks it changes as dirty and lists them, until a save picks them up
+    uint8_t *chunk_dirty;
+    uint32_t *dirty_chunks;
+    size_t dirty_chunk_count;
+
+    // the level file this was loaded from, if any, and its directory of chunks
+    char *file_map;
+    size_t file_map_size;
+    LevelFileChunk *file_directory;
+    uint32_t file_generation;
 } Level;
 
-int setFlagAt(Vector3 position, Level *level)
+// Chunks can be loaded by whichever thread reads them first. That happens rarely enough that one
+// lock for all levels will do, and it keeps working when a Level is passed around by value.
+atomic_flag level_load_lock = ATOMIC_FLAG_INIT;
+
+// one block of LEVEL_CHUNK_VOLUME copies of each tile value, made the first time a uniform chunk needs it
+// and shared by every uniform chunk of every level from then on
+_Atomic(uint8_t *) level_uniform_blocks[256];
+
+uint8_t *getUniformBlock(uint8_t tile)
 {
-    if (position.x >= 0 && position.x < level->size.x
-    && position.y >= 0 && position.y < level->size.y
-    && position.z >= 0 && position.z < level->size.z)
+    _Atomic(uint8_t *) *slot = &level_uniform_blocks[tile];
+    uint8_t *block = atomic_load(slot);
+    if (block) return block;
+    // chunks can be loaded from more than one thread, so whoever gets here first wins
+    uint8_t *new_block = malloc(LEVEL_CHUNK_VOLUME);
+    memset(new_block, tile, LEVEL_CHUNK_VOLUME);
+    if (atomic_compare_exchange_strong(slot, &block, new_block)) return new_block;
+    free(new_block);
+    return block;
+}
+
+size_t levelChunkIndex(Vector3 position, Level *level)
+{
+    return (position.x >> LEVEL_CHUNK_BITS) + (position.z >> LEVEL_CHUNK_BITS) * level->chunk_count.x
+        + (size_t)(position.y >> LEVEL_CHUNK_BITS) * level->chunk_count.x * level->chunk_count.z;
+}
+
+// where a cell is inside its chunk, y varies fastest like it used to in the flat array
+int levelChunkCellIndex(Vector3 position)
+{
+    int mask = LEVEL_CHUNK_SIZE - 1;
+    return (position.y & mask) | (position.x & mask) << LEVEL_CHUNK_BITS | (position.z & mask) << (2 * LEVEL_CHUNK_BITS);
+}
+
+uint8_t decodePaletteTile(LevelChunk *chunk, int cell)
+{
+    int bit = cell * chunk->palette_bits;
+    return chunk->palette[(chunk->indices[bit >> 3] >> (bit & 7)) & ((1 << chunk->palette_bits) - 1)];
+}
+
+size_t levelChunkTotal(Level *level)
+{
+    return (size_t)level->chunk_count.x * level->chunk_count.y * level->chunk_count.z;
+}
+
+// length is a multiple of 8
+uint32_t levelChecksum(const void *data, size_t length, uint64_t seed)
+{
+    const char *bytes = data;
+    uint64_t hash = seed ^ length;
+    for (size_t i = 0; i < length; i += 8)
     {
-        level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x] |= CELL_HAS_ENTITY_FLAG;
-        return 1;
-    } else return 0;
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return (uint32_t)hash;
 }
 
-int clearFlagAt(Vector3 position, Level *level)
+size_t levelFileChunkLength(uint8_t kind, uint8_t palette_bits)
 {
-    if (position.x >= 0 && position.x < level->size.x
-    && position.y >= 0 && position.y < level->size.y
-    && position.z >= 0 && position.z < level->size.z)
+    if (kind == LEVEL_CHUNK_DENSE) return LEVEL_CHUNK_VOLUME;
+    if (kind == LEVEL_CHUNK_PALETTE) return LEVEL_CHUNK_VOLUME * palette_bits / 8;
+    return 0;
+}
+
+uint32_t levelFileChunkChecksum(LevelFileChunk *entry, const char *data)
+{
+    LevelFileChunk header = *entry;
+    header.checksum = 0;
+    return levelChecksum(data, levelFileChunkLength(entry->kind, entry->palette_bits), levelChecksum(&header, sizeof(header), 0));
+}
+
+// only checks that the kind and palette make sense, not the data
+int levelFileChunkValid(LevelFileChunk *entry)
+{
+    return (entry->kind == LEVEL_CHUNK_UNIFORM && entry->palette_count == 1)
+        || (entry->kind == LEVEL_CHUNK_PALETTE && entry->palette_count > 1 && entry->palette_count <= LEVEL_PALETTE_MAX
+            && (entry->palette_bits == 1 || entry->palette_bits == 2 || entry->palette_bits == 4)
+            && entry->palette_count <= (1 << entry->palette_bits))
+        || entry->kind == LEVEL_CHUNK_DENSE;
+}
+
+// Fills in an entry for a packed chunk, all but the offset and checksum, and returns the data to write after it
+char *describeLevelChunk(LevelChunk *packed, LevelFileChunk *entry)
+{
+    *entry = (LevelFileChunk) { .kind = packed->kind, .palette_count = packed->palette_count, .palette_bits = packed->palette_bits };
+    memcpy(entry->palette, packed->palette, LEVEL_PALETTE_MAX);
+    return (char *)((packed->kind == LEVEL_CHUNK_PALETTE) ? packed->indices : packed->tiles);
+}
+
+// Sets up a chunk from a checked entry and its data, either pointing at the data or copying it
+void setLevelChunkFromFile(LevelChunk *chunk, LevelFileChunk *entry, char *data, int copy)
+{
+    size_t length = levelFileChunkLength(entry->kind, entry->palette_bits);
+    if (copy && length)
     {
-        level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x] &= (char)~CELL_HAS_ENTITY_FLAG;
-        return 1;
-    } else return 0;
+        char *copied = malloc(length);
+        memcpy(copied, data, length);
+        data = copied;
+    }
+    memcpy(chunk->palette, entry->palette, LEVEL_PALETTE_MAX);
+    chunk->palette_count = entry->palette_count;
+    chunk->palette_bits = entry->palette_bits;
+    chunk->mapped = !copy && entry->kind != LEVEL_CHUNK_UNIFORM;
+    chunk->tiles = NULL;
+    chunk->indices = NULL;
+    if (entry->kind == LEVEL_CHUNK_UNIFORM) chunk->tiles = getUniformBlock(entry->palette[0]);
+    else if (entry->kind == LEVEL_CHUNK_DENSE) chunk->tiles = (uint8_t *)data;
+    else chunk->indices = (uint8_t *)data;
 }
 
-// remember to free the last level before running again
-int loadLevel(Level *level, const char *path)
+// Sets up an unloaded chunk from its directory entry, pointing straight into the mapping.
+// A chunk that fails its checks is replaced with air, so one bad chunk doesn't lose the whole level.
+void loadLevelChunk(Level *level, LevelChunk *chunk)
+{
+    while (atomic_flag_test_and_set_explicit(&level_load_lock, memory_order_acquire));
+    if (chunk->kind == LEVEL_CHUNK_UNLOADED)
+    {
+        size_t chunk_index = chunk - level->chunks;
+        LevelFileChunk entry = level->file_directory[chunk_index];
+        size_t length = levelFileChunkLength(entry.kind, entry.palette_bits);
+        int valid = levelFileChunkValid(&entry);
+        valid = valid && entry.offset <= level->file_map_size && length <= level->file_map_size - entry.offset;
+        char *data = valid ? level->file_map + entry.offset : NULL;
+        if (valid && levelFileChunkChecksum(&entry, data) != entry.checksum) valid = 0;
+        if (!valid)
+        {
+            printf("Level chunk %zu is corrupt, replacing it with air\n", chunk_index);
+            entry = (LevelFileChunk) { .kind = LEVEL_CHUNK_UNIFORM, .palette_count = 1 };
+        }
+
+        setLevelChunkFromFile(chunk, &entry, data, 0);
+        atomic_store_explicit(&chunk->kind, entry.kind, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&level_load_lock, memory_order_release);
+}
+
+void ensureLevelChunkLoaded(Level *level, LevelChunk *chunk)
+{
+    if (atomic_load_explicit(&chunk->kind, memory_order_acquire) == LEVEL_CHUNK_UNLOADED) loadLevelChunk(level, chunk);
+}
+
+uint8_t readLevelChunkTile(Level *level, LevelChunk *chunk, int cell)
+{
+    ensureLevelChunkLoaded(level, chunk);
+    return chunk->tiles ? chunk->tiles[cell] : decodePaletteTile(chunk, cell);
+}
+
+// kept small so it gets inlined, the palette decoding and loading stay out of line.
+// An unloaded chunk's tiles can be being set by another thread, so they're only used once it's loaded.
+uint8_t levelChunkTile(Level *level, LevelChunk *chunk, int cell)
+{
+    if (atomic_load_explicit(&chunk->kind, memory_order_acquire) != LEVEL_CHUNK_UNLOADED && chunk->tiles) return chunk->tiles[cell];
+    return readLevelChunkTile(level, chunk, cell);
+}
+
+void setPaletteIndex(LevelChunk *chunk, int cell, int index)
+{
+    int bit = cell * chunk->palette_bits;
+    uint8_t mask = ((1 << chunk->palette_bits) - 1) << (bit & 7);
+    chunk->indices[bit >> 3] = (chunk->indices[bit >> 3] & ~mask) | (index << (bit & 7));
+}
+
+void freeLevelChunk(LevelChunk *chunk)
+{
+    if (!chunk->mapped)
+    {
+        if (chunk->kind == LEVEL_CHUNK_DENSE) free(chunk->tiles);
+        free(chunk->indices);
+    }
+    chunk->tiles = NULL;
+    chunk->indices = NULL;
+    chunk->mapped = 0;
+}
+
+void makeUniformChunk(LevelChunk *chunk, uint8_t tile)
+{
+    freeLevelChunk(chunk);
+    chunk->kind = LEVEL_CHUNK_UNIFORM;
+    chunk->tiles = getUniformBlock(tile);
+    chunk->palette[0] = tile;
+    chunk->palette_count = 1;
+    chunk->palette_bits = 0;
+}
+
+// Replaces the chunk's contents with tiles, picking the smallest way to store them
+void packLevelChunk(LevelChunk *chunk, const uint8_t *tiles)
+{
+    uint8_t palette[LEVEL_PALETTE_MAX];
+    int palette_count = 0;
+    for (int i = 0; i < LEVEL_CHUNK_VOLUME && palette_count <= LEVEL_PALETTE_MAX; i++)
+    {
+        int found = 0;
+        for (int j = 0; j < palette_count; j++) found |= palette[j] == tiles[i];
+        if (found) continue;
+        if (palette_count < LEVEL_PALETTE_MAX) palette[palette_count] = tiles[i];
+        palette_count++;
+    }
+    if (palette_count == 1)
+    {
+        makeUniformChunk(chunk, tiles[0]);
+        return;
+    }
+    freeLevelChunk(chunk);
+    if (palette_count > LEVEL_PALETTE_MAX)
+    {
+        chunk->kind = LEVEL_CHUNK_DENSE;
+        chunk->tiles = malloc(LEVEL_CHUNK_VOLUME);
+        memcpy(chunk->tiles, tiles, LEVEL_CHUNK_VOLUME);
+        return;
+    }
+    chunk->kind = LEVEL_CHUNK_PALETTE;
+    memcpy(chunk->palette, palette, palette_count);
+    chunk->palette_count = palette_count;
+    chunk->palette_bits = (palette_count <= 2) ? 1 : (palette_count <= 4) ? 2 : 4;
+    chunk->indices = calloc(LEVEL_CHUNK_VOLUME * chunk->palette_bits / 8, 1);
+    for (int i = 0; i < LEVEL_CHUNK_VOLUME; i++)
+    {
+        int index = 0;
+        while (palette[index] != tiles[i]) index++;
+        setPaletteIndex(chunk, i, index);
+    }
+}
+
+void unpackLevelChunk(LevelChunk *chunk, uint8_t *tiles)
+{
+    if (chunk->tiles) memcpy(tiles, chunk->tiles, LEVEL_CHUNK_VOLUME);
+    else for (int i = 0; i < LEVEL_CHUNK_VOLUME; i++) tiles[i] = decodePaletteTile(chunk, i);
+}
+
+// copy has to be empty, the copy owns its storage
+void copyLevelChunk(LevelChunk *copy, LevelChunk *chunk)
+{
+    *copy = *chunk;
+    copy->mapped = 0;
+    if (chunk->kind == LEVEL_CHUNK_DENSE)
+    {
+        copy->tiles = malloc(LEVEL_CHUNK_VOLUME);
+        memcpy(copy->tiles, chunk->tiles, LEVEL_CHUNK_VOLUME);
+    }
+    else if (chunk->kind == LEVEL_CHUNK_PALETTE)
+    {
+        size_t length = LEVEL_CHUNK_VOLUME * chunk->palette_bits / 8;
+        copy->indices = malloc(length);
+        memcpy(copy->indices, chunk->indices, length);
+    }
+}
+
+// Writes one tile into a loaded chunk, changing how the chunk is stored if the tile doesn't fit.
+// Chunks only ever get less compressed here, compactLevel packs them back down.
+// Mapped chunks are written in place, the mapping is private so the file is left alone.
+void storeLevelChunkTile(LevelChunk *chunk, int cell, uint8_t tile)
+{
+    if (chunk->kind == LEVEL_CHUNK_DENSE)
+    {
+        chunk->tiles[cell] = tile;
+        return;
+    }
+    if (chunk->kind == LEVEL_CHUNK_UNIFORM)
+    {
+        if (chunk->palette[0] == tile) return;
+        chunk->kind = LEVEL_CHUNK_PALETTE;
+        chunk->tiles = NULL;
+        chunk->palette_bits = 1;
+        // every index starts out as 0, the old uniform tile
+        chunk->indices = calloc(LEVEL_CHUNK_VOLUME / 8, 1);
+    }
+    int index = 0;
+    while (index < chunk->palette_count && chunk->palette[index] != tile) index++;
+    if (index == chunk->palette_count)
+    {
+        if (index == LEVEL_PALETTE_MAX)
+        {
+            uint8_t tiles[LEVEL_CHUNK_VOLUME];
+            unpackLevelChunk(chunk, tiles);
+            freeLevelChunk(chunk);
+            chunk->kind = LEVEL_CHUNK_DENSE;
+            chunk->tiles = malloc(LEVEL_CHUNK_VOLUME);
+            memcpy(chunk->tiles, tiles, LEVEL_CHUNK_VOLUME);
+            chunk->tiles[cell] = tile;
+            return;
+        }
+        if (index == (1 << chunk->palette_bits))
+        {
+            // out of room in the indices, so widen them
+            uint8_t old_bits = chunk->palette_bits;
+            uint8_t *old_indices = chunk->indices;
+            chunk->palette_bits *= 2;
+            chunk->indices = calloc(LEVEL_CHUNK_VOLUME * chunk->palette_bits / 8, 1);
+            for (int i = 0; i < LEVEL_CHUNK_VOLUME; i++)
+            {
+                int bit = i * old_bits;
+                setPaletteIndex(chunk, i, (old_indices[bit >> 3] >> (bit & 7)) & ((1 << old_bits) - 1));
+            }
+            if (!chunk->mapped) free(old_indices);
+            chunk->mapped = 0;
+        }
+        chunk->palette[chunk->palette_count++] = tile;
+    }
+    setPaletteIndex(chunk, cell, index);
+}
+
+// every chunk starts out unloaded
+void allocateLevel(Level *level, Vector3 size)
+{
+    level->size = size;
+    level->chunk_count.x = (size.x + LEVEL_CHUNK_SIZE - 1) / LEVEL_CHUNK_SIZE;
+    level->chunk_count.y = (size.y + LEVEL_CHUNK_SIZE - 1) / LEVEL_CHUNK_SIZE;
+    level->chunk_count.z = (size.z + LEVEL_CHUNK_SIZE - 1) / LEVEL_CHUNK_SIZE;
+    level->chunks = calloc(levelChunkTotal(level), sizeof(LevelChunk));
+    level->chunk_revisions = calloc(levelChunkTotal(level), sizeof(uint32_t));
+    level->chunk_dirty = calloc(levelChunkTotal(level), sizeof(uint8_t));
+    level->dirty_chunks = malloc(levelChunkTotal(level) * sizeof(uint32_t));
+    level->dirty_chunk_count = 0;
+    int diagonal_count = size.x + size.z - 1;
+    level->diagonal_row_offsets = malloc(diagonal_count * sizeof(uint32_t));
+    level->diagonal_layer_words = 0;
+    for (int d = 0; d < diagonal_count; d++)
+    {
+        int row_start = (d > size.z - 1) ? d - (size.z - 1) : 0;
+        int row_end = (d < size.x - 1) ? d : size.x - 1;
+        level->diagonal_row_offsets[d] = level->diagonal_layer_words;
+        level->diagonal_layer_words += (row_end - row_start + 64) / 64;
+    }
+    level->solid_cells = calloc(level->diagonal_layer_words * size.y, sizeof(uint64_t));
+    level->chunk_solid_ready = calloc(levelChunkTotal(level), sizeof(uint8_t));
+    memset(level->start_positions, 0, sizeof(level->start_positions));
+    level->entities_count = 0;
+    level->file_map = NULL;
+    level->file_map_size = 0;
+    level->file_directory = NULL;
+    level->file_generation = 0;
+}
+
+// makes an empty level, filled with air
+void createLevel(Level *level, Vector3 size)
+{
+    allocateLevel(level, size);
+    for (size_t i = 0; i < levelChunkTotal(level); i++) makeUniformChunk(&level->chunks[i], 0);
+}
+
+void unmapLevelFile(Level *level)
+{
+    if (!level->file_map) return;
+#ifndef _WIN32
+    munmap(level->file_map, level->file_map_size);
+#else
+    free(level->file_map);
+#endif
+    level->file_map = NULL;
+    level->file_map_size = 0;
+    level->file_directory = NULL;
+}
+
+void freeLevel(Level *level)
+{
+    for (size_t i = 0; i < levelChunkTotal(level); i++) freeLevelChunk(&level->chunks[i]);
+    free(level->chunks);
+    free(level->chunk_revisions);
+    free(level->chunk_dirty);
+    free(level->dirty_chunks);
+    free(level->diagonal_row_offsets);
+    free(level->solid_cells);
+    free(level->chunk_solid_ready);
+    level->diagonal_row_offsets = NULL;
+    level->solid_cells = NULL;
+    level->chunk_solid_ready = NULL;
+    level->chunks = NULL;
+    level->chunk_revisions = NULL;
+    level->chunk_dirty = NULL;
+    level->dirty_chunks = NULL;
+    level->dirty_chunk_count = 0;
+    unmapLevelFile(level);
+}
+
+// Repacks every chunk that has become less compressed than it needs to be from edits
+void compactLevel(Level *level)
+{
+    uint8_t tiles[LEVEL_CHUNK_VOLUME];
+    for (size_t i = 0; i < levelChunkTotal(level); i++)
+    {
+        // chunks that were never loaded are still packed the way they were saved
+        if (level->chunks[i].kind == LEVEL_CHUNK_UNIFORM || level->chunks[i].kind == LEVEL_CHUNK_UNLOADED) continue;
+        unpackLevelChunk(&level->chunks[i], tiles);
+        packLevelChunk(&level->chunks[i], tiles);
+    }
+}
+
+// how many bytes the tiles take up, not counting the shared uniform blocks or chunks that haven't been loaded
+size_t levelMemoryUsage(Level *level)
+{
+    size_t bytes = levelChunkTotal(level) * (sizeof(LevelChunk) + sizeof(uint32_t));
+    for (size_t i = 0; i < levelChunkTotal(level); i++)
+    {
+        LevelChunk *chunk = &level->chunks[i];
+        if (chunk->kind == LEVEL_CHUNK_DENSE) bytes += LEVEL_CHUNK_VOLUME;
+        else if (chunk->kind == LEVEL_CHUNK_PALETTE) bytes += LEVEL_CHUNK_VOLUME * chunk->palette_bits / 8;
+    }
+    return bytes;
+}
+
+void markLevelChunkDirty(Level *level, size_t chunk_index)
+{
+    if (level->chunk_dirty[chunk_index]) return;
+    level->chunk_dirty[chunk_index] = 1;
+    level->dirty_chunks[level->dirty_chunk_count++] = chunk_index;
+}
+
+// for when everything has to be written out, like when there is no level file to build on
+void markLevelDirty(Level *level)
+{
+    for (size_t i = 0; i < levelChunkTotal(level); i++) markLevelChunkDirty(level, i);
+}
+
+void clearLevelDirty(Level *level)
+{
+    for (size_t i = 0; i < level->dirty_chunk_count; i++) level->chunk_dirty[level->dirty_chunks[i]] = 0;
+    level->dirty_chunk_count = 0;
+}
+
+// Packs a loaded chunk as small as it goes, for saving, into packed, which should be zeroed
+void repackLevelChunk(LevelChunk *chunk, LevelChunk *packed)
+{
+    uint8_t tiles[LEVEL_CHUNK_VOLUME];
+    unpackLevelChunk(chunk, tiles);
+    packLevelChunk(packed, tiles);
+}
+
+// uniform and dense chunks are read straight from tiles, only palette chunks need decoding
+uint8_t getTileAtUnsafe(Vector3 position, Level *level)
+{
+    return levelChunkTile(level, &level->chunks[levelChunkIndex(position, level)], levelChunkCellIndex(position));
+}
+
+// For walking through tiles one after another, like down a column or along a row of drawLevel's diagonals.
+// It remembers the chunk the last tile came from, so tiles from the same chunk skip finding the chunk,
+// loading it and reading its kind. Every kind of chunk is read the same way, as indices into a palette:
+// uniform chunks have 0 bit indices, and dense chunks have 8 bit ones into a palette that maps each tile to itself.
+// Each thread needs its own, and like getTileAtUnsafe it's only good while the level isn't being edited.
+typedef struct LevelTileReader
+{
+    Level *level;
+    // the first cell of the remembered chunk, all bits set before the first read so nothing matches
+    int origin_x, origin_y, origin_z;
+    const uint8_t *indices;
+    uint8_t palette_bits;
+    uint8_t index_mask;
+    uint8_t palette[256];
+} LevelTileReader;
+
+LevelTileReader makeLevelTileReader(Level *level)
+{
+    return (LevelTileReader) { .level = level, .origin_x = -1, .origin_y = -1, .origin_z = -1 };
+}
+
+// the slow part of readTile, kept out of it so what's left gets inlined
+void switchLevelTileReaderChunk(LevelTileReader *reader, int x, int y, int z)
+{
+    Level *level = reader->level;
+    LevelChunk *chunk = &level->chunks[levelChunkIndex((Vector3) { x, y, z }, level)];
+    ensureLevelChunkLoaded(level, chunk);
+    int mask = ~(LEVEL_CHUNK_SIZE - 1);
+    reader->origin_x = x & mask;
+    reader->origin_y = y & mask;
+    reader->origin_z = z & mask;
+    uint8_t kind = atomic_load_explicit(&chunk->kind, memory_order_relaxed);
+    if (kind == LEVEL_CHUNK_DENSE)
+    {
+        reader->indices = chunk->tiles;
+        reader->palette_bits = 8;
+        for (int i = 0; i < 256; i++) reader->palette[i] = i;
+    }
+    else if (kind == LEVEL_CHUNK_UNIFORM)
+    {
+        // any byte will do, every index is 0
+        reader->indices = chunk->tiles;
+        reader->palette_bits = 0;
+        reader->palette[0] = chunk->tiles[0];
+    }
+    else
+    {
+        reader->indices = chunk->indices;
+        reader->palette_bits = chunk->palette_bits;
+        memcpy(reader->palette, chunk->palette, LEVEL_PALETTE_MAX);
+    }
+    reader->index_mask = (1 << reader->palette_bits) - 1;
+}
+
+// the same as getTileAtUnsafe, the cell has to be inside the level
+uint8_t readTile(LevelTileReader *reader, int x, int y, int z)
+{
+    // a cell is in the remembered chunk when it only differs from the origin in the low bits
+    if ((unsigned)((x ^ reader->origin_x) | (y ^ reader->origin_y) | (z ^ reader->origin_z)) >> LEVEL_CHUNK_BITS)
+    {
+        switchLevelTileReaderChunk(reader, x, y, z);
+    }
+    int bit = levelChunkCellIndex((Vector3) { x, y, z }) * reader->palette_bits;
+    return reader->palette[(reader->indices[bit >> 3] >> (bit & 7)) & reader->index_mask];
+}
+
+int levelLowestBit(uint64_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    while (!(bits & 1)) { bits >>= 1; index++; }
+    return index;
+#endif
+}
+
+// the first x on diagonal d, where x + z = d, that is inside the level
+int diagonalRowStart(Level *level, int d)
+{
+    return (d > level->size.z - 1) ? d - (level->size.z - 1) : 0;
+}
+
+int diagonalRowEnd(Level *level, int d)
+{
+    return (d < level->size.x - 1) ? d : level->size.x - 1;
+}
+
+// Finds the cell's bit in rows laid out like solid_cells. The cell has to be inside the level.
+uint64_t *diagonalRowWord(Level *level, uint64_t *rows, Vector3 position, uint64_t *bit)
+{
+    int d = position.x + position.z;
+    int index = position.x - diagonalRowStart(level, d);
+    *bit = 1ull << (index & 63);
+    return &rows[position.y * level->diagonal_layer_words + level->diagonal_row_offsets[d] + (index >> 6)];
+}
+
+// Returns the first x from x to x_max whose bit is set in the q-bert row of rows at height y where x + z = d,
+// or x_max + 1 if there isn't one. Goes through the row 64 cells at a time.
+int nextSetCell(Level *level, uint64_t *rows, int y, int d, int x, int x_max)
+{
+    int end = x_max + 1;
+    if (y < 0 || y >= level->size.y || d < 0 || d > level->size.x + level->size.z - 2) return end;
+    int row_start = diagonalRowStart(level, d);
+    int row_end = diagonalRowEnd(level, d);
+    if (x < row_start) x = row_start;
+    if (x_max > row_end) x_max = row_end;
+    if (x > x_max) return end;
+    uint64_t *row = &rows[y * level->diagonal_layer_words + level->diagonal_row_offsets[d]];
+    int first = x - row_start, last = x_max - row_start;
+    int word_index = first >> 6;
+    uint64_t word = row[word_index] & (~0ull << (first & 63));
+    for (;;)
+    {
+        if (word)
+        {
+            int found = (word_index << 6) + levelLowestBit(word);
+            return (found <= last) ? found + row_start : end;
+        }
+        if (++word_index > last >> 6) return end;
+        word = row[word_index];
+    }
+}
+
+// The next cell in the row that isn't air. The chunks the row goes through have to have been
+// prepared with prepareLevelSolidity, or their tiles are skipped.
+int nextSolidCell(Level *level, int y, int d, int x, int x_max)
+{
+    return nextSetCell(level, level->solid_cells, y, d, x, x_max);
+}
+
+// Fills in the solid bits of a chunk from its tiles, loading it if it hasn't been yet
+void buildLevelChunkSolidity(Level *level, int chunk_x, int chunk_y, int chunk_z)
+{
+    size_t chunk_index = chunk_x + chunk_z * level->chunk_count.x + chunk_y * level->chunk_count.x * level->chunk_count.z;
+    Vector3 start = { chunk_x * LEVEL_CHUNK_SIZE, chunk_y * LEVEL_CHUNK_SIZE, chunk_z * LEVEL_CHUNK_SIZE };
+    // chunks on the far edges can stick out of the level
+    Vector3 last = clampVector3(addVector3(start, (Vector3) { LEVEL_CHUNK_SIZE - 1, LEVEL_CHUNK_SIZE - 1, LEVEL_CHUNK_SIZE - 1 }), (Vector3) { 0, 0, 0 }, level->size);
+    LevelTileReader reader = makeLevelTileReader(level);
+    for (int y = start.y; y <= last.y; y++)
+    {
+        for (int z = start.z; z <= last.z; z++)
+        {
+            for (int x = start.x; x <= last.x; x++)
+            {
+                Vector3 position = { x, y, z };
+                uint64_t bit;
+                uint64_t *word = diagonalRowWord(level, level->solid_cells, position, &bit);
+                if (readTile(&reader, x, y, z)) *word |= bit; else *word &= ~bit;
+            }
+        }
+    }
+    level->chunk_solid_ready[chunk_index] = 1;
+}
+
+// Makes sure the solid bits are filled in for every cell from min to max, inclusive
+void prepareLevelSolidity(Level *level, Vector3 min, Vector3 max)
+{
+    min = clampVector3(min, (Vector3) { 0, 0, 0 }, level->size);
+    max = clampVector3(max, (Vector3) { 0, 0, 0 }, level->size);
+    for (int chunk_y = min.y >> LEVEL_CHUNK_BITS; chunk_y <= max.y >> LEVEL_CHUNK_BITS; chunk_y++)
+    {
+        for (int chunk_z = min.z >> LEVEL_CHUNK_BITS; chunk_z <= max.z >> LEVEL_CHUNK_BITS; chunk_z++)
+        {
+            for (int chunk_x = min.x >> LEVEL_CHUNK_BITS; chunk_x <= max.x >> LEVEL_CHUNK_BITS; chunk_x++)
+            {
+                size_t chunk_index = chunk_x + chunk_z * level->chunk_count.x + chunk_y * level->chunk_count.x * level->chunk_count.z;
+                if (!level->chunk_solid_ready[chunk_index]) buildLevelChunkSolidity(level, chunk_x, chunk_y, chunk_z);
+            }
+        }
+    }
+}
+
+// The old level files are just the size, then every tile with y varying fastest, then x, then z,
+// then the start positions. The tiles are read one slab of LEVEL_CHUNK_SIZE z slices at a time
+// and split into chunks from there, the parts of edge chunks outside the level are air.
+void copyLegacySlab(Level *level, char *slab, int chunk_z)
+{
+    uint8_t tiles[LEVEL_CHUNK_VOLUME];
+    int slab_depth = level->size.z - chunk_z * LEVEL_CHUNK_SIZE;
+    if (slab_depth > LEVEL_CHUNK_SIZE) slab_depth = LEVEL_CHUNK_SIZE;
+    for (int chunk_y = 0; chunk_y < level->chunk_count.y; chunk_y++)
+    {
+        for (int chunk_x = 0; chunk_x < level->chunk_count.x; chunk_x++)
+        {
+            Vector3 origin = { chunk_x * LEVEL_CHUNK_SIZE, chunk_y * LEVEL_CHUNK_SIZE, chunk_z * LEVEL_CHUNK_SIZE };
+            memset(tiles, 0, sizeof(tiles));
+            int height = level->size.y - origin.y;
+            if (height > LEVEL_CHUNK_SIZE) height = LEVEL_CHUNK_SIZE;
+            for (int z = 0; z < slab_depth; z++)
+            {
+                for (int x = 0; x < LEVEL_CHUNK_SIZE && origin.x + x < level->size.x; x++)
+                {
+                    char *column = &slab[origin.y + (origin.x + x) * level->size.y + (size_t)z * level->size.y * level->size.x];
+                    memcpy(&tiles[(x << LEVEL_CHUNK_BITS) | (z << (2 * LEVEL_CHUNK_BITS))], column, height);
+                }
+            }
+            packLevelChunk(&level->chunks[levelChunkIndex(origin, level)], tiles);
+        }
+    }
+}
+
+int loadLegacyLevel(Level *level, const char *path)
 {
-    FILE *level_file = fopen(path, "r");
+    FILE *level_file = fopen(path, "rb");
     if (!level_file) { return 0; }
     
     // first thing to read is the size
-    fread(&level->size, sizeof(Vector3), 1, level_file);
-    // the number of bytes to copy will be the product of x, y, and z
-    size_t next_copy_size = level->size.x * level->size.y * level->size.z;
-    level->tiles = calloc(next_copy_size, 1);
-    fread(level->tiles, sizeof(char), next_copy_size, level_file);
+    Vector3 size;
+    if (fread(&size, sizeof(Vector3), 1, level_file) != 1 || size.x <= 0 || size.y <= 0 || size.z <= 0)
+    {
+        fclose(level_file);
+        return 0;
+    }
+    allocateLevel(level, size);
+    size_t slice_size = (size_t)level->size.x * level->size.y;
+    char *slab = malloc(slice_size * LEVEL_CHUNK_SIZE);
+    int complete = 1;
+    for (int chunk_z = 0; chunk_z < level->chunk_count.z; chunk_z++)
+    {
+        int slab_depth = level->size.z - chunk_z * LEVEL_CHUNK_SIZE;
+        if (slab_depth > LEVEL_CHUNK_SIZE) slab_depth = LEVEL_CHUNK_SIZE;
+        size_t slab_size = slice_size * slab_depth;
+        // whatever is missing from a cut off file is air
+        size_t read_size = complete ? fread(slab, sizeof(char), slab_size, level_file) : 0;
+        if (read_size < slab_size)
+        {
+            memset(slab + read_size, 0, slab_size - read_size);
+            complete = 0;
+        }
+        copyLegacySlab(level, slab, chunk_z);
+    }
+    free(slab);
     // now, copy the start position
-    fread(&level->start_positions, sizeof(Vector3), sizeof(level->start_positions) / sizeof(Vector3), level_file);
+    if (!complete || fread(&level->start_positions, sizeof(level->start_positions), 1, level_file) != 1)
+    {
+        puts("Level file is cut short");
+    }
     fclose(level_file);
     return 1;
 }
 
-int saveLevel(Level *level, const char *path)
+// maps the whole file, copy on write, or reads it in where there is no mmap
+int mapLevelFile(Level *level, const char *path)
 {
-    // clear all entity flags
-    for (int x = 0; x < level->size.x; x++)
+#ifndef _WIN32
+    int file = open(path, O_RDONLY);
+    if (file < 0) return 0;
+    struct stat file_stat;
+    if (fstat(file, &file_stat) || file_stat.st_size == 0)
+    {
+        close(file);
+        return 0;
+    }
+    void *map = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    // the mapping stays valid after the file is closed
+    close(file);
+    if (map == MAP_FAILED) return 0;
+    level->file_map = map;
+    level->file_map_size = file_stat.st_size;
+#else
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    level->file_map = (file_size > 0) ? malloc(file_size) : NULL;
+    if (!level->file_map || fread(level->file_map, 1, file_size, file) != (size_t)file_size)
     {
-        for (int y = 0; y < level->size.y; y++)
+        free(level->file_map);
+        level->file_map = NULL;
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    level->file_map_size = file_size;
+#endif
+    return 1;
+}
+
+// returns a new string that has to be freed
+char *levelJournalPath(const char *path)
+{
+    size_t path_length = strlen(path);
+    char *journal_path = malloc(path_length + sizeof(".journal"));
+    memcpy(journal_path, path, path_length);
+    memcpy(journal_path + path_length, ".journal", sizeof(".journal"));
+    return journal_path;
+}
+
+// Reads the journal's header, returns 0 if there is no journal or it's not one
+int readLevelJournalHeader(FILE *journal, LevelJournalHeader *header)
+{
+    return fread(header, sizeof(*header), 1, journal) == 1 && !memcmp(header->magic, LEVEL_JOURNAL_MAGIC, 4)
+        && header->version == LEVEL_FILE_VERSION;
+}
+
+// starts a journal over, for the level file of the given generation
+int writeLevelJournalHeader(FILE *journal, uint32_t generation, Vector3 size)
+{
+    LevelJournalHeader header = { .version = LEVEL_FILE_VERSION, .generation = generation, .size = size };
+    memcpy(header.magic, LEVEL_JOURNAL_MAGIC, 4);
+    return fwrite(&header, sizeof(header), 1, journal) == 1;
+}
+
+// Appends a packed chunk to the journal, returns how many bytes were written or 0 if it failed
+size_t appendLevelJournalChunk(FILE *journal, uint32_t chunk_index, LevelChunk *packed)
+{
+    LevelJournalRecord record = { .chunk_index = chunk_index };
+    char *data = describeLevelChunk(packed, &record.chunk);
+    record.chunk.checksum = levelFileChunkChecksum(&record.chunk, data);
+    size_t length = levelFileChunkLength(record.chunk.kind, record.chunk.palette_bits);
+    // chunk data is always a multiple of 8 bytes, so there is no padding to add
+    if (fwrite(&record, sizeof(record), 1, journal) != 1 || fwrite(data, 1, length, journal) != length) return 0;
+    return sizeof(record) + length;
+}
+
+// Applies the journal at path to the level, if it was made for the level's file.
+// Returns how many chunks were replaced. The replayed chunks aren't dirty, they're already saved.
+size_t replayLevelJournal(Level *level, const char *journal_path)
+{
+    FILE *journal = fopen(journal_path, "rb");
+    if (!journal) return 0;
+    LevelJournalHeader header;
+    size_t replayed = 0;
+    if (readLevelJournalHeader(journal, &header) && header.generation == level->file_generation
+        && !memcmp(&header.size, &level->size, sizeof(Vector3)))
+    {
+        LevelJournalRecord record;
+        char data[LEVEL_CHUNK_VOLUME];
+        while (fread(&record, sizeof(record), 1, journal) == 1)
         {
-            for (int z = 0; z < level->size.z; z++)
+            size_t length = levelFileChunkLength(record.chunk.kind, record.chunk.palette_bits);
+            if (record.chunk_index >= levelChunkTotal(level) || !levelFileChunkValid(&record.chunk)
+                || fread(data, 1, length, journal) != length || levelFileChunkChecksum(&record.chunk, data) != record.chunk.checksum)
             {
-                Vector3 world = { x, y, z };
-                clearFlagAt(world, level);
+                puts("Level journal ends with a bad record, the edits after it are lost");
+                break;
             }
+            LevelChunk *chunk = &level->chunks[record.chunk_index];
+            freeLevelChunk(chunk);
+            setLevelChunkFromFile(chunk, &record.chunk, data, 1);
+            chunk->kind = record.chunk.kind;
+            replayed++;
         }
     }
-    FILE *level_file = fopen(path, "w+");
-    if (!level_file) { return 0; }
+    fclose(journal);
+    return replayed;
+}
 
-    // first write the size
-    fwrite(&level->size, sizeof(Vector3), 1, level_file);
+// Opens a level file, either format, then applies its journal if it has one.
+// Only the header is read here, chunks are loaded as they are used.
+// A journal with no level file is enough on its own, the rest of the level is air.
+// remember to free the last level before running again
+int loadLevel(Level *level, const char *path)
+{
+    char *journal_path = levelJournalPath(path);
+    Level mapped = { 0 };
+    int loaded = 0;
+    if (!mapLevelFile(&mapped, path))
+    {
+        // see if there is a journal to go on
+        FILE *journal = fopen(journal_path, "rb");
+        LevelJournalHeader header;
+        if (journal && readLevelJournalHeader(journal, &header) && header.generation == 0
+            && header.size.x > 0 && header.size.y > 0 && header.size.z > 0)
+        {
+            createLevel(level, header.size);
+            loaded = 1;
+        }
+        if (journal) fclose(journal);
+    }
+    else if (mapped.file_map_size < sizeof(LevelFileHeader) || memcmp(mapped.file_map, LEVEL_FILE_MAGIC, 4))
+    {
+        unmapLevelFile(&mapped);
+        loaded = loadLegacyLevel(level, path);
+    }
+    else
+    {
+        LevelFileHeader header;
+        memcpy(&header, mapped.file_map, sizeof(header));
+        if (header.version != LEVEL_FILE_VERSION || header.size.x <= 0 || header.size.y <= 0 || header.size.z <= 0)
+        {
+            printf("Can't read level file %s, version %u\n", path, header.version);
+            unmapLevelFile(&mapped);
+        }
+        else
+        {
+            allocateLevel(level, header.size);
+            size_t chunk_total = levelChunkTotal(level);
+            if (header.chunk_total != chunk_total || (mapped.file_map_size - sizeof(header)) / sizeof(LevelFileChunk) < chunk_total)
+            {
+                puts("Level file directory doesn't match its size");
+                freeLevel(level);
+                unmapLevelFile(&mapped);
+            }
+            else
+            {
+                memcpy(level->start_positions, header.start_positions, sizeof(level->start_positions));
+                level->file_map = mapped.file_map;
+                level->file_map_size = mapped.file_map_size;
+                level->file_directory = (LevelFileChunk *)(mapped.file_map + sizeof(header));
+                level->file_generation = header.generation;
+                loaded = 1;
+            }
+        }
+    }
+    if (loaded) replayLevelJournal(level, journal_path);
+    free(journal_path);
+    return loaded;
+}
+
+// Writes the whole level in the current format, as one generation past the file it was loaded from,
+// and removes the journal, which is folded into the new file.
+// The file is written next to the old one and then renamed over it, so a level that is still
+// mapped from the old file keeps working and a failed save doesn't lose anything.
+// Don't call this on a level that a LevelSaver is writing out, it owns the journal.
+int saveLevel(Level *level, const char *path)
+{
+    size_t path_length = strlen(path);
+    char *temporary_path = malloc(path_length + 5);
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", 5);
+    FILE *level_file = fopen(temporary_path, "wb");
+    if (!level_file)
+    {
+        free(temporary_path);
+        return 0;
+    }
 
-    fwrite(level->tiles, sizeof(char), level->size.x * level->size.y * level->size.z, level_file);
+    LevelFileHeader header = { .version = LEVEL_FILE_VERSION, .size = level->size, .chunk_total = levelChunkTotal(level) };
+    memcpy(header.magic, LEVEL_FILE_MAGIC, 4);
+    memcpy(header.start_positions, level->start_positions, sizeof(header.start_positions));
+    header.generation = level->file_generation + 1;
+    size_t directory_size = header.chunk_total * sizeof(LevelFileChunk);
+    LevelFileChunk *directory = calloc(header.chunk_total, sizeof(LevelFileChunk));
+    uint64_t offset = sizeof(header) + directory_size;
+    offset = (offset + LEVEL_FILE_ALIGNMENT - 1) & ~(uint64_t)(LEVEL_FILE_ALIGNMENT - 1);
+    int written = fseek(level_file, offset, SEEK_SET) == 0;
 
-    fwrite(&level->start_positions, sizeof(Vector3), sizeof(level->start_positions) / sizeof(Vector3), level_file);
+    char padding[LEVEL_FILE_ALIGNMENT] = { 0 };
+    for (size_t i = 0; i < header.chunk_total && written; i++)
+    {
+        LevelChunk *chunk = &level->chunks[i];
+        ensureLevelChunkLoaded(level, chunk);
+        LevelChunk packed = { 0 };
+        repackLevelChunk(chunk, &packed);
 
-    fclose(level_file);
-    return 1;
+        LevelFileChunk *entry = &directory[i];
+        char *data = describeLevelChunk(&packed, entry);
+        size_t length = levelFileChunkLength(packed.kind, packed.palette_bits);
+        if (length)
+        {
+            entry->offset = offset;
+            written = fwrite(data, 1, length, level_file) == length;
+            offset += length;
+            size_t padding_size = (LEVEL_FILE_ALIGNMENT - offset % LEVEL_FILE_ALIGNMENT) % LEVEL_FILE_ALIGNMENT;
+            written = written && fwrite(padding, 1, padding_size, level_file) == padding_size;
+            offset += padding_size;
+        }
+        entry->checksum = levelFileChunkChecksum(entry, data);
+        freeLevelChunk(&packed);
+    }
+
+    written = written && fseek(level_file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, level_file) == 1
+        && fwrite(directory, sizeof(LevelFileChunk), header.chunk_total, level_file) == header.chunk_total;
+    free(directory);
+    written = (fclose(level_file) == 0) && written;
+#ifdef _WIN32
+    // rename won't replace an existing file here
+    if (written) remove(path);
+#endif
+    written = written && rename(temporary_path, path) == 0;
+    if (!written) remove(temporary_path);
+    free(temporary_path);
+    if (written)
+    {
+        // the journal is for the old generation now, so it would be skipped anyway
+        char *journal_path = levelJournalPath(path);
+        remove(journal_path);
+        free(journal_path);
+        level->file_generation = header.generation;
+        clearLevelDirty(level);
+    }
+    return written;
 }
 
-char getTileAt(Vector3 position, Level *level)
+uint8_t getTileAt(Vector3 position, Level *level)
 {
     if (position.x >= 0 && position.x < level->size.x
     && position.y >= 0 && position.y < level->size.y
     && position.z >= 0 && position.z < level->size.z)
     {
-        return level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x];
+        return getTileAtUnsafe(position, level);
     }
     puts("Out of bounds access");
     return 0;
 }
 
-char getTileAtUnsafe(Vector3 position, Level *level)
-{
-    return level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x];
-}
-
-int setTileAt(char tile, Vector3 position, Level *level)
+int setTileAt(uint8_t tile, Vector3 position, Level *level)
 {
-    tile &= (char)~CELL_HAS_ENTITY_FLAG;
     if (position.x >= 0 && position.x < level->size.x
     && position.y >= 0 && position.y < level->size.y
     && position.z >= 0 && position.z < level->size.z)
     {
-        level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x] &= CELL_HAS_ENTITY_FLAG;
-        level->tiles[position.y + position.x * level->size.y + position.z * level->size.y * level->size.x] |= tile;
+        size_t chunk_index = levelChunkIndex(position, level);
+        LevelChunk *chunk = &level->chunks[chunk_index];
+        int cell = levelChunkCellIndex(position);
+        if (levelChunkTile(level, chunk, cell) != tile)
+        {
+            storeLevelChunkTile(chunk, cell, tile);
+            level->chunk_revisions[chunk_index]++;
+            markLevelChunkDirty(level, chunk_index);
+            if (level->chunk_solid_ready[chunk_index])
+            {
+                uint64_t bit;
+                uint64_t *word = diagonalRowWord(level, level->solid_cells, position, &bit);
+                if (tile) *word |= bit; else *word &= ~bit;
+            }
+        }
         return 1;
     } else return 0;
 }
@@ -0,0 +1,238 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <string.h>
+#include "level.h"
+#include "trace.h"
+
+// Saves a level in the background, a few chunks at a time.
+// The main thread calls queueLevelSave whenever it wants a save, which copies the chunks that
+// setTileAt marked dirty since the last one, a memcpy per chunk, and hands them to a writer thread.
+// The writer appends them to the level's journal, and once the journal has grown big enough
+// compared to the level file, folds it into a new level file. Nothing in the live level is touched
+// by the writer, so the game keeps running while it works.
+
+// the journal is folded into the level file once it's bigger than this plus a quarter of the file
+#define LEVEL_JOURNAL_COMPACT_BYTES (4 << 20)
+
+typedef struct LevelSaveChunk
+{
+    uint32_t chunk_index;
+    LevelChunk chunk;
+} LevelSaveChunk;
+
+typedef struct LevelSaver
+{
+    char *path;
+    char *journal_path;
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *work_available;
+    SDL_cond *idle;
+
+    // copies of dirty chunks, waiting for the writer
+    LevelSaveChunk *pending;
+    size_t pending_count, pending_capacity;
+    int writing;
+    int running;
+    // set by the writer when a write fails, so the next save writes everything again
+    int save_everything;
+
+    // these belong to the writer thread
+    uint32_t generation;
+    Vector3 size;
+    // 0 until the journal is started for the current generation
+    uint64_t journal_size;
+    uint64_t file_size;
+
+    // for keeping an eye on things
+    uint64_t chunks_written;
+    uint32_t compactions;
+} LevelSaver;
+
+uint64_t levelSaverFileSize(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return (size > 0) ? size : 0;
+}
+
+// Folds the journal into a new level file. The live level may still be mapped from the old file,
+// which is fine since saveLevel renames the new one over it.
+int compactLevelJournal(LevelSaver *saver)
+{
+    Level snapshot;
+    if (!loadLevel(&snapshot, saver->path)) return 0;
+    int saved = saveLevel(&snapshot, saver->path);
+    if (saved)
+    {
+        saver->generation = snapshot.file_generation;
+        saver->journal_size = 0;
+        saver->file_size = levelSaverFileSize(saver->path);
+        saver->compactions++;
+    }
+    freeLevel(&snapshot);
+    return saved;
+}
+
+// runs on the writer thread, returns 0 if anything couldn't be written
+int writeLevelSaveChunks(LevelSaver *saver, LevelSaveChunk *chunks, size_t count)
+{
+    FILE *journal = fopen(saver->journal_path, saver->journal_size ? "ab" : "wb");
+    if (!journal) return 0;
+    int written = 1;
+    uint64_t journal_size = saver->journal_size;
+    if (!journal_size)
+    {
+        written = writeLevelJournalHeader(journal, saver->generation, saver->size);
+        journal_size = sizeof(LevelJournalHeader);
+    }
+    for (size_t i = 0; i < count && written; i++)
+    {
+        LevelChunk packed = { 0 };
+        repackLevelChunk(&chunks[i].chunk, &packed);
+        size_t record_size = appendLevelJournalChunk(journal, chunks[i].chunk_index, &packed);
+        freeLevelChunk(&packed);
+        written = record_size != 0;
+        journal_size += record_size;
+    }
+    written = fflush(journal) == 0 && written;
+#ifndef _WIN32
+    written = fsync(fileno(journal)) == 0 && written;
+    // cut off anything half written, so the next records aren't stuck behind a bad one
+    if (!written && ftruncate(fileno(journal), saver->journal_size)) saver->journal_size = 0;
+#endif
+    fclose(journal);
+    if (!written) return 0;
+    saver->journal_size = journal_size;
+    saver->chunks_written += count;
+
+    // until there is a level file of the current format, the journal is all there is
+    if (saver->generation == 0 || saver->journal_size > saver->file_size / 4 + LEVEL_JOURNAL_COMPACT_BYTES)
+    {
+        // the chunks are safe in the journal either way, so this is tried again after the next write
+        if (!compactLevelJournal(saver)) printf("Couldn't fold %s into the level file\n", saver->journal_path);
+    }
+    return 1;
+}
+
+int levelSaverThread(void *data)
+{
+    LevelSaver *saver = data;
+    SDL_LockMutex(saver->lock);
+    for (;;)
+    {
+        while (saver->running && !saver->pending_count) SDL_CondWait(saver->work_available, saver->lock);
+        // whatever is still pending gets written before stopping
+        if (!saver->pending_count) break;
+        LevelSaveChunk *chunks = saver->pending;
+        size_t count = saver->pending_count;
+        saver->pending = NULL;
+        saver->pending_count = saver->pending_capacity = 0;
+        saver->writing = 1;
+        SDL_UnlockMutex(saver->lock);
+
+        TRACE_BEGIN(writeLevelSaveChunks);
+        int written = writeLevelSaveChunks(saver, chunks, count);
+        TRACE_END(writeLevelSaveChunks);
+        if (!written) printf("Couldn't save %zu level chunks to %s\n", count, saver->journal_path);
+        for (size_t i = 0; i < count; i++) freeLevelChunk(&chunks[i].chunk);
+        free(chunks);
+
+        SDL_LockMutex(saver->lock);
+        if (!written) saver->save_everything = 1;
+        saver->writing = 0;
+        if (!saver->pending_count) SDL_CondBroadcast(saver->idle);
+    }
+    SDL_UnlockMutex(saver->lock);
+    return 0;
+}
+
+// Starts saving level to path, which is usually where it was loaded from.
+// A level that doesn't come from a current level file gets written out in full on the first save.
+void createLevelSaver(LevelSaver *saver, Level *level, const char *path)
+{
+    *saver = (LevelSaver) { 0 };
+    size_t path_length = strlen(path);
+    saver->path = malloc(path_length + 1);
+    memcpy(saver->path, path, path_length + 1);
+    saver->journal_path = levelJournalPath(path);
+    saver->generation = level->file_generation;
+    saver->size = level->size;
+    saver->file_size = levelSaverFileSize(path);
+
+    // keep adding to the journal that was replayed on load, if there was one
+    FILE *journal = fopen(saver->journal_path, "rb");
+    LevelJournalHeader header;
+    if (journal && readLevelJournalHeader(journal, &header) && header.generation == saver->generation
+        && !memcmp(&header.size, &level->size, sizeof(Vector3)))
+    {
+        saver->journal_size = levelSaverFileSize(saver->journal_path);
+    }
+    if (journal) fclose(journal);
+    if (!saver->generation) markLevelDirty(level);
+
+    saver->lock = SDL_CreateMutex();
+    saver->work_available = SDL_CreateCond();
+    saver->idle = SDL_CreateCond();
+    saver->running = 1;
+    saver->thread = SDL_CreateThread(levelSaverThread, "level saver", saver);
+}
+
+// Hands the chunks changed since the last save to the writer, returns how many there were
+size_t queueLevelSave(LevelSaver *saver, Level *level)
+{
+    SDL_LockMutex(saver->lock);
+    if (saver->save_everything)
+    {
+        markLevelDirty(level);
+        saver->save_everything = 0;
+    }
+    if (saver->pending_count + level->dirty_chunk_count > saver->pending_capacity)
+    {
+        saver->pending_capacity = saver->pending_count + level->dirty_chunk_count;
+        saver->pending = realloc(saver->pending, saver->pending_capacity * sizeof(LevelSaveChunk));
+    }
+    for (size_t i = 0; i < level->dirty_chunk_count; i++)
+    {
+        uint32_t chunk_index = level->dirty_chunks[i];
+        LevelSaveChunk *save_chunk = &saver->pending[saver->pending_count++];
+        save_chunk->chunk_index = chunk_index;
+        ensureLevelChunkLoaded(level, &level->chunks[chunk_index]);
+        copyLevelChunk(&save_chunk->chunk, &level->chunks[chunk_index]);
+    }
+    size_t queued = level->dirty_chunk_count;
+    clearLevelDirty(level);
+    if (queued) SDL_CondSignal(saver->work_available);
+    SDL_UnlockMutex(saver->lock);
+    return queued;
+}
+
+// blocks until everything queued so far is written
+void waitForLevelSaver(LevelSaver *saver)
+{
+    SDL_LockMutex(saver->lock);
+    while (saver->pending_count || saver->writing) SDL_CondWait(saver->idle, saver->lock);
+    SDL_UnlockMutex(saver->lock);
+}
+
+// saves whatever changed since the last save, then stops the writer once it's done
+void destroyLevelSaver(LevelSaver *saver, Level *level)
+{
+    queueLevelSave(saver, level);
+    SDL_LockMutex(saver->lock);
+    saver->running = 0;
+    SDL_CondSignal(saver->work_available);
+    SDL_UnlockMutex(saver->lock);
+    SDL_WaitThread(saver->thread, NULL);
+    SDL_DestroyCond(saver->work_available);
+    SDL_DestroyCond(saver->idle);
+    SDL_DestroyMutex(saver->lock);
+    free(saver->pending);
+    free(saver->path);
+    free(saver->journal_path);
+    *saver = (LevelSaver) { 0 };
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <stdlib.h>
 #include <stdint.h>
 
@@ -19,7 +20,7 @@ int insertToMinHeap(Heap *min_heap, uint64_t key, void *value)
     if (min_heap->count >= min_heap->max_size) return 0;
     min_heap->pairs[min_heap->count].key = key;
     min_heap->pairs[min_heap->count].value = value;
-    for (size_t i = min_heap->count; i > 0 && min_heap->pairs[i].key < min_heap->pairs[(i - 1) >> 1].key; i >>= 1)
+    for (size_t i = min_heap->count; i > 0 && min_heap->pairs[i].key < min_heap->pairs[(i - 1) >> 1].key; i = (i - 1) >> 1)
     {
         KeyValuePair temporary = min_heap->pairs[i];
         min_heap->pairs[i] = min_heap->pairs[(i - 1) >> 1];
@@ -29,25 +30,30 @@ int insertToMinHeap(Heap *min_heap, uint64_t key, void *value)
     return 1;
 }
 
+// removes the smallest pair, which is always at pairs[0]
 void minHeapify(Heap *min_heap)
 {
     if (min_heap->count <= 0) return;
     min_heap->pairs[0] = min_heap->pairs[--min_heap->count];
     
-    size_t min_index = 0;
     size_t index = 0;
-    do 
+    for (;;)
     {
         size_t left = (index << 1) + 1;
         size_t right = (index << 1) + 2;
-        index = min_index;
-        if (left < min_heap->count && min_heap->pairs[left].value < min_heap->pairs[min_index].value)
+        size_t min_index = index;
+        if (left < min_heap->count && min_heap->pairs[left].key < min_heap->pairs[min_index].key)
         {
             min_index = left;
         }
-        if (right < min_heap->count && min_heap->pairs[right].value < min_heap->pairs[min_index].value)
+        if (right < min_heap->count && min_heap->pairs[right].key < min_heap->pairs[min_index].key)
         {
             min_index = right;
         }
-    } while (min_index != index);
-}
\ No newline at end of file
+        if (min_index == index) break;
+        KeyValuePair temporary = min_heap->pairs[index];
+        min_heap->pairs[index] = min_heap->pairs[min_index];
+        min_heap->pairs[min_index] = temporary;
+        index = min_index;
+    }
+}
@@ -0,0 +1,240 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <string.h>
+#include "a_star.h"
+#include "level.h"
+#include "trace.h"
+
+// A pool of worker threads that answer path queries in the background.
+// Game logic submits batches of requests, and the main loop picks up the finished paths
+// once per frame with pollPathResults, so the searches never eat into the frame budget.
+// Each worker has its own SearchData and reads the level without any locking, which means
+// the level's tiles must not be edited while the service is running; see pausePathService.
+
+typedef struct PathRequest
+{
+    Vector3 start;
+    Vector3 goal;
+    void *user_data;
+    uint32_t id;
+} PathRequest;
+
+typedef struct PathResult
+{
+    uint32_t id;
+    void *user_data;
+    int found;
+    // paths longer than the service's max_path_length get cut off
+    // after that many steps and have truncated set
+    int truncated;
+    size_t path_length;
+    Vector3 *path;
+} PathResult;
+
+typedef struct PathWorker
+{
+    struct PathService *service;
+    SearchData search_data;
+    SDL_Thread *thread;
+} PathWorker;
+
+typedef struct PathService
+{
+    Level *level;
+    SDL_mutex *lock;
+    SDL_cond *work_available;
+    SDL_cond *workers_idle;
+
+    // ring buffer of requests waiting for a worker
+    PathRequest *requests;
+    size_t request_capacity, request_head, request_count;
+
+    // ring buffer of finished results, each slot owns max_path_length steps of result_paths
+    PathResult *results;
+    Vector3 *result_paths;
+    size_t result_capacity, result_head, result_count;
+    size_t max_path_length;
+
+    // requests that a worker has taken but not finished, each of these has a result slot reserved
+    size_t in_flight;
+    uint32_t next_id;
+    int paused;
+    int running;
+
+    PathWorker *workers;
+    int worker_count;
+} PathService;
+
+int pathWorkerThread(void *data)
+{
+    PathWorker *worker = data;
+    PathService *service = worker->service;
+    SDL_LockMutex(service->lock);
+    for (;;)
+    {
+        // only take a request when there is guaranteed to be room for its result
+        while (service->running && (service->paused || !service->request_count
+            || service->result_count + service->in_flight >= service->result_capacity))
+        {
+            SDL_CondWait(service->work_available, service->lock);
+        }
+        if (!service->running) break;
+        PathRequest request = service->requests[service->request_head];
+        service->request_head = (service->request_head + 1) % service->request_capacity;
+        service->request_count--;
+        service->in_flight++;
+        SDL_UnlockMutex(service->lock);
+
+        TRACE_BEGIN(aStarPathFind);
+        int found = aStarPathFind(request.start, request.goal, &worker->search_data, service->level) != NULL;
+        TRACE_END(aStarPathFind);
+
+        SDL_LockMutex(service->lock);
+        size_t slot = (service->result_head + service->result_count) % service->result_capacity;
+        PathResult *result = &service->results[slot];
+        result->id = request.id;
+        result->user_data = request.user_data;
+        result->found = found;
+        result->path = &service->result_paths[slot * service->max_path_length];
+        result->path_length = found ? worker->search_data.path_length : 0;
+        result->truncated = result->path_length > service->max_path_length;
+        if (result->truncated) result->path_length = service->max_path_length;
+        memcpy(result->path, worker->search_data.path, result->path_length * sizeof(Vector3));
+        service->result_count++;
+        service->in_flight--;
+        if (!service->in_flight) SDL_CondBroadcast(service->workers_idle);
+    }
+    SDL_UnlockMutex(service->lock);
+    return 0;
+}
+
+void destroyPathService(PathService *service)
+{
+    SDL_LockMutex(service->lock);
+    service->running = 0;
+    SDL_CondBroadcast(service->work_available);
+    SDL_UnlockMutex(service->lock);
+    for (int i = 0; i < service->worker_count; i++)
+    {
+        if (service->workers[i].thread) SDL_WaitThread(service->workers[i].thread, NULL);
+        freeSearchData(&service->workers[i].search_data);
+    }
+    SDL_DestroyCond(service->work_available);
+    SDL_DestroyCond(service->workers_idle);
+    SDL_DestroyMutex(service->lock);
+    free(service->workers);
+    free(service->requests);
+    free(service->results);
+    free(service->result_paths);
+    *service = (PathService) { 0 };
+}
+
+// worker_count of 0 or less means one worker per core, leaving one for the main thread.
+// If not all of the workers can be started the service runs with the ones that were, and if none
+// were it is destroyed again and this returns 0.
+int createPathService(PathService *service, Level *level, int worker_count, size_t queue_capacity, size_t max_path_length, int max_search_nodes)
+{
+    if (worker_count <= 0) worker_count = SDL_GetCPUCount() - 1;
+    if (worker_count < 1) worker_count = 1;
+    *service = (PathService) { 0 };
+    service->level = level;
+    service->lock = SDL_CreateMutex();
+    service->work_available = SDL_CreateCond();
+    service->workers_idle = SDL_CreateCond();
+    service->requests = calloc(queue_capacity, sizeof(PathRequest));
+    service->request_capacity = queue_capacity;
+    service->results = calloc(queue_capacity, sizeof(PathResult));
+    service->result_paths = calloc(queue_capacity * max_path_length, sizeof(Vector3));
+    service->result_capacity = queue_capacity;
+    service->max_path_length = max_path_length;
+    service->next_id = 1;
+    service->running = 1;
+    service->workers = calloc(worker_count, sizeof(PathWorker));
+    service->worker_count = worker_count;
+    for (int i = 0; i < worker_count; i++)
+    {
+        service->workers[i].service = service;
+        service->workers[i].search_data = createSearchData(max_search_nodes);
+        service->workers[i].thread = SDL_CreateThread(pathWorkerThread, "path worker", &service->workers[i]);
+        if (!service->workers[i].thread)
+        {
+            freeSearchData(&service->workers[i].search_data);
+            service->worker_count = i;
+            break;
+        }
+    }
+    if (!service->worker_count)
+    {
+        destroyPathService(service);
+        return 0;
+    }
+    return 1;
+}
+
+// Queues as many of the requests as there is room for and returns how many were queued.
+// The id of each queued request is written back into the array.
+size_t submitPathRequests(PathService *service, PathRequest *requests, size_t count)
+{
+    SDL_LockMutex(service->lock);
+    size_t submitted = 0;
+    while (submitted < count && service->request_count < service->request_capacity)
+    {
+        requests[submitted].id = service->next_id++;
+        if (!service->next_id) service->next_id = 1;
+        size_t slot = (service->request_head + service->request_count) % service->request_capacity;
+        service->requests[slot] = requests[submitted++];
+        service->request_count++;
+    }
+    if (submitted) SDL_CondBroadcast(service->work_available);
+    SDL_UnlockMutex(service->lock);
+    return submitted;
+}
+
+// returns the id of the request, or 0 if the queue is full
+uint32_t submitPathRequest(PathService *service, Vector3 start, Vector3 goal, void *user_data)
+{
+    PathRequest request = { start, goal, user_data, 0 };
+    return submitPathRequests(service, &request, 1) ? request.id : 0;
+}
+
+// Hands every finished result to callback, meant to be called once per frame.
+// The results and their paths are only valid until the callback returns.
+size_t pollPathResults(PathService *service, void (*callback)(PathResult *, void *), void *context)
+{
+    SDL_LockMutex(service->lock);
+    size_t head = service->result_head;
+    size_t count = service->result_count;
+    SDL_UnlockMutex(service->lock);
+    // workers only ever write past the results we took, so these are safe to read unlocked
+    for (size_t i = 0; i < count; i++)
+    {
+        callback(&service->results[(head + i) % service->result_capacity], context);
+    }
+    if (count)
+    {
+        SDL_LockMutex(service->lock);
+        service->result_head = (head + count) % service->result_capacity;
+        service->result_count -= count;
+        SDL_CondBroadcast(service->work_available);
+        SDL_UnlockMutex(service->lock);
+    }
+    return count;
+}
+
+// Stops the workers from starting new searches and waits for the running ones to finish.
+// Call this before editing the level, and resumePathService afterwards.
+void pausePathService(PathService *service)
+{
+    SDL_LockMutex(service->lock);
+    service->paused = 1;
+    while (service->in_flight) SDL_CondWait(service->workers_idle, service->lock);
+    SDL_UnlockMutex(service->lock);
+}
+
+void resumePathService(PathService *service)
+{
+    SDL_LockMutex(service->lock);
+    service->paused = 0;
+    SDL_CondBroadcast(service->work_available);
+    SDL_UnlockMutex(service->lock);
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "entity_store.h"
+#include "math_utils.h"
+
+// Which entities have been drawn over which parts of the screen this frame.
+// The screen is cut into SCREEN_GRID_SIZE_PX squares, and each of them has a list of the texture data
+// of the entities drawn over it, chained through one array of entries so any number of entities fit.
+// There's also a bit per square for whether it has anything in it, so clearing the grid for the next
+// frame only touches the squares that were used, instead of the whole screen.
+
+#define SCREEN_GRID_SIZE_PX 70
+
+typedef struct ScreenGridEntry
+{
+    TextureData *texture_data;
+    // the next entry in the same square, or -1
+    int32_t next;
+} ScreenGridEntry;
+
+typedef struct ScreenGrid
+{
+    int width, height;
+    // the first entry of each square, or -1
+    int32_t *heads;
+    uint64_t *marked;
+    size_t marked_words;
+    ScreenGridEntry *entries;
+    size_t entry_count, entry_capacity;
+    // entities remember which frame they were last marked on, so they only go in once however many cells they're drawn in
+    uint32_t frame;
+} ScreenGrid;
+
+// the squares a screen rectangle touches, inclusive
+typedef struct ScreenGridRange
+{
+    int min_x, max_x, min_y, max_y;
+} ScreenGridRange;
+
+ScreenGrid screen_grid = { 0 };
+
+// Makes the grid cover a screen_width by screen_height screen, which empties it if the size changed
+void resizeScreenGrid(ScreenGrid *grid, int screen_width, int screen_height)
+{
+    int width = (screen_width + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
+    int height = (screen_height + SCREEN_GRID_SIZE_PX - 1) / SCREEN_GRID_SIZE_PX;
+    if (grid->heads && width == grid->width && height == grid->height) return;
+    grid->width = width;
+    grid->height = height;
+    grid->heads = realloc(grid->heads, width * height * sizeof(int32_t));
+    memset(grid->heads, -1, width * height * sizeof(int32_t));
+    grid->marked_words = (width * height + 63) / 64;
+    grid->marked = realloc(grid->marked, grid->marked_words * sizeof(uint64_t));
+    memset(grid->marked, 0, grid->marked_words * sizeof(uint64_t));
+    grid->entry_count = 0;
+    grid->frame++;
+}
+
+void clearScreenGrid(ScreenGrid *grid)
+{
+    for (size_t i = 0; i < grid->marked_words; i++)
+    {
+        for (uint64_t word = grid->marked[i]; word; word &= word - 1)
+        {
+            grid->heads[i * 64 + __builtin_ctzll(word)] = -1;
+        }
+        grid->marked[i] = 0;
+    }
+    grid->entry_count = 0;
+    grid->frame++;
+}
+
+ScreenGridRange screenGridRange(ScreenGrid *grid, SDL_Rect rectangle)
+{
+    return (ScreenGridRange) {
+        clamp(rectangle.x / SCREEN_GRID_SIZE_PX, 0, grid->width - 1),
+        clamp((rectangle.x + rectangle.w) / SCREEN_GRID_SIZE_PX, 0, grid->width - 1),
+        clamp(rectangle.y / SCREEN_GRID_SIZE_PX, 0, grid->height - 1),
+        clamp((rectangle.y + rectangle.h) / SCREEN_GRID_SIZE_PX, 0, grid->height - 1) };
+}
+
+int screenGridSquareMarked(ScreenGrid *grid, int x, int y)
+{
+    size_t square = x + y * grid->width;
+    return (grid->marked[square / 64] >> (square % 64)) & 1;
+}
+
+// Adds texture_data to every square that bounds touches, once a frame
+void markScreenGrid(ScreenGrid *grid, SDL_Rect bounds, TextureData *texture_data)
+{
+    if (texture_data->screen_grid_frame == grid->frame) return;
+    texture_data->screen_grid_frame = grid->frame;
+    ScreenGridRange range = screenGridRange(grid, bounds);
+    size_t needed = grid->entry_count + (range.max_x - range.min_x + 1) * (range.max_y - range.min_y + 1);
+    if (needed > grid->entry_capacity)
+    {
+        grid->entry_capacity = (needed > 2 * grid->entry_capacity) ? needed : 2 * grid->entry_capacity;
+        grid->entries = realloc(grid->entries, grid->entry_capacity * sizeof(ScreenGridEntry));
+    }
+    for (int y = range.min_y; y <= range.max_y; y++)
+    {
+        for (int x = range.min_x; x <= range.max_x; x++)
+        {
+            size_t square = x + y * grid->width;
+            grid->entries[grid->entry_count] = (ScreenGridEntry) { texture_data, grid->heads[square] };
+            grid->heads[square] = grid->entry_count++;
+            grid->marked[square / 64] |= 1ull << (square % 64);
+        }
+    }
+}
+
+void freeScreenGrid(ScreenGrid *grid)
+{
+    free(grid->heads);
+    free(grid->marked);
+    free(grid->entries);
+    *grid = (ScreenGrid) { 0 };
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "vector.h"
+#include "entity_store.h"
+
+// Steps the game forward at a fixed SIMULATION_TICKS_PER_SECOND, however long frames take to draw.
+// The main loop adds the time that has passed to the accumulator every frame and runs as many
+// ticks as fit in it, then draws once. A slow frame just means more ticks before the next draw,
+// and a fast one means none at all.
+// After every tick the entities' positions are copied into a snapshot, keeping the one before it,
+// and drawing happens at a point between the two so that movement stays smooth even when the
+// display runs faster or slower than the ticks.
+
+#define SIMULATION_TICKS_PER_SECOND 30
+// after a long stall, like dragging the window, this many ticks are run and the rest of the time is dropped
+#define SIMULATION_MAX_TICKS_PER_FRAME 5
+
+// The entities as they were at the end of a tick, by entity index. The handles say which entity
+// each position belongs to, since destroying entities moves others to different indices.
+typedef struct EntitySnapshot
+{
+    Vector3 *positions;
+    EntityHandle *handles;
+    uint32_t count, capacity;
+} EntitySnapshot;
+
+typedef struct Simulation
+{
+    // SDL_GetPerformanceCounter ticks
+    uint64_t tick_length;
+    uint64_t accumulator;
+    uint64_t last_time;
+    uint32_t tick;
+    EntitySnapshot previous, current;
+    // the positions drawLevel sees while drawing, see beginInterpolatedDraw
+    Vector3 *draw_positions;
+    Vector3 *live_positions;
+    uint32_t draw_capacity;
+    // for keeping an eye on things, ticks dropped after stalls
+    uint32_t ticks_dropped;
+} Simulation;
+
+Simulation makeSimulation()
+{
+    return (Simulation) { .tick_length = SDL_GetPerformanceFrequency() / SIMULATION_TICKS_PER_SECOND,
+        .last_time = SDL_GetPerformanceCounter() };
+}
+
+void takeEntitySnapshot(EntitySnapshot *snapshot, EntityStore *store)
+{
+    if (snapshot->capacity < store->count)
+    {
+        snapshot->capacity = store->capacity;
+        snapshot->positions = realloc(snapshot->positions, snapshot->capacity * sizeof(Vector3));
+        snapshot->handles = realloc(snapshot->handles, snapshot->capacity * sizeof(EntityHandle));
+    }
+    memcpy(snapshot->positions, store->positions, store->count * sizeof(Vector3));
+    memcpy(snapshot->handles, store->handles, store->count * sizeof(EntityHandle));
+    snapshot->count = store->count;
+}
+
+// Adds the time since the last call and returns how many ticks are due, to be run with
+// endSimulationTick after each one
+int simulationTicksDue(Simulation *simulation)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    simulation->accumulator += now - simulation->last_time;
+    simulation->last_time = now;
+    uint64_t due = simulation->accumulator / simulation->tick_length;
+    if (due > SIMULATION_MAX_TICKS_PER_FRAME)
+    {
+        simulation->ticks_dropped += due - SIMULATION_MAX_TICKS_PER_FRAME;
+        simulation->accumulator -= (due - SIMULATION_MAX_TICKS_PER_FRAME) * simulation->tick_length;
+        due = SIMULATION_MAX_TICKS_PER_FRAME;
+    }
+    return due;
+}
+
+void endSimulationTick(Simulation *simulation, EntityStore *store)
+{
+    EntitySnapshot previous = simulation->previous;
+    simulation->previous = simulation->current;
+    simulation->current = previous;
+    takeEntitySnapshot(&simulation->current, store);
+    simulation->accumulator -= simulation->tick_length;
+    simulation->tick++;
+}
+
+// How far between the last two ticks to draw, from 0 to 1
+double simulationAlpha(Simulation *simulation)
+{
+    double alpha = (double)simulation->accumulator / simulation->tick_length;
+    return (alpha > 1) ? 1 : alpha;
+}
+
+// Points store->positions at positions between the last two snapshots until endInterpolatedDraw.
+// Only entities that are still where the last tick left them are moved, anything that was moved
+// since, like the editor cursor following the mouse, is drawn where it is.
+// Nothing may move entities in between, the spatial grid still has them where they really are.
+void beginInterpolatedDraw(Simulation *simulation, EntityStore *store)
+{
+    if (simulation->draw_capacity < store->count)
+    {
+        simulation->draw_capacity = store->capacity;
+        simulation->draw_positions = realloc(simulation->draw_positions, simulation->draw_capacity * sizeof(Vector3));
+    }
+    double alpha = simulationAlpha(simulation);
+    EntitySnapshot *previous = &simulation->previous, *current = &simulation->current;
+    for (uint32_t i = 0; i < store->count; i++)
+    {
+        Vector3 position = store->positions[i];
+        simulation->draw_positions[i] = position;
+        if (i >= current->count || i >= previous->count) continue;
+        if (current->handles[i] != store->handles[i] || previous->handles[i] != store->handles[i]) continue;
+        Vector3 to = current->positions[i];
+        if (position.x != to.x || position.y != to.y || position.z != to.z) continue;
+        Vector3 from = previous->positions[i];
+        simulation->draw_positions[i] = (Vector3) { from.x + (int)((to.x - from.x) * alpha),
+            from.y + (int)((to.y - from.y) * alpha), from.z + (int)((to.z - from.z) * alpha) };
+    }
+    simulation->live_positions = store->positions;
+    store->positions = simulation->draw_positions;
+}
+
+void endInterpolatedDraw(Simulation *simulation, EntityStore *store)
+{
+    store->positions = simulation->live_positions;
+}
+
+void freeSimulation(Simulation *simulation)
+{
+    free(simulation->previous.positions);
+    free(simulation->previous.handles);
+    free(simulation->current.positions);
+    free(simulation->current.handles);
+    free(simulation->draw_positions);
+    *simulation = (Simulation) { 0 };
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+
+// A spatial index that maps each cell of a bounded level to the entities in it.
+// Every column of the level, all the cells with the same x and z, has one list of the entities
+// in it, and each node remembers which height it is at, so lookups are just index math instead of hashing.
+// Entities are only ever a cell or two tall, so the lists stay short, and the heads of a whole level
+// take a 16th of what one per cell would, which keeps what a tick touches in the cache.
+// The column heads are split into squares of SPATIAL_GRID_CHUNK_SIZE columns, which are only allocated
+// once something is put in them, which keeps big, mostly empty maps cheap.
+// The lists themselves are singly linked through a shared pool of nodes, addressed by index.
+// Entities are stored by their 32-bit EntityHandle, never by pointer.
+
+#define SPATIAL_GRID_CHUNK_BITS 4
+#define SPATIAL_GRID_CHUNK_SIZE (1 << SPATIAL_GRID_CHUNK_BITS)
+#define SPATIAL_GRID_CHUNK_AREA (SPATIAL_GRID_CHUNK_SIZE * SPATIAL_GRID_CHUNK_SIZE)
+// node 0 is never handed out, so a head or next of 0 ends the list
+#define SPATIAL_GRID_NO_NODE 0
+
+typedef struct SpatialGridNode
+{
+    uint32_t entity;
+    uint32_t next;
+    // the height of the cell, the column gives x and z
+    int y;
+} SpatialGridNode;
+
+typedef struct SpatialGridChunk
+{
+    uint32_t heads[SPATIAL_GRID_CHUNK_AREA];
+} SpatialGridChunk;
+
+typedef struct SpatialGrid
+{
+    Vector3 size;
+    Vector3 chunk_count;
+    // NULL until a cell inside the chunk gets an entity
+    SpatialGridChunk **chunks;
+    SpatialGridNode *nodes;
+    uint32_t node_capacity;
+    uint32_t node_count;
+    // removed nodes are chained through next
+    uint32_t free_nodes;
+} SpatialGrid;
+
+void createSpatialGrid(SpatialGrid *grid, Vector3 size)
+{
+    grid->size = size;
+    grid->chunk_count.x = (size.x + SPATIAL_GRID_CHUNK_SIZE - 1) / SPATIAL_GRID_CHUNK_SIZE;
+    // chunks are whole columns
+    grid->chunk_count.y = 1;
+    grid->chunk_count.z = (size.z + SPATIAL_GRID_CHUNK_SIZE - 1) / SPATIAL_GRID_CHUNK_SIZE;
+    grid->chunks = calloc((size_t)grid->chunk_count.x * grid->chunk_count.z, sizeof(SpatialGridChunk *));
+    grid->node_capacity = 256;
+    grid->nodes = malloc(grid->node_capacity * sizeof(SpatialGridNode));
+    grid->node_count = 1;
+    grid->free_nodes = SPATIAL_GRID_NO_NODE;
+}
+
+void freeSpatialGrid(SpatialGrid *grid)
+{
+    size_t chunk_total = (size_t)grid->chunk_count.x * grid->chunk_count.z;
+    for (size_t i = 0; i < chunk_total; i++) free(grid->chunks[i]);
+    free(grid->chunks);
+    free(grid->nodes);
+    *grid = (SpatialGrid) { 0 };
+}
+
+int spatialGridContains(SpatialGrid *grid, Vector3 cell)
+{
+    return cell.x >= 0 && cell.x < grid->size.x
+        && cell.y >= 0 && cell.y < grid->size.y
+        && cell.z >= 0 && cell.z < grid->size.z;
+}
+
+// the cell has to be inside the grid
+size_t spatialGridChunkIndex(SpatialGrid *grid, Vector3 cell)
+{
+    // everything is known to be positive, so shifts are enough
+    return ((uint32_t)cell.x >> SPATIAL_GRID_CHUNK_BITS) + (size_t)((uint32_t)cell.z >> SPATIAL_GRID_CHUNK_BITS) * grid->chunk_count.x;
+}
+
+// the head of the list for the cell's column
+uint32_t *spatialGridChunkHead(SpatialGridChunk *chunk, Vector3 cell)
+{
+    uint32_t mask = SPATIAL_GRID_CHUNK_SIZE - 1;
+    return &chunk->heads[(cell.x & mask) | (cell.z & mask) << SPATIAL_GRID_CHUNK_BITS];
+}
+
+// orders cells the way they are laid out in memory, chunk by chunk and column by column
+uint64_t spatialGridCellKey(SpatialGrid *grid, Vector3 cell)
+{
+    uint32_t mask = SPATIAL_GRID_CHUNK_SIZE - 1;
+    uint64_t column = (uint64_t)spatialGridChunkIndex(grid, cell) * SPATIAL_GRID_CHUNK_AREA
+        + ((cell.x & mask) | (cell.z & mask) << SPATIAL_GRID_CHUNK_BITS);
+    return column * grid->size.y + cell.y;
+}
+
+// returns NULL if the cell is out of bounds or nothing has been put in its chunk yet
+uint32_t *spatialGridFindHead(SpatialGrid *grid, Vector3 cell)
+{
+    if (!spatialGridContains(grid, cell)) return NULL;
+    SpatialGridChunk *chunk = grid->chunks[spatialGridChunkIndex(grid, cell)];
+    return chunk ? spatialGridChunkHead(chunk, cell) : NULL;
+}
+
+// like spatialGridFindHead, but makes the chunk if it doesn't exist yet
+uint32_t *spatialGridMakeHead(SpatialGrid *grid, Vector3 cell)
+{
+    if (!spatialGridContains(grid, cell)) return NULL;
+    SpatialGridChunk **chunk = &grid->chunks[spatialGridChunkIndex(grid, cell)];
+    // calloc leaves every head as SPATIAL_GRID_NO_NODE
+    if (!*chunk) *chunk = calloc(1, sizeof(SpatialGridChunk));
+    return spatialGridChunkHead(*chunk, cell);
+}
+
+uint32_t allocateSpatialGridNode(SpatialGrid *grid)
+{
+    if (grid->free_nodes != SPATIAL_GRID_NO_NODE)
+    {
+        uint32_t node = grid->free_nodes;
+        grid->free_nodes = grid->nodes[node].next;
+        return node;
+    }
+    if (grid->node_count == grid->node_capacity)
+    {
+        grid->node_capacity *= 2;
+        grid->nodes = realloc(grid->nodes, grid->node_capacity * sizeof(SpatialGridNode));
+    }
+    return grid->node_count++;
+}
+
+// returns 0 if the cell is outside the grid
+int spatialGridInsert(SpatialGrid *grid, Vector3 cell, uint32_t entity)
+{
+    uint32_t *head = spatialGridMakeHead(grid, cell);
+    if (!head) return 0;
+    uint32_t node = allocateSpatialGridNode(grid);
+    grid->nodes[node] = (SpatialGridNode) { entity, *head, cell.y };
+    *head = node;
+    return 1;
+}
+
+// Removes entity from the cell. Like removeFromTableByValue, returns how many entities
+// were in the cell before the removal, or 0 if the entity wasn't there.
+int spatialGridRemove(SpatialGrid *grid, Vector3 cell, uint32_t entity)
+{
+    uint32_t *head = spatialGridFindHead(grid, cell);
+    if (!head) return 0;
+    int count = 0;
+    uint32_t *link = NULL;
+    for (uint32_t *next = head; *next != SPATIAL_GRID_NO_NODE; next = &grid->nodes[*next].next)
+    {
+        if (grid->nodes[*next].y != cell.y) continue;
+        if (!link && grid->nodes[*next].entity == entity) link = next;
+        count++;
+    }
+    if (!link) return 0;
+    uint32_t node = *link;
+    *link = grid->nodes[node].next;
+    grid->nodes[node].next = grid->free_nodes;
+    grid->free_nodes = node;
+    return count;
+}
+
+size_t spatialGridQuery(SpatialGrid *grid, Vector3 cell, uint32_t *return_buffer, size_t buffer_size)
+{
+    uint32_t *head = spatialGridFindHead(grid, cell);
+    if (!head) return 0;
+    size_t index = 0;
+    for (uint32_t node = *head; node != SPATIAL_GRID_NO_NODE && index < buffer_size; node = grid->nodes[node].next)
+    {
+        if (grid->nodes[node].y == cell.y) return_buffer[index++] = grid->nodes[node].entity;
+    }
+    return index;
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include "vector.h"
+#include "level.h"
+#include "entity.h"
+#include "textures_generated.h"
+#include "tile_batch.h"
+
+// Terrain hardly ever changes, so rather than drawing every tile every frame, the tiles of each chunk
+// are drawn once into a texture of their own, and a frame starts out by copying those into place.
+// A chunk is drawn again when its revision changes, which setTileAt takes care of.
+// The chunk textures go down back to front in q-bert order of the chunks themselves. That works out
+// for the same reason it does for tiles, since every tile is drawn inside its chunk's cube.
+
+#define TERRAIN_CACHE_SLOTS 96
+// where the chunk's first cell goes in its texture, the cells furthest left and up are this far from it
+#define TERRAIN_CHUNK_ORIGIN_X ((LEVEL_CHUNK_SIZE - 1) * TILE_HALF_WIDTH_PX)
+#define TERRAIN_CHUNK_ORIGIN_Y ((LEVEL_CHUNK_SIZE - 1) * TILE_HEIGHT_PX)
+
+typedef struct TerrainChunkTexture
+{
+    SDL_Texture *texture;
+    uint32_t chunk_index;
+    uint32_t revision;
+    // the frame it was last drawn in, the slot that has gone unused longest is the one that gets reused
+    uint32_t last_used;
+    int valid;
+} TerrainChunkTexture;
+
+typedef struct TerrainCache
+{
+    TerrainChunkTexture slots[TERRAIN_CACHE_SLOTS];
+    // the level the textures are of, everything is drawn again when a different one shows up
+    uint32_t *level_revisions;
+    int tile_width, tile_height;
+    int chunk_width, chunk_height;
+    uint32_t frame;
+    // for keeping an eye on things, chunks copied to the screen and chunks drawn tile by tile
+    uint32_t chunks_copied, chunks_drawn;
+} TerrainCache;
+
+TerrainCache makeTerrainCache(int tile_width, int tile_height)
+{
+    return (TerrainCache) { .tile_width = tile_width, .tile_height = tile_height,
+        .chunk_width = 2 * TERRAIN_CHUNK_ORIGIN_X + tile_width,
+        .chunk_height = TERRAIN_CHUNK_ORIGIN_Y + 2 * (LEVEL_CHUNK_SIZE - 1) * TILE_HALF_DEPTH_PX + tile_height };
+}
+
+// for when the textures' contents are lost, like after SDL_RENDER_TARGETS_RESET
+void invalidateTerrainCache(TerrainCache *cache)
+{
+    for (int i = 0; i < TERRAIN_CACHE_SLOTS; i++) cache->slots[i].valid = 0;
+}
+
+void freeTerrainCache(TerrainCache *cache)
+{
+    for (int i = 0; i < TERRAIN_CACHE_SLOTS; i++)
+    {
+        if (cache->slots[i].texture) SDL_DestroyTexture(cache->slots[i].texture);
+    }
+    *cache = makeTerrainCache(cache->tile_width, cache->tile_height);
+}
+
+// Draws a chunk's tiles in q-bert order, with its first cell at origin_x, origin_y on the current render target.
+// They all go out in one batch.
+void drawTerrainChunkTiles(SDL_Renderer *renderer, Level *level, Vector3 chunk, int origin_x, int origin_y, int tile_width, int tile_height)
+{
+    Vector3 start = { chunk.x * LEVEL_CHUNK_SIZE, chunk.y * LEVEL_CHUNK_SIZE, chunk.z * LEVEL_CHUNK_SIZE };
+    // chunks on the far edges can stick out of the level
+    Vector3 last = clampVector3(addVector3(start, (Vector3) { LEVEL_CHUNK_SIZE - 1, LEVEL_CHUNK_SIZE - 1, LEVEL_CHUNK_SIZE - 1 }), (Vector3) { 0, 0, 0 }, level->size);
+    Vector3 extent = subtractVector3(last, start);
+    LevelTileReader reader = makeLevelTileReader(level);
+    for (int a = 0; a <= componentSum(extent); a++)
+    {
+        for (int b = 0; b <= min(a, extent.y); b++)
+        {
+            for (int c = -min(0, -(a - b - extent.z)); c <= min(a - b, extent.x); c++)
+            {
+                Vector3 local = { c, b, a - b - c };
+                uint8_t tile = readTile(&reader, start.x + local.x, start.y + local.y, start.z + local.z);
+                if (!tile) continue;
+                SDL_Rect destination_rectangle = { origin_x + (local.x - local.z) * TILE_HALF_WIDTH_PX,
+                    origin_y - local.y * TILE_HEIGHT_PX + (local.x + local.z) * TILE_HALF_DEPTH_PX, tile_width, tile_height };
+                batchTile(&tile_batch, tile, destination_rectangle);
+            }
+        }
+    }
+    flushTileBatch(&tile_batch, renderer);
+}
+
+// Finds the texture of a chunk, drawing it if it isn't there or has gone stale.
+// Returns NULL if every slot is already in use this frame.
+SDL_Texture *terrainChunkTexture(TerrainCache *cache, SDL_Renderer *renderer, Level *level, Vector3 chunk, size_t chunk_index)
+{
+    TerrainChunkTexture *slot = NULL;
+    for (int i = 0; i < TERRAIN_CACHE_SLOTS && !slot; i++)
+    {
+        if (cache->slots[i].valid && cache->slots[i].chunk_index == chunk_index) slot = &cache->slots[i];
+    }
+    if (slot && slot->revision == level->chunk_revisions[chunk_index])
+    {
+        slot->last_used = cache->frame;
+        return slot->texture;
+    }
+    if (!slot)
+    {
+        for (int i = 0; i < TERRAIN_CACHE_SLOTS; i++)
+        {
+            TerrainChunkTexture *candidate = &cache->slots[i];
+            if (!candidate->valid) { slot = candidate; break; }
+            if (candidate->last_used != cache->frame && (!slot || candidate->last_used < slot->last_used)) slot = candidate;
+        }
+        if (!slot) return NULL;
+    }
+    if (!slot->texture)
+    {
+        slot->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, cache->chunk_width, cache->chunk_height);
+        if (!slot->texture) return NULL;
+        SDL_SetTextureBlendMode(slot->texture, SDL_BLENDMODE_BLEND);
+    }
+
+    SDL_Texture *last_target = SDL_GetRenderTarget(renderer);
+    uint8_t red, green, blue, alpha;
+    SDL_GetRenderDrawColor(renderer, &red, &green, &blue, &alpha);
+    SDL_SetRenderTarget(renderer, slot->texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    drawTerrainChunkTiles(renderer, level, chunk, TERRAIN_CHUNK_ORIGIN_X, TERRAIN_CHUNK_ORIGIN_Y, cache->tile_width, cache->tile_height);
+    SDL_SetRenderDrawColor(renderer, red, green, blue, alpha);
+    SDL_SetRenderTarget(renderer, last_target);
+
+    slot->chunk_index = chunk_index;
+    slot->revision = level->chunk_revisions[chunk_index];
+    slot->last_used = cache->frame;
+    slot->valid = 1;
+    cache->chunks_drawn++;
+    return slot->texture;
+}
+
+// Draws the terrain of every chunk that has a cell from min to max onto the current render target,
+// which is screen_width by screen_height. The chunks have to be loaded, which prepareLevelSolidity does.
+void drawTerrain(TerrainCache *cache, SDL_Renderer *renderer, Level *level, Vector3 min, Vector3 max,
+    int camera_x, int camera_y, int screen_width, int screen_height)
+{
+    if (cache->level_revisions != level->chunk_revisions)
+    {
+        invalidateTerrainCache(cache);
+        cache->level_revisions = level->chunk_revisions;
+    }
+    cache->frame++;
+    min = clampVector3(min, (Vector3) { 0, 0, 0 }, level->size);
+    max = clampVector3(max, (Vector3) { 0, 0, 0 }, level->size);
+    Vector3 chunk_min = { min.x >> LEVEL_CHUNK_BITS, min.y >> LEVEL_CHUNK_BITS, min.z >> LEVEL_CHUNK_BITS };
+    Vector3 chunk_max = { max.x >> LEVEL_CHUNK_BITS, max.y >> LEVEL_CHUNK_BITS, max.z >> LEVEL_CHUNK_BITS };
+    for (int sum = componentSum(chunk_min); sum <= componentSum(chunk_max); sum++)
+    {
+        for (int chunk_y = chunk_min.y; chunk_y <= chunk_max.y; chunk_y++)
+        {
+            for (int chunk_z = chunk_min.z; chunk_z <= chunk_max.z; chunk_z++)
+            {
+                Vector3 chunk = { sum - chunk_y - chunk_z, chunk_y, chunk_z };
+                if (chunk.x < chunk_min.x || chunk.x > chunk_max.x) continue;
+                size_t chunk_index = chunk.x + chunk.z * level->chunk_count.x + chunk.y * level->chunk_count.x * level->chunk_count.z;
+                LevelChunk *level_chunk = &level->chunks[chunk_index];
+                if (level_chunk->kind == LEVEL_CHUNK_UNIFORM && !level_chunk->tiles[0]) continue;
+
+                int origin_x, origin_y;
+                worldToScreen((Vector3) { chunk.x * LEVEL_CHUNK_SIZE, chunk.y * LEVEL_CHUNK_SIZE, chunk.z * LEVEL_CHUNK_SIZE },
+                    camera_x, camera_y, &origin_x, &origin_y);
+                SDL_Rect destination_rectangle = { origin_x - TERRAIN_CHUNK_ORIGIN_X, origin_y - TERRAIN_CHUNK_ORIGIN_Y, cache->chunk_width, cache->chunk_height };
+                if (destination_rectangle.x >= screen_width || destination_rectangle.y >= screen_height
+                    || destination_rectangle.x + destination_rectangle.w <= 0 || destination_rectangle.y + destination_rectangle.h <= 0) continue;
+
+                SDL_Texture *texture = terrainChunkTexture(cache, renderer, level, chunk, chunk_index);
+                if (texture)
+                {
+                    SDL_RenderCopy(renderer, texture, NULL, &destination_rectangle);
+                    cache->chunks_copied++;
+                }
+                // more chunks on screen than there are slots, so this one goes straight to the screen
+                else drawTerrainChunkTiles(renderer, level, chunk, origin_x, origin_y, cache->tile_width, cache->tile_height);
+            }
+        }
+    }
+}
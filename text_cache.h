@@ -1,3 +1,4 @@
+#pragma once
 #include <string.h>
 #include <stdint.h>
 #include <SDL2/SDL.h>
@@ -31,9 +32,8 @@ typedef struct
 TextCache makeTextCache(size_t size)
 {
     assert(size > 0);
-    BlockPage page;
-    makePage(&page, size, sizeof(HashItem));
-    HashTable table = { calloc(size, sizeof(HashItem *)), NULL, page, size, 0 }; 
+    HashTable table;
+    makeHashTable(&table, size);
     return (TextCache) { .size = size, .count = 0, .total_added = 0, .elements = calloc(size, sizeof(TextCacheElement)),
          .table = table, .min_heap = (Heap) { .max_size = size, .count = 0, .pairs = calloc(size, sizeof(KeyValuePair))}};
 }
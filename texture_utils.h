@@ -39,4 +39,52 @@ int invertMask(SDL_Surface *surface)
     }
     SDL_UnlockSurface(surface);
     return 1;
-}
\ No newline at end of file
+}
+
+// A copy of surface in the same format, or NULL if there is nothing to copy
+SDL_Surface *copySurface(SDL_Surface *surface)
+{
+    if (!surface) return NULL;
+    return SDL_ConvertSurface(surface, surface->format, 0);
+}
+
+// Packs the surfaces into one texture, left to right in rows, with a pixel of space around each so
+// nothing bleeds into its neighbours. rects gets where each surface ended up, NULL surfaces get an
+// empty rect. The atlas is at most TEXTURE_ATLAS_MAX_WIDTH wide and as tall as it needs to be.
+#define TEXTURE_ATLAS_MAX_WIDTH 1024
+SDL_Texture *packTextureAtlas(SDL_Renderer *renderer, SDL_Surface **surfaces, SDL_Rect *rects, int count, int *width, int *height)
+{
+    int x = 1, y = 1, row_height = 0;
+    *width = 0;
+    for (int i = 0; i < count; i++)
+    {
+        rects[i] = (SDL_Rect) { 0, 0, 0, 0 };
+        if (!surfaces[i]) continue;
+        if (x + surfaces[i]->w + 1 > TEXTURE_ATLAS_MAX_WIDTH && x > 1)
+        {
+            x = 1;
+            y += row_height + 1;
+            row_height = 0;
+        }
+        rects[i] = (SDL_Rect) { x, y, surfaces[i]->w, surfaces[i]->h };
+        x += surfaces[i]->w + 1;
+        if (x > *width) *width = x;
+        if (surfaces[i]->h > row_height) row_height = surfaces[i]->h;
+    }
+    *height = y + row_height + 1;
+    if (!*width) return NULL;
+
+    SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, *width, *height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!atlas) return NULL;
+    for (int i = 0; i < count; i++)
+    {
+        if (!surfaces[i]) continue;
+        // copy the alpha over as is instead of blending onto the empty atlas
+        SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(surfaces[i], NULL, atlas, &rects[i]);
+    }
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, atlas);
+    SDL_FreeSurface(atlas);
+    if (texture) SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return texture;
+}
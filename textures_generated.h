@@ -1,8 +1,10 @@
 #pragma once
 #include "texture_utils.h"
 SDL_Texture *tile_textures[256] = { NULL };
-SDL_Texture *tile_mask_textures[256] = { NULL }; 
-SDL_Texture *tile_inverted_mask_textures[256] = { NULL }; 
+SDL_Texture *tile_atlas = NULL;
+int tile_atlas_width, tile_atlas_height;
+SDL_Rect tile_atlas_rects[256] = { 0 };
+SDL_Rect tile_mask_atlas_rects[256] = { 0 };
 enum
 {
 	AIR_TILE,
@@ -19,98 +21,82 @@ enum
 	STONE_BRICKS_TILE,
 	WATER_TILE
 };
+#define TILE_TYPE_COUNT 13
 void loadAllTextures(SDL_Renderer *renderer)
 {
 	SDL_Surface *temp_surface;
+	SDL_Surface *atlas_surfaces[2 * TILE_TYPE_COUNT];
+	SDL_Rect atlas_rects[2 * TILE_TYPE_COUNT];
 	temp_surface = SDL_LoadBMP("tiles/air.bmp");
 	tile_textures[AIR_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * AIR_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[AIR_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[AIR_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * AIR_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/cobble.bmp");
 	tile_textures[COBBLE_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * COBBLE_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[COBBLE_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[COBBLE_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * COBBLE_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/grass.bmp");
 	tile_textures[GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * GRASS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * GRASS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/grass_rocks.bmp");
 	tile_textures[GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * GRASS_ROCKS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * GRASS_ROCKS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/hot_grass.bmp");
 	tile_textures[HOT_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * HOT_GRASS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[HOT_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[HOT_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * HOT_GRASS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/hot_grass_rocks.bmp");
 	tile_textures[HOT_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * HOT_GRASS_ROCKS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[HOT_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[HOT_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * HOT_GRASS_ROCKS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/snow_grass.bmp");
 	tile_textures[SNOW_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * SNOW_GRASS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[SNOW_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[SNOW_GRASS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * SNOW_GRASS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/snow_grass_rocks.bmp");
 	tile_textures[SNOW_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * SNOW_GRASS_ROCKS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[SNOW_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[SNOW_GRASS_ROCKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * SNOW_GRASS_ROCKS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/stone_bricks_1.bmp");
 	tile_textures[STONE_BRICKS_1_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_1_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[STONE_BRICKS_1_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[STONE_BRICKS_1_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_1_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/stone_bricks_2.bmp");
 	tile_textures[STONE_BRICKS_2_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_2_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[STONE_BRICKS_2_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[STONE_BRICKS_2_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_2_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/stone_bricks_3.bmp");
 	tile_textures[STONE_BRICKS_3_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_3_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[STONE_BRICKS_3_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[STONE_BRICKS_3_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_3_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/stone_bricks.bmp");
 	tile_textures[STONE_BRICKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[STONE_BRICKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[STONE_BRICKS_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * STONE_BRICKS_TILE + 1] = temp_surface;
 	temp_surface = SDL_LoadBMP("tiles/water.bmp");
 	tile_textures[WATER_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
+	atlas_surfaces[2 * WATER_TILE] = copySurface(temp_surface);
 	surfaceToMask(temp_surface);
-	tile_mask_textures[WATER_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	invertMask(temp_surface);
-	tile_inverted_mask_textures[WATER_TILE] = SDL_CreateTextureFromSurface(renderer, temp_surface);
-	SDL_FreeSurface(temp_surface);
+	atlas_surfaces[2 * WATER_TILE + 1] = temp_surface;
+	tile_atlas = packTextureAtlas(renderer, atlas_surfaces, atlas_rects, 2 * TILE_TYPE_COUNT, &tile_atlas_width, &tile_atlas_height);
+	for (int i = 0; i < TILE_TYPE_COUNT; i++)
+	{
+		tile_atlas_rects[i] = atlas_rects[2 * i];
+		tile_mask_atlas_rects[i] = atlas_rects[2 * i + 1];
+		for (int j = 0; j < 2; j++) SDL_FreeSurface(atlas_surfaces[2 * i + j]);
+	}
 }
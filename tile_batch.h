@@ -0,0 +1,97 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include "textures_generated.h"
+
+// Tiles all come out of tile_atlas, so instead of a SDL_RenderCopy for each one they are gathered
+// up as quads and drawn with a single SDL_RenderGeometry when the batch is flushed.
+// Quads are drawn in the order they were added, so q-bert order holds within a batch.
+
+typedef struct TileBatch
+{
+    SDL_Vertex *vertices;
+    int *indices;
+    int quad_count, quad_capacity;
+    // for keeping an eye on things
+    uint32_t flushes;
+} TileBatch;
+
+TileBatch tile_batch = { 0 };
+
+// Adds the part of the atlas at source, drawn to destination
+void batchAtlasQuad(TileBatch *batch, SDL_Rect source, SDL_Rect destination)
+{
+    if (batch->quad_count == batch->quad_capacity)
+    {
+        int capacity = batch->quad_capacity ? 2 * batch->quad_capacity : 256;
+        batch->vertices = realloc(batch->vertices, 4 * capacity * sizeof(SDL_Vertex));
+        batch->indices = realloc(batch->indices, 6 * capacity * sizeof(int));
+        // every quad is two triangles over its four corners, so the indices never change
+        for (int i = batch->quad_capacity; i < capacity; i++)
+        {
+            int *quad_indices = &batch->indices[6 * i];
+            quad_indices[0] = 4 * i;
+            quad_indices[1] = 4 * i + 1;
+            quad_indices[2] = 4 * i + 2;
+            quad_indices[3] = 4 * i + 2;
+            quad_indices[4] = 4 * i + 1;
+            quad_indices[5] = 4 * i + 3;
+        }
+        batch->quad_capacity = capacity;
+    }
+    SDL_Vertex *corners = &batch->vertices[4 * batch->quad_count++];
+    float u_min = (float)source.x / tile_atlas_width, u_max = (float)(source.x + source.w) / tile_atlas_width;
+    float v_min = (float)source.y / tile_atlas_height, v_max = (float)(source.y + source.h) / tile_atlas_height;
+    SDL_Color white = { 255, 255, 255, 255 };
+    corners[0] = (SDL_Vertex) { { destination.x, destination.y }, white, { u_min, v_min } };
+    corners[1] = (SDL_Vertex) { { destination.x + destination.w, destination.y }, white, { u_max, v_min } };
+    corners[2] = (SDL_Vertex) { { destination.x, destination.y + destination.h }, white, { u_min, v_max } };
+    corners[3] = (SDL_Vertex) { { destination.x + destination.w, destination.y + destination.h }, white, { u_max, v_max } };
+}
+
+// Adds a whole tile, or nothing if the tile has no texture
+void batchTile(TileBatch *batch, uint8_t tile, SDL_Rect destination)
+{
+    if (tile_atlas_rects[tile].w) batchAtlasQuad(batch, tile_atlas_rects[tile], destination);
+}
+
+// Adds the part of a tile drawn at destination that lands inside of part
+void batchTilePart(TileBatch *batch, uint8_t tile, SDL_Rect destination, SDL_Rect part)
+{
+    SDL_Rect source = tile_atlas_rects[tile];
+    if (!source.w) return;
+    source.x += part.x - destination.x;
+    source.y += part.y - destination.y;
+    source.w = part.w;
+    source.h = part.h;
+    batchAtlasQuad(batch, source, part);
+}
+
+// Draws everything in the batch to the current render target and empties it
+void flushTileBatch(TileBatch *batch, SDL_Renderer *renderer)
+{
+    if (!batch->quad_count) return;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    SDL_RenderGeometry(renderer, tile_atlas, batch->vertices, 4 * batch->quad_count, batch->indices, 6 * batch->quad_count);
+#else
+    // there is no SDL_RenderGeometry before 2.0.18, so the quads go one at a time
+    for (int i = 0; i < batch->quad_count; i++)
+    {
+        SDL_Vertex *corners = &batch->vertices[4 * i];
+        SDL_Rect source = { corners[0].tex_coord.x * tile_atlas_width + 0.5f, corners[0].tex_coord.y * tile_atlas_height + 0.5f,
+            (corners[3].tex_coord.x - corners[0].tex_coord.x) * tile_atlas_width + 0.5f, (corners[3].tex_coord.y - corners[0].tex_coord.y) * tile_atlas_height + 0.5f };
+        SDL_Rect destination = { corners[0].position.x, corners[0].position.y,
+            corners[3].position.x - corners[0].position.x, corners[3].position.y - corners[0].position.y };
+        SDL_RenderCopy(renderer, tile_atlas, &source, &destination);
+    }
+#endif
+    batch->quad_count = 0;
+    batch->flushes++;
+}
+
+void freeTileBatch(TileBatch *batch)
+{
+    free(batch->vertices);
+    free(batch->indices);
+    *batch = (TileBatch) { 0 };
+}
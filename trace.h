@@ -0,0 +1,126 @@
+#pragma once
+#include <SDL2/SDL.h>
+
+// Timing zones, for finding out where the time in a frame goes.
+// TRACE_BEGIN(zone) and TRACE_END(zone) go around some code in the same scope, and record when it
+// started and ended into a ring buffer belonging to the thread that ran it. zone is a plain name,
+// which is also what shows up in the trace, and a return in between has to TRACE_END it first.
+// Only built with -DTRACING, otherwise the macros are empty and none of the rest exists,
+// so the zones can stay in for good.
+// writeChromeTrace dumps every thread's buffer as JSON that chrome://tracing or Perfetto can open.
+
+#ifdef TRACING
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// the most recent events kept for each thread, must be a power of two
+#define TRACE_BUFFER_EVENTS (1 << 16)
+#define TRACE_MAX_THREADS 32
+
+typedef struct TraceEvent
+{
+    const char *name;
+    // SDL_GetPerformanceCounter ticks
+    uint64_t start, end;
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    // how many events have ever been written, only the thread the buffer belongs to changes it
+    _Atomic uint64_t written;
+    SDL_threadID thread_id;
+} TraceBuffer;
+
+// buffers are handed out to threads the first time they record something and never freed
+TraceBuffer *_Atomic trace_buffers[TRACE_MAX_THREADS];
+_Atomic int trace_buffer_count = 0;
+_Thread_local TraceBuffer *trace_thread_buffer = NULL;
+_Thread_local int trace_thread_untraced = 0;
+
+TraceBuffer *traceThreadBuffer()
+{
+    if (trace_thread_buffer || trace_thread_untraced) return trace_thread_buffer;
+    int slot = atomic_fetch_add(&trace_buffer_count, 1);
+    TraceBuffer *buffer = (slot < TRACE_MAX_THREADS) ? calloc(1, sizeof(TraceBuffer)) : NULL;
+    // out of slots, this thread goes untraced
+    if (!buffer)
+    {
+        trace_thread_untraced = 1;
+        return NULL;
+    }
+    buffer->thread_id = SDL_ThreadID();
+    atomic_store(&trace_buffers[slot], buffer);
+    return trace_thread_buffer = buffer;
+}
+
+void traceRecord(const char *name, uint64_t start, uint64_t end)
+{
+    TraceBuffer *buffer = traceThreadBuffer();
+    if (!buffer) return;
+    uint64_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    buffer->events[written & (TRACE_BUFFER_EVENTS - 1)] = (TraceEvent) { name, start, end };
+    atomic_store_explicit(&buffer->written, written + 1, memory_order_release);
+}
+
+// Copies the events of buffer that are still there, oldest first, and returns how many.
+// The thread can keep recording while this runs, anything it might have written over is left out.
+size_t copyTraceEvents(TraceBuffer *buffer, TraceEvent *events)
+{
+    uint64_t written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+    uint64_t first = (written > TRACE_BUFFER_EVENTS) ? written - TRACE_BUFFER_EVENTS : 0;
+    for (uint64_t i = first; i < written; i++) events[i - first] = buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+    // the slot of the event being written after the last one we saw is also the slot of the oldest
+    uint64_t still_there = atomic_load_explicit(&buffer->written, memory_order_acquire) + 1;
+    still_there = (still_there > TRACE_BUFFER_EVENTS) ? still_there - TRACE_BUFFER_EVENTS : 0;
+    if (still_there <= first) return written - first;
+    if (still_there >= written) return 0;
+    memmove(events, &events[still_there - first], (written - still_there) * sizeof(TraceEvent));
+    return written - still_there;
+}
+
+// Writes every thread's events to path in the Chrome trace event format, returns 0 if it couldn't
+int writeChromeTrace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+    TraceEvent *events = malloc(TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+    if (!events)
+    {
+        fclose(file);
+        return 0;
+    }
+    double microseconds_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+    int thread_count = atomic_load(&trace_buffer_count);
+    if (thread_count > TRACE_MAX_THREADS) thread_count = TRACE_MAX_THREADS;
+    fprintf(file, "{\"traceEvents\":[\n");
+    int first_event = 1;
+    for (int i = 0; i < thread_count; i++)
+    {
+        TraceBuffer *buffer = atomic_load(&trace_buffers[i]);
+        if (!buffer) continue;
+        size_t count = copyTraceEvents(buffer, events);
+        for (size_t j = 0; j < count; j++)
+        {
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                first_event ? "" : ",\n", events[j].name, (unsigned long)buffer->thread_id,
+                events[j].start * microseconds_per_tick, (events[j].end - events[j].start) * microseconds_per_tick);
+            first_event = 0;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    free(events);
+    return fclose(file) == 0;
+}
+
+#define TRACE_BEGIN(zone) uint64_t trace_start_##zone = SDL_GetPerformanceCounter()
+#define TRACE_END(zone) traceRecord(#zone, trace_start_##zone, SDL_GetPerformanceCounter())
+
+#else
+
+#define TRACE_BEGIN(zone)
+#define TRACE_END(zone)
+
+#endif
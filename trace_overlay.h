@@ -0,0 +1,74 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <string.h>
+#include "trace.h"
+#include "text_cache.h"
+
+// Draws the zones of the last whole frame this thread traced, as bars across area, with a bar's
+// row being how many other zones it's inside of. The frame is the latest zone called frame, and
+// area is budget_ticks wide, so anything past the right edge went over.
+
+#ifdef TRACING
+#define TRACE_OVERLAY_MAX_ZONES 64
+
+TraceEvent trace_overlay_events[TRACE_OVERLAY_MAX_ZONES];
+
+void drawTraceOverlay(SDL_Renderer *renderer, TextCache *text_cache, TTF_Font *font, SDL_Rect area, uint64_t budget_ticks)
+{
+    TraceBuffer *buffer = traceThreadBuffer();
+    if (!buffer) return;
+    uint64_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    uint64_t oldest = (written > TRACE_BUFFER_EVENTS) ? written - TRACE_BUFFER_EVENTS : 0;
+    // zones are written when they end, so the ones inside of the frame come right before it
+    uint64_t frame_index = written;
+    for (uint64_t i = written; i > oldest; i--)
+    {
+        if (!strcmp(buffer->events[(i - 1) & (TRACE_BUFFER_EVENTS - 1)].name, "frame"))
+        {
+            frame_index = i - 1;
+            break;
+        }
+    }
+    if (frame_index == written) return;
+    TraceEvent frame = buffer->events[frame_index & (TRACE_BUFFER_EVENTS - 1)];
+    int count = 0;
+    trace_overlay_events[count++] = frame;
+    for (uint64_t i = frame_index; i > oldest && count < TRACE_OVERLAY_MAX_ZONES; i--)
+    {
+        TraceEvent event = buffer->events[(i - 1) & (TRACE_BUFFER_EVENTS - 1)];
+        if (event.start < frame.start) break;
+        trace_overlay_events[count++] = event;
+    }
+
+    int row_height = area.h / 8;
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 128);
+    SDL_RenderFillRect(renderer, &area);
+    for (int i = 0; i < count; i++)
+    {
+        TraceEvent event = trace_overlay_events[i];
+        int depth = 0;
+        for (int j = 0; j < count; j++)
+        {
+            if (j != i && trace_overlay_events[j].start <= event.start && trace_overlay_events[j].end >= event.end
+                && (trace_overlay_events[j].end - trace_overlay_events[j].start > event.end - event.start || j < i)) depth++;
+        }
+        SDL_Rect bar = { area.x + (event.start - frame.start) * area.w / budget_ticks, area.y + depth * row_height,
+            (event.end - event.start) * area.w / budget_ticks + 1, row_height - 1 };
+        // a color for each name that stays the same from frame to frame
+        uint64_t color = hashString((char *)event.name, 0);
+        SDL_SetRenderDrawColor(renderer, 64 + (color & 127), 64 + ((color >> 8) & 127), 64 + ((color >> 16) & 127), 255);
+        SDL_RenderFillRect(renderer, &bar);
+
+        // the name, if it fits, the times would be a new string to render every frame
+        SDL_Texture *text = getTextureFromString(renderer, text_cache, (char *)event.name, font);
+        int text_width = 0, text_height = 0;
+        SDL_QueryTexture(text, NULL, NULL, &text_width, &text_height);
+        if (!text_height) continue;
+        int label_width = text_width * bar.h / text_height;
+        if (label_width <= bar.w) SDL_RenderCopy(renderer, text, NULL, &(SDL_Rect) { bar.x, bar.y, label_width, bar.h });
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+#endif
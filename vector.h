@@ -26,9 +26,12 @@ uint64_t hashVector3(Vector3 vec)
     result |=  (uint64_t)vec.x & 0x00FFFFFF;
     result |= ((uint64_t)vec.z & 0x00FFFFFF) << 24;
     result |= ((uint64_t)vec.y) << 48;
-    result ^= result << 13;
-    result ^= result >> 7;
-    result ^= result << 17;
+    // splitmix64 finalizer, so that the low bits used for bucketing depend on every component
+    result ^= result >> 30;
+    result *= 0xBF58476D1CE4E5B9ull;
+    result ^= result >> 27;
+    result *= 0x94D049BB133111EBull;
+    result ^= result >> 31;
     return result;
 }
 